@@ -18,6 +18,8 @@
 #include <boost/foreach.hpp>
 #define foreach BOOST_FOREACH
 
+#include <kuri_mbzirc_challenge_2_tools/cluster_features.h>
+
 ros::Publisher  pub_cloud;
 ros::Publisher  pub_velo;
 
@@ -179,7 +181,13 @@ int main(int argc, char **argv)
 
   std::ofstream myfile;
   myfile.open ("velodyne_points.csv");
-  myfile << "Average distance, Points, Average Intensity\n";
+  myfile << "Average distance, Points, Average Intensity";
+  for (int id=0; id < FEATURE_COUNT; id++)
+    myfile << ", " << CLUSTER_FEATURE_NAMES[id];
+  myfile << "\n";
+
+  // Same features as the live detectors, to tune the cluster_classifier thresholds
+  ClusterFeatureExtractor feature_extractor;
 
   foreach(rosbag::MessageInstance const m, view)
   {
@@ -312,13 +320,23 @@ int main(int argc, char **argv)
           double intensity = 0;
           double count = tracked[ti].cloud->points.size();
 
+          std::vector<int> indices;
+          std::vector<float> intensities;
           for (int idx=0; idx < count; idx++)
           {
             intensity += tracked[ti].cloud->points[idx].intensity;
+            indices.push_back(idx);
+            intensities.push_back(tracked[ti].cloud->points[idx].intensity);
           }
           intensity /= count;
 
-          myfile << dist2 << ", " << count << ", " << intensity << "\n";
+          ClusterFeatures features;
+          feature_extractor.compute(*tracked[ti].cloud, indices, intensities, features);
+
+          myfile << dist2 << ", " << count << ", " << intensity;
+          for (int id=0; id < FEATURE_COUNT; id++)
+            myfile << ", " << clusterFeatureValue(features, id);
+          myfile << "\n";
         }
 
       }
@@ -0,0 +1,86 @@
+#ifndef KURI_MBZIRC_CHALLENGE_2_EXPLORATION_BACKGROUND_MAP_H_
+#define KURI_MBZIRC_CHALLENGE_2_EXPLORATION_BACKGROUND_MAP_H_
+
+#include <cmath>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include <boost/unordered_map.hpp>
+#include <boost/unordered_set.hpp>
+#include <Eigen/Geometry>
+#include <ros/ros.h>
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+/**
+ * Voxels of the arena that return points on every scan (fences, poles, the
+ * start area), so the box detector only clusters new structure.
+ *
+ * The map lives in a fixed frame (odom by default, which starts at the same
+ * place on every run) and is either loaded from a PCD file of voxel centers
+ * or learned over the first scans: a voxel hit in at least min_hit_ratio of
+ * them is static, unless it is within keep_out_radius of a panel candidate.
+ * Lookups are one hash probe per point.
+ */
+class BackgroundMap
+{
+public:
+  BackgroundMap();
+
+  // Reads the parameters under ns, e.g. "background_map/", and loads the map file if there is one
+  void loadParams(ros::NodeHandle& nh, const std::string& ns);
+
+  bool load(const std::string& path);
+  bool save(const std::string& path) const;
+
+  bool isEnabled() const  { return enabled_; }
+  bool isLearning() const { return enabled_ && learning_; }
+
+  // Static voxels can be filtered out
+  bool isReady() const    { return enabled_ && !learning_ && !static_.empty(); }
+
+  const std::string& getFrameId() const  { return frame_id_; }
+  const std::string& getFile() const     { return file_; }
+  bool saveLearned() const               { return save_learned_; }
+  size_t size() const                    { return static_.size(); }
+  int learnedScans() const               { return learned_scans_; }
+  int scansToLearn() const               { return learn_scans_; }
+
+  // Counts the voxels hit by a scan. to_map takes the cloud to the map frame.
+  void learnScan(const pcl::PointCloud<pcl::PointXYZ>& cloud, const Eigen::Affine3f& to_map);
+
+  // Turns the learned counts into the static map. keep_out is in the map frame.
+  void finishLearning(const std::vector<Eigen::Vector3f>& keep_out);
+
+  bool isStatic(const Eigen::Vector3f& p_map) const
+  {
+    return static_.find(key(p_map)) != static_.end();
+  }
+
+protected:
+  struct VoxelHits
+  {
+    int hits;
+    int last_scan;
+  };
+
+  bool enabled_;
+  std::string frame_id_;
+  double leaf_size_;
+  int learn_scans_;
+  double min_hit_ratio_;
+  double keep_out_radius_;
+  std::string file_;
+  bool save_learned_;
+
+  bool learning_;
+  int learned_scans_;
+  boost::unordered_map<uint64_t, VoxelHits> hits_;
+  boost::unordered_set<uint64_t> static_;
+
+  uint64_t key(const Eigen::Vector3f& p) const;
+  Eigen::Vector3f center(uint64_t k) const;
+};
+
+#endif
@@ -40,6 +40,8 @@
 #include <kuri_mbzirc_challenge_2_exploration/pointcloud_gps_filter.h>
 #include <kuri_mbzirc_challenge_2_msgs/BoxPositionAction.h>
 #include <kuri_mbzirc_challenge_2_tools/pose_conversion.h>
+#include <kuri_mbzirc_challenge_2_tools/visualization_sink.h>
+#include <kuri_mbzirc_challenge_2_tools/visualization_views.h>
 
 
 // Convinient typedefs
@@ -80,6 +82,12 @@ protected:
   ros::Publisher  pub_poses_;
   tf::TransformListener *tf_listener_;
 
+  // Declared after the publishers, so its thread stops before they are destroyed
+  VisualizationSink vis_sink_;
+  boost::shared_ptr<VisualizationChannel<ClustersView> > clusters_view_;
+  boost::shared_ptr<VisualizationChannel<PointsView> > points_view_;
+  boost::shared_ptr<VisualizationChannel<geometry_msgs::PoseArray> > poses_view_;
+
 
 
 
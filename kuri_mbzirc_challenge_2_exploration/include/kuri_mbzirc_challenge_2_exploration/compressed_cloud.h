@@ -0,0 +1,88 @@
+#ifndef KURI_MBZIRC_CHALLENGE_2_EXPLORATION_COMPRESSED_CLOUD_H_
+#define KURI_MBZIRC_CHALLENGE_2_EXPLORATION_COMPRESSED_CLOUD_H_
+
+#include <string>
+#include <vector>
+
+#include <ros/ros.h>
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+#include <sensor_msgs/PointCloud2.h>
+
+#include <kuri_mbzirc_challenge_2_msgs/CompressedPointCloud.h>
+
+/**
+ * Encoder for kuri_mbzirc_challenge_2_msgs/CompressedPointCloud.
+ *
+ * The origin is the center of the bounding box of the cloud, and the
+ * resolution is raised when needed so that the whole cloud fits in 16 bits.
+ * With ring ordering the points are sorted by (ring, azimuth) as seen from
+ * the origin of the cloud frame, so consecutive points are neighbours on the
+ * same ring and their deltas are small.
+ */
+class CompressedCloudEncoder
+{
+public:
+  CompressedCloudEncoder();
+
+  // Meters per quantization step
+  void setResolution(double resolution) { resolution_ = resolution; }
+
+  // Vertical angle between rings (rad), used to sort the points by ring
+  void setRingOrder(bool enabled, double vertical_resolution = 2.0*M_PI/180);
+
+  void loadParams(ros::NodeHandle& nh, const std::string& ns);
+
+  void encode(const pcl::PointCloud<pcl::PointXYZ>& cloud, kuri_mbzirc_challenge_2_msgs::CompressedPointCloud& msg);
+
+protected:
+  struct RingKey
+  {
+    int ring;
+    float azimuth;
+    int index;
+
+    bool operator<(const RingKey& other) const
+    {
+      return ring < other.ring || (ring == other.ring && azimuth < other.azimuth);
+    }
+  };
+
+  double resolution_;
+  bool ring_order_;
+  double vertical_resolution_;
+
+  std::vector<RingKey> order_;
+};
+
+// Returns false if the data is truncated. Points decoded so far are kept.
+bool decodeCompressedCloud(const kuri_mbzirc_challenge_2_msgs::CompressedPointCloud& msg, pcl::PointCloud<pcl::PointXYZ>& cloud);
+
+
+/**
+ * Publishes a cloud both as a sensor_msgs/PointCloud2 on <topic> and quantized
+ * on <topic>/compressed, converting it only for the topics that have
+ * subscribers. On the base side, compressed_cloud_republisher turns the
+ * compressed topic back into a PointCloud2 for RViz, so the full precision
+ * cloud never crosses the wireless link.
+ */
+class CompressedCloudPublisher
+{
+public:
+  void advertise(ros::NodeHandle& nh, const std::string& topic, int queue_size);
+  void publish(const pcl::PointCloud<pcl::PointXYZ>& cloud, const std::string& frame_id, const ros::Time& stamp);
+
+  CompressedCloudEncoder& encoder() { return encoder_; }
+  uint32_t getNumSubscribers() const { return pub_cloud_.getNumSubscribers() + pub_compressed_.getNumSubscribers(); }
+
+protected:
+  ros::Publisher pub_cloud_;
+  ros::Publisher pub_compressed_;
+  CompressedCloudEncoder encoder_;
+
+  // Reused between calls, publish() serializes them right away
+  sensor_msgs::PointCloud2 cloud_msg_;
+  kuri_mbzirc_challenge_2_msgs::CompressedPointCloud compressed_msg_;
+};
+
+#endif
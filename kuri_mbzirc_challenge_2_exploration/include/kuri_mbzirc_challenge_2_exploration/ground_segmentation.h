@@ -0,0 +1,150 @@
+#ifndef KURI_MBZIRC_CHALLENGE_2_EXPLORATION_GROUND_SEGMENTATION_H_
+#define KURI_MBZIRC_CHALLENGE_2_EXPLORATION_GROUND_SEGMENTATION_H_
+
+#include <cmath>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include <ros/ros.h>
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+typedef pcl::PointXYZ PcPoint;
+typedef pcl::PointCloud<PcPoint> PcCloud;
+
+
+/**
+ * Lidar scan stored as a structure of arrays, with every return tagged by
+ * its laser ring and azimuth sector. Coordinates are in the sensor frame.
+ */
+struct RingScan
+{
+  std::vector<float> x;
+  std::vector<float> y;
+  std::vector<float> z;
+  std::vector<float> range;       // Horizontal distance from the sensor
+  std::vector<uint16_t> ring;     // 0 is the lowest laser
+  std::vector<uint16_t> sector;
+  std::vector<uint32_t> index;    // Index of the point in the source cloud
+
+  size_t size() const { return x.size(); }
+
+  void clear()
+  {
+    x.clear(); y.clear(); z.clear();
+    range.clear(); ring.clear(); sector.clear(); index.clear();
+  }
+
+  void reserve(size_t n)
+  {
+    x.reserve(n); y.reserve(n); z.reserve(n);
+    range.reserve(n); ring.reserve(n); sector.reserve(n); index.reserve(n);
+  }
+
+  void swap(RingScan& other)
+  {
+    x.swap(other.x); y.swap(other.y); z.swap(other.z);
+    range.swap(other.range); ring.swap(other.ring); sector.swap(other.sector); index.swap(other.index);
+  }
+
+  void push_back(float px, float py, float pz, float r, uint16_t rg, uint16_t sec, uint32_t idx)
+  {
+    x.push_back(px); y.push_back(py); z.push_back(pz);
+    range.push_back(r); ring.push_back(rg); sector.push_back(sec); index.push_back(idx);
+  }
+};
+
+
+struct GroundSegmentationParams
+{
+  // Laser layout (VLP-16 by default). Rings are recovered from the elevation
+  // of each return when the cloud has no ring field.
+  int    num_rings;
+  double min_elevation;     // Elevation of the lowest ring (rad)
+  double elevation_step;    // Between consecutive rings (rad)
+  int    num_sectors;       // Azimuth bins over 360 degrees
+
+  double sensor_height;     // Expected ground height below the sensor on flat ground (m)
+  double height_tolerance;  // First ground cell of a sector is within this of -sensor_height (m)
+  double max_slope;         // Steepest ground slope between consecutive rings (rad)
+  double max_step;          // Height jump allowed between consecutive rings on top of the slope (m)
+  double ground_threshold;  // Points less than this above the local ground are ground (m)
+
+  GroundSegmentationParams():
+    num_rings(16),
+    min_elevation(-15*M_PI/180),
+    elevation_step(2*M_PI/180),
+    num_sectors(180),
+    sensor_height(0.8),
+    height_tolerance(0.3),
+    max_slope(15*M_PI/180),
+    max_step(0.1),
+    ground_threshold(0.15)
+  { }
+};
+
+
+/**
+ * Labels ground in a single lidar sweep in linear time.
+ *
+ * The scan is split into cells by ring and azimuth sector, and the lowest
+ * return of each cell is found. Each sector is then walked from the lowest
+ * ring outwards: the first ground cell must lie within height_tolerance of
+ * -sensor_height, and every later one must be reachable from the last ground
+ * cell without exceeding max_slope and max_step, otherwise the last ground
+ * height is carried over. Every point
+ * gets its height above the ground of its own cell, so height gates follow
+ * uneven terrain instead of a fixed z band in the sensor frame.
+ */
+class GroundSegmenter
+{
+public:
+  GroundSegmenter();
+
+  void setParams(const GroundSegmentationParams& params);
+  const GroundSegmentationParams& getParams() { return params_; }
+
+  // Reads the parameters under ns, e.g. "ground_segmentation/"
+  static void loadParams(ros::NodeHandle& nh, const std::string& ns, GroundSegmentationParams& params);
+
+  // Bins a cloud given in the sensor frame. Non-finite points are skipped.
+  void toRingScan(const PcCloud& cloud, RingScan& scan);
+
+  // Labels the points of scan. The results are indexed like scan.
+  void segment(const RingScan& scan);
+
+  // Converts the cloud into an internal RingScan (see scan()) and segments it
+  void segment(const PcCloud& cloud);
+
+  // Segments a scan that is already binned, e.g. decoded from packets. It is
+  // swapped with the internal one (see scan()), so both keep their buffers.
+  void segmentSwap(RingScan& scan);
+
+  const RingScan& scan() { return scan_; }
+
+  // Per point of the last segmented scan
+  const std::vector<uint8_t>& groundMask() { return ground_; }
+  const std::vector<float>& heights() { return height_; }
+  size_t groundCount() { return ground_count_; }
+
+  // Non-ground points of the last segment(cloud) call with a height above the local ground within [min_height, max_height]
+  void extractObstacles(const PcCloud& cloud, double min_height, double max_height, PcCloud& cloud_out);
+
+protected:
+  GroundSegmentationParams params_;
+
+  RingScan scan_;
+  std::vector<uint8_t> ground_;
+  std::vector<float> height_;
+  size_t ground_count_;
+
+  // Per (ring, sector) cell
+  std::vector<float> cell_min_z_;
+  std::vector<float> cell_range_;
+  std::vector<float> cell_ground_z_;
+
+  inline size_t cell(uint16_t ring, uint16_t sector) { return size_t(sector)*params_.num_rings + ring; }
+};
+
+#endif
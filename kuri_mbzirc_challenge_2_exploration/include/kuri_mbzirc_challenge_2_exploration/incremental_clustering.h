@@ -0,0 +1,106 @@
+#ifndef KURI_MBZIRC_CHALLENGE_2_EXPLORATION_INCREMENTAL_CLUSTERING_H_
+#define KURI_MBZIRC_CHALLENGE_2_EXPLORATION_INCREMENTAL_CLUSTERING_H_
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include <boost/unordered_map.hpp>
+#include <Eigen/Geometry>
+#include <ros/ros.h>
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+#include <pcl/PointIndices.h>
+
+/**
+ * Euclidean clustering that carries its labels over from scan to scan.
+ *
+ * Occupied voxels of a fixed frame (odom) are the nodes of a union-find
+ * forest; two voxels are connected when they are at most connect_radius
+ * voxels apart on every axis, which stands in for the cluster tolerance.
+ * Each scan only:
+ *   - links the voxels that became occupied to their occupied neighbours
+ *     (merges are unions),
+ *   - marks the clusters that lost a voxel as dirty, and rebuilds each dirty
+ *     cluster once by flood fill over its own voxels (splits are lazy),
+ * so the neighbour searches depend on how much of the scene changed rather
+ * than on its size. A voxel is dropped after max_missed_scans scans without
+ * a point, which keeps sparse far returns from flickering in and out.
+ */
+class IncrementalClusterer
+{
+public:
+  IncrementalClusterer();
+
+  // Reads the parameters under ns, e.g. "incremental_clustering/"
+  void loadParams(ros::NodeHandle& nh, const std::string& ns);
+
+  bool isEnabled() const { return enabled_; }
+  const std::string& getFrameId() const { return frame_id_; }
+
+  void setClusterSize(int min_size, int max_size) { min_cluster_size_ = min_size; max_cluster_size_ = max_size; }
+
+  /**
+   * Updates the voxel labels with a scan and returns its points grouped by
+   * cluster, like pcl::EuclideanClusterExtraction::extract. to_frame takes
+   * the cloud to the clustering frame.
+   */
+  void update(const pcl::PointCloud<pcl::PointXYZ>& cloud, const Eigen::Affine3f& to_frame, std::vector<pcl::PointIndices>& clusters);
+
+  void clear();
+
+  // Work done by the last update
+  size_t numVoxels() const      { return voxels_.size(); }
+  size_t numAdded() const       { return added_.size(); }
+  size_t numRemoved() const     { return num_removed_; }
+  size_t numRebuilt() const     { return num_rebuilt_; }   // Voxels relabeled by lazy rebuilds
+
+protected:
+  struct Voxel
+  {
+    int node;        // -1 until linked
+    int last_seen;   // Update count
+  };
+
+  bool enabled_;
+  std::string frame_id_;
+  double leaf_size_;
+  int connect_radius_;
+  int max_missed_scans_;
+  int min_cluster_size_;
+  int max_cluster_size_;
+
+  int scan_;
+  boost::unordered_map<uint64_t, Voxel> voxels_;
+  std::vector<uint64_t> active_;          // Keys of the linked voxels
+  std::vector<int64_t> neighbour_offsets_;
+
+  // Union-find forest. Nodes are recycled through free_nodes_.
+  std::vector<int> parent_;
+  std::vector<uint64_t> node_key_;
+  std::vector<std::vector<int> > members_;  // Nodes of each root, including the ones of dropped voxels
+  std::vector<char> dirty_;
+  std::vector<int> free_nodes_;
+
+  // Per update
+  std::vector<uint64_t> added_;
+  std::vector<int> dirty_roots_;
+  std::vector<uint64_t> point_keys_;
+  std::vector<int> root_label_;
+  std::vector<int> root_label_scan_;
+  std::vector<uint64_t> queue_;
+  size_t num_removed_;
+  size_t num_rebuilt_;
+
+  uint64_t key(const Eigen::Vector3f& p) const;
+  void computeOffsets();
+
+  int  newNode(uint64_t k);
+  int  find(int node);
+  void unite(int a, int b);
+  void markDirty(int node);
+  void link(uint64_t k);
+  void rebuild(int root);
+};
+
+#endif
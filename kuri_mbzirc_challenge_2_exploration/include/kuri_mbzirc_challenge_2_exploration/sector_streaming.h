@@ -0,0 +1,134 @@
+#ifndef KURI_MBZIRC_CHALLENGE_2_EXPLORATION_SECTOR_STREAMING_H_
+#define KURI_MBZIRC_CHALLENGE_2_EXPLORATION_SECTOR_STREAMING_H_
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include <boost/unordered_map.hpp>
+#include <ros/ros.h>
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+#include <pcl/PointIndices.h>
+
+#include <kuri_mbzirc_challenge_2_exploration/ground_segmentation.h>
+
+/**
+ * Clusters a lidar sweep while it arrives, a few packets at a time, instead
+ * of waiting for the whole revolution.
+ *
+ * Points wait until the sweep has left their azimuth sector, which makes the
+ * sector complete for the ground segmentation. The obstacles it keeps go into
+ * a union-find over voxels: voxels at most connect_radius voxels apart on
+ * every axis are in the same cluster, as in IncrementalClusterer. A cluster
+ * stays open while a point still to come could reach it, that is while the
+ * sweep is less than asin(reach/range) past its last point, with reach the
+ * voxel connection distance and range its nearest point. Past that it is
+ * finished and handed out, only milliseconds after the beam left it.
+ * Clusters close to the azimuth where the sweep started stay open until the
+ * revolution is complete, since its end may still join them.
+ *
+ * Coordinates are in the sensor frame, in sweep order (clockwise from above).
+ */
+class SectorStreamer
+{
+public:
+  SectorStreamer();
+
+  // Reads the parameters under ns, e.g. "sector_streaming/"
+  void loadParams(ros::NodeHandle& nh, const std::string& ns);
+
+  bool isEnabled() const { return enabled_; }
+
+  void setGroundSegmentation(const GroundSegmentationParams& params, double min_height, double max_height);
+
+  // Range (m) and angle (rad, counterclockwise from x) window of the kept points
+  void setLimits(double r_min, double r_max, double a_min, double a_max);
+
+  /**
+   * Adds the points of scan from begin on, where scan.index refers to cloud and
+   * intensity (which may be empty). Stops early at the end of a revolution and
+   * returns the index of the first point not added, scan.size() otherwise.
+   * The clusters finished meanwhile are in finished().
+   */
+  size_t add(const pcl::PointCloud<pcl::PointXYZ>& cloud, const std::vector<float>& intensity, const RingScan& scan, size_t begin = 0);
+
+  // The revolution is complete and every cluster finished. Call startSweep() before adding more.
+  bool sweepDone() const { return sweep_done_; }
+  void startSweep();
+
+  // Obstacle points of the current revolution, which finished() refers to
+  const pcl::PointCloud<pcl::PointXYZ>& obstacles() const { return obstacles_; }
+  const std::vector<float>& obstacleIntensity() const     { return obstacle_intensity_; }
+
+  // Clusters finished by the last add(), within the cluster size limits
+  const std::vector<pcl::PointIndices>& finished() const  { return finished_; }
+
+  size_t numOpen() const { return open_.size(); }
+
+protected:
+  struct Cluster
+  {
+    std::vector<int> points;   // In obstacles_
+    float min_range;
+    float first_angle;         // Sweep angles of its first and last point
+    float last_angle;
+  };
+
+  bool enabled_;
+  double leaf_size_;
+  int connect_radius_;
+  int min_cluster_size_;
+  int max_cluster_size_;
+
+  double min_height_;
+  double max_height_;
+  double r_min_, r_max_;
+  double a_min_, a_max_;
+
+  GroundSegmenter ground_segmenter_;
+  int num_sectors_;
+
+  // Sweep
+  bool has_start_;
+  bool sweep_done_;
+  float start_azimuth_;
+  float last_angle_;
+
+  // Points of the sectors the sweep is still in, and their sweep angles
+  RingScan pending_;
+  std::vector<float> pending_intensity_;
+  std::vector<float> pending_angle_;
+
+  // Completed sectors, handed to the ground segmentation
+  RingScan complete_;
+
+  pcl::PointCloud<pcl::PointXYZ> obstacles_;
+  std::vector<float> obstacle_intensity_;
+
+  // Union-find over the voxels of the obstacles. Node i is a voxel, and each
+  // root holds its cluster.
+  boost::unordered_map<uint64_t, int> voxels_;
+  std::vector<int64_t> neighbour_offsets_;
+  std::vector<int> parent_;
+  std::vector<Cluster> clusters_;
+  std::vector<char> done_;
+  std::vector<int> open_;          // Roots that may still grow, and stale entries of merged ones
+  float reach_;                    // Farthest a voxel connects to, horizontally
+
+  std::vector<pcl::PointIndices> finished_;
+
+  void computeOffsets();
+  uint64_t key(float x, float y, float z) const;
+  int  find(int node);
+  int  unite(int a, int b);
+
+  // Segments the first n pending points and clusters their obstacles
+  void processPending(size_t n);
+  void insert(float x, float y, float z, float intensity, float range, float angle);
+
+  // Hands out the open clusters the sweep has moved past, or all of them
+  void finish(float sweep_angle, bool all);
+};
+
+#endif
@@ -11,9 +11,31 @@
 #include <pcl/common/transforms.h>
 #include <pcl/common/common.h>
 #include <pcl/io/pcd_io.h>
+#include <pcl/search/kdtree.h>
+#include <pcl/PointIndices.h>
 #include <pcl_conversions/pcl_conversions.h>
+#include <ros/callback_queue.h>
+#include <boost/atomic.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/thread.hpp>
 
 #include "../include/kuri_mbzirc_challenge_2_exploration/pointcloud_gps_filter.h"
+#include <kuri_mbzirc_challenge_2_exploration/background_map.h>
+#include <kuri_mbzirc_challenge_2_exploration/compressed_cloud.h>
+#include <kuri_mbzirc_challenge_2_exploration/ground_segmentation.h>
+#include <kuri_mbzirc_challenge_2_exploration/incremental_clustering.h>
+#include <kuri_mbzirc_challenge_2_exploration/sector_streaming.h>
+#include <kuri_mbzirc_challenge_2_exploration/velodyne_packet_decoder.h>
+#include <kuri_mbzirc_challenge_2_tools/cluster_features.h>
+#include <kuri_mbzirc_challenge_2_tools/latest_value.h>
+#include <kuri_mbzirc_challenge_2_tools/min_area_rect.h>
+#include <kuri_mbzirc_challenge_2_tools/motion_gated_scheduler.h>
+#include <kuri_mbzirc_challenge_2_tools/pipeline_ring.h>
+#include <kuri_mbzirc_challenge_2_tools/scan_arena.h>
+#include <kuri_mbzirc_challenge_2_tools/stats_reporter.h>
+#include <kuri_mbzirc_challenge_2_tools/visualization_sink.h>
+#include <kuri_mbzirc_challenge_2_tools/visualization_views.h>
 #include <kuri_mbzirc_challenge_2_msgs/BoxPositionAction.h>
 
 
@@ -28,6 +50,9 @@ typedef pcl::PointCloud<PcPoint> PcCloud;
 typedef pcl::PointCloud<PcPoint>::Ptr PcCloudPtr;
 typedef std::vector<PcCloudPtr> PcCloudPtrList;
 
+// Temporary lists of one scan, allocated from the scan arena
+typedef std::vector<bool, ArenaAllocator<bool> > ScanFlagList;
+
 
 class Belief
 {
@@ -98,12 +123,94 @@ public:
   }
 };
 
+// Sensor state handed from the state callbacks to the cluster thread
+struct GpsSample
+{
+  double lat, lon;
+  uint64_t seq;
+};
+
+struct OrientationSample
+{
+  double x, y, z, w;
+};
+
+struct PoseSample
+{
+  double x, y, z;
+  double qx, qy, qz, qw;
+};
+
+// Start goal handed from the action thread to the cluster thread
+struct StartRequest
+{
+  double range_min, range_max;
+  double angle_min, angle_max;
+};
+
+// A scan decoded by the velodyne thread, waiting to be clustered. The slots
+// of the ring are reused, so the cloud and intensity keep their capacity.
+struct DecodedScan
+{
+  PcCloudPtr cloud;
+  std::vector<float> intensity;   // Per point of cloud, empty if the scan has none
+  RingScan ring_scan;             // Binned by the packet decoder, indexed like cloud
+  bool has_ring_scan;
+  bool follows_gap;               // Scans before it were lost or dropped since the last one pushed
+  std_msgs::Header header;
+  ros::WallTime received;
+
+  // Sensor poses looked up when the scan arrived
+  bool has_sensor_to_map;
+  Eigen::Transform<float, 3, Eigen::Affine, Eigen::DontAlign> sensor_to_map;
+  bool has_sensor_to_cluster_frame;
+  Eigen::Transform<float, 3, Eigen::Affine, Eigen::DontAlign> sensor_to_cluster_frame;
+
+  DecodedScan():
+    cloud(new PcCloud),
+    has_ring_scan(false),
+    follows_gap(false),
+    has_sensor_to_map(false),
+    has_sensor_to_cluster_frame(false)
+  { }
+};
+
 struct BoxCluster{
   PcCloudPtr point_cloud;
+  OrientedRect footprint;   // Of point_cloud
   geometry_msgs::Pose pose;
   Belief confidence;
 };
 
+// Tracker output after a scan. Never modified once published, so any thread
+// can read it without locking.
+struct PanelState
+{
+  geometry_msgs::Pose pose;
+  geometry_msgs::Vector3 extents;   // Width (long side), depth and height of the fitted box
+  double confidence;
+  int num_points;
+};
+
+struct PanelSnapshot
+{
+  ros::Time stamp;
+  std::string frame_id;
+  uint64_t scan;
+  std::vector<PanelState> panels;   // Most confident first
+  PcCloud cloud;                    // Points of all the tracked clusters
+};
+
+typedef boost::shared_ptr<const PanelSnapshot> PanelSnapshotConstPtr;
+
+// What the visualization thread needs to build its messages
+struct CloudView
+{
+  boost::shared_ptr<const PcCloud> cloud;
+  std::string frame_id;
+  ros::Time stamp;
+};
+
 // ======
 // Classes
 // ======
@@ -131,38 +238,193 @@ protected:
 
   std::vector<BoxCluster> cluster_list;
   PcCloudPtr pc_current_;
-  PcCloudPtr pc_prev_;
 
   PointcloudGpsFilter gps_filter_;
+
+  // Points kept for clustering, as height above the local ground
+  GroundSegmenter ground_segmenter_;
+  double min_height_;
+  double max_height_;
+
+  // Early rejection of non-panel clusters
+  ClusterFeatureExtractor feature_extractor_;
+  ClusterClassifier cluster_classifier_;
+
+  // Oriented footprint of the clusters, for the panel pose and extents
+  MinAreaRectFitter rect_fitter_;
+  std::vector<float> intensity_current_;  // Per point of pc_current_, empty if the cloud has none
+  std::vector<float> filtered_intensity_; // Per point of the output of filterCloudRangeAngle
+
+  // Region of interest mode: while a panel is tracked with enough confidence, only
+  // the points around the tracked panels are processed, except for a full scan
+  // every roi_full_scan_interval_ frames to pick up new candidates
+  bool   roi_enabled_;
+  double roi_min_confidence_;
+  double roi_radius_;
+  int    roi_full_scan_interval_;
+  int    frame_count_;
+
+  // Known static structure of the arena, dropped before clustering
+  BackgroundMap background_map_;
+  Eigen::Transform<float, 3, Eigen::Affine, Eigen::DontAlign> sensor_to_map_;
+  bool   has_sensor_to_map_;   // For the current scan
+  int    background_dropped_;
+
+  bool has_odom_;        // current_odom holds a real sample
+  bool has_prev_odom_;
+  geometry_msgs::Pose prev_odom_pose_;
+
+  // Drops to a heartbeat rate while the robot stands still and the tracker has settled
+  MotionGatedScheduler scheduler_;
+
+  StatsReporter stats_;
+
+  // The velodyne and the state topics (GPS, IMU, odometry) are served by
+  // separate callback queues and threads, so a slow scan never delays the
+  // state updates. The state reaches the cluster thread through lock-free
+  // cells, and the GPS filter is only touched by the cluster thread.
+  ros::NodeHandle nh_velo_;
+  ros::NodeHandle nh_state_;
+  ros::CallbackQueue velo_queue_;
+  ros::CallbackQueue state_queue_;
+  boost::scoped_ptr<ros::AsyncSpinner> velo_spinner_;
+  boost::scoped_ptr<ros::AsyncSpinner> state_spinner_;
+
+  LatestValue<GpsSample> latest_gps_;
+  LatestValue<OrientationSample> latest_orientation_;
+  LatestValue<PoseSample> latest_odom_;
+  uint32_t gps_version_;
+  uint32_t orientation_version_;
+
+  // Only the cluster thread touches the limits and is_initiatializing_, it
+  // applies a new start goal before the next scan
+  LatestValue<StartRequest> start_request_;
+  uint32_t start_version_;
+
+  void updateSensorState();
+  void applyStartRequest();
+
+  // Two stage pipeline: the velodyne thread decodes each scan into a slot of
+  // scan_ring_ while the cluster thread filters, clusters and tracks the
+  // previous one. The tracker and the scan buffers are only used by the
+  // cluster thread.
+  boost::scoped_ptr<PipelineRing<DecodedScan> > scan_ring_;
+  boost::thread cluster_thread_;
+  boost::atomic<bool> tracker_settled_;   // For the motion gating of the velodyne thread
+
+  // Velodyne thread. Scans lost by the subscriber queue show up as gaps in the sequence numbers.
+  VelodynePacketDecoder packet_decoder_;
+  uint32_t last_seq_;
+  bool     has_last_seq_;
+  bool     scan_gap_;
+  uint64_t missed_scans_;
+
+  // Cluster thread
+  RingScan* decoded_ring_scan_;   // Of the current scan, until the ground segmenter takes it
+  ros::WallTime throughput_start_;
+  int      throughput_scans_;
+
+  void startPipeline(int depth);
+  void stopPipeline();
+  DecodedScan* beginScan(const std_msgs::Header& header);
+  void endScan(DecodedScan* scan, const std_msgs::Header& header, const ros::WallTime& received);
+  void clusterLoop();
+  void processScan(DecodedScan& scan);
+
+  // Sector streaming: the scans are chunks of a revolution, and the tracked
+  // clusters are matched as soon as the sweep has moved past a cluster. The
+  // misses are counted once per revolution.
+  SectorStreamer sector_streamer_;
+  bool stream_sweep_started_;
+  bool stream_initializing_;          // The revolution started while initializing, its clusters are added
+  std::vector<char> stream_matched_;  // Per tracked cluster, in the current revolution
+
+  void processChunk(DecodedScan& scan);
+  void restartStreamedSweep();
+  void startStreamedSweep();
+  int  matchStreamedClusters();
+  void finishStreamedSweep();
+
+  // Swapped atomically after each scan. cluster_list itself is only used by the cluster thread.
+  PanelSnapshotConstPtr snapshot_;
+  uint64_t scan_count_;
+
+  void publishSnapshot(const std::string& frame_id, const ros::Time& stamp);
+
+  // Transient buffers of callbackVelo. The arena is reset and the clouds
+  // recycled after every scan, so a steady stream of scans barely mallocs.
+  ScanArena scan_arena_;
+  bool scan_arena_enabled_;
+  CloudPool<PcPoint> cloud_pool_;
+  pcl::search::KdTree<PcPoint>::Ptr cluster_tree_;
+  std::vector<pcl::PointIndices> cluster_indices_;
+
+  // Clustering that keeps its voxel labels between full scans
+  IncrementalClusterer incremental_clusterer_;
+  Eigen::Transform<float, 3, Eigen::Affine, Eigen::DontAlign> sensor_to_cluster_frame_;
+  bool   use_incremental_clustering_;   // For the current scan
+  std::vector<float> roi_intensity_;
+
+  // Messages for RViz are built and published by the sink thread
+  VisualizationSink vis_sink_;
+  boost::shared_ptr<VisualizationChannel<CloudView> > cluster_view_;
+  boost::shared_ptr<VisualizationChannel<PointsView> > points_view_;
+
+  void publishClusterView(const CloudView& view);
 public:
   ros::Subscriber sub_gps;
   ros::Subscriber sub_imu;
   ros::Subscriber sub_odom;
   ros::Subscriber sub_velo;
-  ros::Publisher  pub_wall;
+  CompressedCloudPublisher pub_wall;  // Also on /explore/PCL/compressed for the base station
   ros::Publisher  pub_lines;
   ros::Publisher  pub_points;
   tf::TransformListener *tf_listener;
-  nav_msgs::Odometry current_odom;
+  nav_msgs::Odometry current_odom;  // Pose only, refreshed from latest_odom_ at the start of each scan
 
   BoxPositionActionHandler(std::string name, std::vector<GeoPoint> bounds);
-  ~BoxPositionActionHandler(){}
+  ~BoxPositionActionHandler();
 
   // actionlib
   void executeCB(const GoalConstPtr &goal);
   void setSuccess(bool success = true);
 
+  void setClusterClassifier(ros::NodeHandle& nh, const std::string& ns);
+  void setRoiMode(ros::NodeHandle& nh, const std::string& ns);
+  void setScanArena(ros::NodeHandle& nh, const std::string& ns);
+  void setCloudCompression(ros::NodeHandle& nh, const std::string& ns);
+  void setBackgroundMap(ros::NodeHandle& nh, const std::string& ns);
+  void setIncrementalClustering(ros::NodeHandle& nh, const std::string& ns);
+  void setMotionGating(ros::NodeHandle& nh, const std::string& ns);
+  void setPipeline(ros::NodeHandle& nh, const std::string& ns);   // Before the scans start
+  void setPacketDecoding(ros::NodeHandle& nh, const std::string& ns);
+  void setSectorStreaming(ros::NodeHandle& nh, const std::string& ns);  // After setPacketDecoding
+  void setVisualizationRate(double rate);
+  void setGroundSegmentation(const GroundSegmentationParams& params, double min_height, double max_height);
+
+  // Latest tracker state, safe to call from any thread. Null before the first scan.
+  PanelSnapshotConstPtr getSnapshot() const;
+
   void callbackGPS(const sensor_msgs::NavSatFix::ConstPtr& msg);
   void callbackIMU(const sensor_msgs::Imu::ConstPtr& msg);
   void callbackOdom(const nav_msgs::Odometry::ConstPtr& odom_msg);
   void callbackVelo(const sensor_msgs::PointCloud2::ConstPtr& cloud_msg);
+  void callbackPackets(const velodyne_msgs::VelodyneScan::ConstPtr& scan_msg);
 
-  void              computeBoundingBox(PcCloudPtrList& pc_vector,std::vector<Eigen::Vector3f>& dimension_list, std::vector<Eigen::Vector4f>& centroid_list, std::vector<std::vector<PcPoint> >& corners);
   PcCloudPtrList    getCloudClusters(PcCloudPtr cloud_ptr);
+  PcCloudPtrList    getClusterClouds(const PcCloud& cloud, const std::vector<pcl::PointIndices>& cluster_indices, const std::vector<float>& intensity);
+  PcCloudPtrList    filterBoxSize(PcCloudPtrList& pc_vector, std::vector<OrientedRect>& footprints);
+  void              setDefaultLimits();
   void              getInitialBoxClusters();
-  std::vector<geometry_msgs::Pose>   getPanelPose(PcCloudPtrList);
-  PcCloudPtrList    extractBoxClusters(PcCloudPtr cloud_ptr);
+  std::vector<geometry_msgs::Pose>   getPanelPose(const PcCloudPtrList& clusters, const std::vector<OrientedRect>& footprints);
+  PcCloudPtrList    extractBoxClusters(PcCloudPtr cloud_ptr, std::vector<OrientedRect>& footprints);
+  void              predictClusters();
+  bool              selectRoi(ScanFlagList& in_roi);
+  bool              isTrackerSettled();
+  PcCloudPtr        filterCloudRoi(PcCloudPtr cloud_ptr, const ScanFlagList& in_roi);
   PcCloudPtr        filterCloudRangeAngle(PcCloudPtr cloud_ptr, double r_min, double r_max, double a_min = -M_PI, double a_max = M_PI);
+  bool              lookupSensorTransform(const std::string& frame_out, const std::string& sensor_frame, Eigen::Transform<float, 3, Eigen::Affine, Eigen::DontAlign>& transform);
+  void              learnBackground(PcCloudPtr cloud_ptr);
   void              transformToFrame(PcCloudPtr cloud_in, PcCloudPtr& cloud_out, std::string frame_in, std::string frame_out);
 
   void drawPoints(std::vector<geometry_msgs::Point> points, std::string frame_id);
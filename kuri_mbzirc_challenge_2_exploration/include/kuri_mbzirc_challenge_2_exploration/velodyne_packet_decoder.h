@@ -0,0 +1,68 @@
+#ifndef KURI_MBZIRC_CHALLENGE_2_EXPLORATION_VELODYNE_PACKET_DECODER_H_
+#define KURI_MBZIRC_CHALLENGE_2_EXPLORATION_VELODYNE_PACKET_DECODER_H_
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include <ros/ros.h>
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+#include <velodyne_msgs/VelodyneScan.h>
+
+#include <kuri_mbzirc_challenge_2_exploration/ground_segmentation.h>
+
+/**
+ * Decodes raw VLP-16 packets (velodyne_msgs/VelodyneScan) straight into the
+ * cloud, intensity and RingScan used by the box detector, without the
+ * velodyne_pointcloud node and the PointCloud2 round trip in between.
+ *
+ * Every trigonometric term is looked up: sin/cos of the azimuth in steps of
+ * 0.01 degree (the packet resolution), sin/cos of each laser's elevation,
+ * and the RingScan sector of each azimuth step. The ring comes from the
+ * laser id rather than from the elevation of the return, and points are
+ * in the same frame and axes as velodyne_pointcloud's output. Only single
+ * return mode is supported.
+ */
+class VelodynePacketDecoder
+{
+public:
+  VelodynePacketDecoder();
+
+  // Reads the parameters under ns, e.g. "velodyne_packets/"
+  void loadParams(ros::NodeHandle& nh, const std::string& ns);
+
+  bool isEnabled() const                 { return enabled_; }
+  const std::string& getTopic() const    { return topic_; }
+
+  // Sectors of the RingScan, must match the ground segmentation
+  void setNumSectors(int num_sectors);
+
+  /**
+   * Decodes a whole revolution. scan.index refers to the points of cloud,
+   * and intensity has one value per point. The outputs are cleared first,
+   * so buffers kept between calls are reused. Returns the number of points.
+   */
+  size_t decode(const velodyne_msgs::VelodyneScan& msg, pcl::PointCloud<pcl::PointXYZ>& cloud, std::vector<float>& intensity, RingScan& scan);
+
+protected:
+  bool enabled_;
+  std::string topic_;
+  double min_range_;
+  double max_range_;
+  int num_sectors_;
+
+  // Per azimuth step of 0.01 degree
+  std::vector<float> cos_azimuth_;
+  std::vector<float> sin_azimuth_;
+  std::vector<uint16_t> sector_;
+
+  // Per laser id
+  std::vector<float> cos_elevation_;
+  std::vector<float> sin_elevation_;
+  std::vector<uint16_t> ring_;
+
+  void computeTables();
+};
+
+#endif
@@ -0,0 +1,150 @@
+#include <algorithm>
+#include <cmath>
+
+#include <pcl/io/pcd_io.h>
+
+#include <kuri_mbzirc_challenge_2_exploration/background_map.h>
+
+// 21 bits per axis, centered so that negative coordinates are valid
+static const int64_t KEY_OFFSET = 1 << 20;
+static const uint64_t KEY_MASK = (1 << 21) - 1;
+
+
+BackgroundMap::BackgroundMap():
+  enabled_(false),
+  frame_id_("odom"),
+  leaf_size_(0.5),
+  learn_scans_(50),
+  min_hit_ratio_(0.8),
+  keep_out_radius_(3.0),
+  save_learned_(false),
+  learning_(true),
+  learned_scans_(0)
+{
+}
+
+
+void BackgroundMap::loadParams(ros::NodeHandle& nh, const std::string& ns)
+{
+  nh.param(ns + "enabled", enabled_, enabled_);
+  nh.param(ns + "frame_id", frame_id_, frame_id_);
+  nh.param(ns + "leaf_size", leaf_size_, leaf_size_);
+  nh.param(ns + "learn_scans", learn_scans_, learn_scans_);
+  nh.param(ns + "min_hit_ratio", min_hit_ratio_, min_hit_ratio_);
+  nh.param(ns + "keep_out_radius", keep_out_radius_, keep_out_radius_);
+  nh.param(ns + "file", file_, file_);
+  nh.param(ns + "save_learned", save_learned_, save_learned_);
+
+  learning_ = (learn_scans_ > 0);
+  learned_scans_ = 0;
+  hits_.clear();
+  static_.clear();
+
+  if (enabled_ && !file_.empty() && !save_learned_)
+    load(file_);
+}
+
+
+bool BackgroundMap::load(const std::string& path)
+{
+  pcl::PointCloud<pcl::PointXYZ> centers;
+  if (pcl::io::loadPCDFile(path, centers) < 0)
+    return false;
+
+  static_.clear();
+  for (size_t i=0; i < centers.points.size(); i++)
+  {
+    const pcl::PointXYZ& p = centers.points[i];
+    static_.insert(key(Eigen::Vector3f(p.x, p.y, p.z)));
+  }
+
+  learning_ = false;
+  hits_.clear();
+  return true;
+}
+
+
+bool BackgroundMap::save(const std::string& path) const
+{
+  pcl::PointCloud<pcl::PointXYZ> centers;
+  centers.points.reserve(static_.size());
+
+  for (boost::unordered_set<uint64_t>::const_iterator it = static_.begin(); it != static_.end(); ++it)
+  {
+    Eigen::Vector3f c = center(*it);
+    centers.points.push_back(pcl::PointXYZ(c[0], c[1], c[2]));
+  }
+
+  centers.width = centers.points.size();
+  centers.height = 1;
+  centers.is_dense = true;
+
+  return !centers.points.empty() && pcl::io::savePCDFileBinary(path, centers) >= 0;
+}
+
+
+void BackgroundMap::learnScan(const pcl::PointCloud<pcl::PointXYZ>& cloud, const Eigen::Affine3f& to_map)
+{
+  // A voxel counts once per scan, however many points it gets
+  for (size_t i=0; i < cloud.points.size(); i++)
+  {
+    const pcl::PointXYZ& p = cloud.points[i];
+    VoxelHits& v = hits_[ key(to_map*Eigen::Vector3f(p.x, p.y, p.z)) ];
+
+    if (v.hits == 0 || v.last_scan != learned_scans_)
+    {
+      v.hits++;
+      v.last_scan = learned_scans_;
+    }
+  }
+
+  learned_scans_++;
+}
+
+
+void BackgroundMap::finishLearning(const std::vector<Eigen::Vector3f>& keep_out)
+{
+  int min_hits = std::max(1, (int) std::ceil(min_hit_ratio_*learned_scans_));
+  double keep_out_sq = keep_out_radius_*keep_out_radius_;
+
+  static_.clear();
+  for (boost::unordered_map<uint64_t, VoxelHits>::const_iterator it = hits_.begin(); it != hits_.end(); ++it)
+  {
+    if (it->second.hits < min_hits)
+      continue;
+
+    // Never learn a panel candidate as background
+    Eigen::Vector3f c = center(it->first);
+    bool near_candidate = false;
+    for (size_t i=0; i < keep_out.size() && !near_candidate; i++)
+      near_candidate = (c.head<2>() - keep_out[i].head<2>()).squaredNorm() < keep_out_sq;
+
+    if (!near_candidate)
+      static_.insert(it->first);
+  }
+
+  hits_.clear();
+  learning_ = false;
+}
+
+
+uint64_t BackgroundMap::key(const Eigen::Vector3f& p) const
+{
+  int64_t x = (int64_t) std::floor(p[0]/leaf_size_);
+  int64_t y = (int64_t) std::floor(p[1]/leaf_size_);
+  int64_t z = (int64_t) std::floor(p[2]/leaf_size_);
+
+  return (uint64_t(x + KEY_OFFSET) & KEY_MASK)
+      | ((uint64_t(y + KEY_OFFSET) & KEY_MASK) << 21)
+      | ((uint64_t(z + KEY_OFFSET) & KEY_MASK) << 42);
+}
+
+
+Eigen::Vector3f BackgroundMap::center(uint64_t k) const
+{
+  int64_t x = int64_t(k & KEY_MASK) - KEY_OFFSET;
+  int64_t y = int64_t((k >> 21) & KEY_MASK) - KEY_OFFSET;
+  int64_t z = int64_t((k >> 42) & KEY_MASK) - KEY_OFFSET;
+
+  return Eigen::Vector3f((x + 0.5)*leaf_size_, (y + 0.5)*leaf_size_, (z + 0.5)*leaf_size_);
+}
@@ -1,4 +1,5 @@
 #include <kuri_mbzirc_challenge_2_exploration/box_location.h>
+#include <kuri_mbzirc_challenge_2_tools/async_logger.h>
 
 BoxLocator::BoxLocator(actionlib::SimpleActionServer<ServerAction>* actionserver, bool bypass)
 {
@@ -13,6 +14,16 @@ BoxLocator::BoxLocator(actionlib::SimpleActionServer<ServerAction>* actionserver
   pub_points_= node.advertise<visualization_msgs::Marker>("/explore/points", 10);
   pub_poses_ = node.advertise<geometry_msgs::PoseArray>("/explore/poses", 10);
 
+  clusters_view_ = vis_sink_.addChannel<ClustersView>(
+        boost::bind(&ros::Publisher::getNumSubscribers, &pub_wall_),
+        boost::bind(publishClustersView, boost::cref(pub_wall_), _1));
+  points_view_ = vis_sink_.addChannel<PointsView>(
+        boost::bind(&ros::Publisher::getNumSubscribers, &pub_points_),
+        boost::bind(publishPointsView, boost::cref(pub_points_), _1));
+  poses_view_ = vis_sink_.addChannel<geometry_msgs::PoseArray>(
+        boost::bind(&ros::Publisher::getNumSubscribers, &pub_poses_),
+        boost::bind(publishPosesView, boost::cref(pub_poses_), _1));
+
   tf_listener_ = new tf::TransformListener();
 
 
@@ -80,7 +91,7 @@ void BoxLocator::callbackVelo(const sensor_msgs::PointCloud2::ConstPtr& cloud_ms
 
   if (cloud_filtered->points.size() == 0)
   {
-    std::cout << "No laser points detected nearby.\n";
+    KURI_WARN_THROTTLE(1.0, "No laser points detected nearby.");
     return;
   }
 
@@ -108,28 +119,25 @@ void BoxLocator::callbackVelo(const sensor_msgs::PointCloud2::ConstPtr& cloud_ms
 
   if (pc_vector_clustered.size() == 0)
   {
-    std::cout << "Could not find panel cluster.\n";
+    KURI_WARN_THROTTLE(1.0, "Could not find panel cluster.");
     //action_handler->setFailure();
     return;
   }
 
   // Publish cluster clouds
-  for (int i=0; i<pc_vector_clustered.size(); i++)
+  if (clusters_view_->wanted())
   {
-    sensor_msgs::PointCloud2 cloud_cluster_msg;
-    pcl::toROSMsg(*pc_vector_clustered[i], cloud_cluster_msg);
-    cloud_cluster_msg.header.frame_id = cloud_msg->header.frame_id;
-    cloud_cluster_msg.header.stamp = ros::Time::now();
-    pub_wall_.publish(cloud_cluster_msg);
-
-    if (pc_vector_clustered.size() > 1)
-      usleep(200*1000);
+    ClustersView view;
+    view.clusters = pc_vector_clustered;
+    view.frame_id = cloud_msg->header.frame_id;
+    view.stamp = ros::Time::now();
+    clusters_view_->post(view);
   }
 
   /* Select one cloud */
   if (pc_vector_clustered.size() > 1)
   {
-    std::cout << "Found multiple panel clusters. Using the first one.\n";
+    KURI_INFO_THROTTLE(1.0, "Found multiple panel clusters. Using the first one.");
   }
 
   pcl::PointCloud<pcl::PointXYZ>::Ptr cluster_cloud = pc_vector_clustered[0];
@@ -140,7 +148,8 @@ void BoxLocator::callbackVelo(const sensor_msgs::PointCloud2::ConstPtr& cloud_ms
 
   // Publish waypoints for visualization
   waypoints_.header.frame_id = cloud_msg->header.frame_id;
-  pub_poses_.publish(waypoints_);
+  if (poses_view_->wanted())
+    poses_view_->post(waypoints_);
 
   if(!bypass_action_handler_)
     is_done_ = true;
@@ -320,20 +329,14 @@ void BoxLocator::computeBoundingBox(std::vector<pcl::PointCloud<pcl::PointXYZ>::
 
 void BoxLocator::drawPoints(std::vector<geometry_msgs::Point> points, std::string frame_id)
 {
-  // Publish
-  visualization_msgs::Marker marker_msg;
-  marker_msg.header.frame_id = frame_id;
-  marker_msg.header.stamp = ros::Time::now();
-  marker_msg.type = marker_msg.POINTS;
-
-  marker_msg.scale.x = 0.05;
-  marker_msg.scale.y = 0.05;
-  marker_msg.color.a = 1.0;
-  marker_msg.color.g = 1.0;
-
-  marker_msg.points = points;
+  if (!points_view_->wanted())
+    return;
 
-  pub_points_.publish(marker_msg);
+  PointsView view;
+  view.points.swap(points);
+  view.frame_id = frame_id;
+  view.stamp = ros::Time::now();
+  points_view_->post(view);
 }
 
 
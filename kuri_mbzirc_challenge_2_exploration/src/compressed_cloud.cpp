@@ -0,0 +1,221 @@
+#include <algorithm>
+#include <cmath>
+
+#include <pcl_conversions/pcl_conversions.h>
+
+#include <kuri_mbzirc_challenge_2_exploration/compressed_cloud.h>
+
+// Largest step count that fits in 16 bits
+static const int QUANT_MAX = 32767;
+
+
+static inline void writeVarint(uint32_t v, std::vector<uint8_t>& data)
+{
+  while (v >= 0x80)
+  {
+    data.push_back(uint8_t(v | 0x80));
+    v >>= 7;
+  }
+  data.push_back(uint8_t(v));
+}
+
+
+static inline bool readVarint(const std::vector<uint8_t>& data, size_t& pos, uint32_t& v)
+{
+  v = 0;
+  for (int shift=0; shift < 35 && pos < data.size(); shift += 7)
+  {
+    uint8_t b = data[pos++];
+    v |= uint32_t(b & 0x7f) << shift;
+    if (!(b & 0x80))
+      return true;
+  }
+  return false;
+}
+
+
+// Signed deltas to unsigned, keeping small magnitudes small: 0,-1,1,-2 -> 0,1,2,3
+static inline uint32_t zigzag(int32_t v)  { return (uint32_t(v) << 1) ^ uint32_t(v >> 31); }
+static inline int32_t unzigzag(uint32_t v) { return int32_t(v >> 1) ^ -int32_t(v & 1); }
+
+
+static inline int quantize(double v, double origin, double resolution)
+{
+  int q = (int) std::floor((v - origin)/resolution + 0.5);
+  return std::max(-QUANT_MAX, std::min(QUANT_MAX, q));
+}
+
+
+
+CompressedCloudEncoder::CompressedCloudEncoder():
+  resolution_(0.01),
+  ring_order_(true),
+  vertical_resolution_(2.0*M_PI/180)
+{
+}
+
+
+void CompressedCloudEncoder::setRingOrder(bool enabled, double vertical_resolution)
+{
+  ring_order_ = enabled;
+  vertical_resolution_ = vertical_resolution;
+}
+
+
+void CompressedCloudEncoder::loadParams(ros::NodeHandle& nh, const std::string& ns)
+{
+  double vres_deg;
+  nh.param(ns + "resolution", resolution_, resolution_);
+  nh.param(ns + "ring_order", ring_order_, ring_order_);
+  nh.param(ns + "vertical_resolution", vres_deg, vertical_resolution_*180/M_PI);
+  vertical_resolution_ = vres_deg*M_PI/180;
+}
+
+
+void CompressedCloudEncoder::encode(const pcl::PointCloud<pcl::PointXYZ>& cloud, kuri_mbzirc_challenge_2_msgs::CompressedPointCloud& msg)
+{
+  msg.data.clear();
+  msg.ring_ordered = ring_order_;
+  order_.clear();
+
+  // ============
+  // Finite points, and their order
+  // ============
+  float min_x = 0, min_y = 0, min_z = 0, max_x = 0, max_y = 0, max_z = 0;
+
+  for (size_t i=0; i < cloud.points.size(); i++)
+  {
+    const pcl::PointXYZ& p = cloud.points[i];
+    if (!pcl_isfinite(p.x) || !pcl_isfinite(p.y) || !pcl_isfinite(p.z))
+      continue;
+
+    if (order_.empty())
+    {
+      min_x = max_x = p.x;
+      min_y = max_y = p.y;
+      min_z = max_z = p.z;
+    }
+
+    min_x = std::min(min_x, p.x);  max_x = std::max(max_x, p.x);
+    min_y = std::min(min_y, p.y);  max_y = std::max(max_y, p.y);
+    min_z = std::min(min_z, p.z);  max_z = std::max(max_z, p.z);
+
+    RingKey k;
+    k.index = i;
+    k.ring = 0;
+    k.azimuth = 0;
+
+    if (ring_order_)
+    {
+      double r = std::sqrt(p.x*p.x + p.y*p.y);
+      k.ring = (int) std::floor(std::atan2(p.z, r)/vertical_resolution_ + 0.5);
+      k.azimuth = std::atan2(p.y, p.x);
+    }
+
+    order_.push_back(k);
+  }
+
+  if (ring_order_)
+    std::stable_sort(order_.begin(), order_.end());
+
+  msg.num_points = order_.size();
+  msg.origin.x = 0.5*(min_x + max_x);
+  msg.origin.y = 0.5*(min_y + max_y);
+  msg.origin.z = 0.5*(min_z + max_z);
+
+  // Coarser steps if the cloud is too large for 16 bits at the requested resolution
+  double half_extent = 0.5*std::max(max_x - min_x, std::max(max_y - min_y, max_z - min_z));
+  double resolution = std::max(resolution_, half_extent/QUANT_MAX);
+  msg.resolution = resolution;
+
+  // Recompute from the float that is sent, so the decoder sees the same steps
+  resolution = msg.resolution;
+
+  // ============
+  // Delta code
+  // ============
+  msg.data.reserve(order_.size()*4);
+
+  int prev_x = 0, prev_y = 0, prev_z = 0;
+  for (size_t i=0; i < order_.size(); i++)
+  {
+    const pcl::PointXYZ& p = cloud.points[ order_[i].index ];
+    int qx = quantize(p.x, msg.origin.x, resolution);
+    int qy = quantize(p.y, msg.origin.y, resolution);
+    int qz = quantize(p.z, msg.origin.z, resolution);
+
+    writeVarint(zigzag(qx - prev_x), msg.data);
+    writeVarint(zigzag(qy - prev_y), msg.data);
+    writeVarint(zigzag(qz - prev_z), msg.data);
+
+    prev_x = qx;
+    prev_y = qy;
+    prev_z = qz;
+  }
+}
+
+
+bool decodeCompressedCloud(const kuri_mbzirc_challenge_2_msgs::CompressedPointCloud& msg, pcl::PointCloud<pcl::PointXYZ>& cloud)
+{
+  cloud.points.clear();
+  cloud.points.reserve(msg.num_points);
+
+  double res = msg.resolution;
+  size_t pos = 0;
+  int32_t qx = 0, qy = 0, qz = 0;
+  bool complete = true;
+
+  for (uint32_t i=0; i < msg.num_points; i++)
+  {
+    uint32_t dx, dy, dz;
+    if (!readVarint(msg.data, pos, dx) || !readVarint(msg.data, pos, dy) || !readVarint(msg.data, pos, dz))
+    {
+      complete = false;
+      break;
+    }
+
+    qx += unzigzag(dx);
+    qy += unzigzag(dy);
+    qz += unzigzag(dz);
+
+    pcl::PointXYZ p;
+    p.x = msg.origin.x + qx*res;
+    p.y = msg.origin.y + qy*res;
+    p.z = msg.origin.z + qz*res;
+    cloud.points.push_back(p);
+  }
+
+  cloud.width = cloud.points.size();
+  cloud.height = 1;
+  cloud.is_dense = true;
+
+  return complete;
+}
+
+
+
+void CompressedCloudPublisher::advertise(ros::NodeHandle& nh, const std::string& topic, int queue_size)
+{
+  pub_cloud_ = nh.advertise<sensor_msgs::PointCloud2>(topic, queue_size);
+  pub_compressed_ = nh.advertise<kuri_mbzirc_challenge_2_msgs::CompressedPointCloud>(topic + "/compressed", queue_size);
+}
+
+
+void CompressedCloudPublisher::publish(const pcl::PointCloud<pcl::PointXYZ>& cloud, const std::string& frame_id, const ros::Time& stamp)
+{
+  if (pub_cloud_.getNumSubscribers() > 0)
+  {
+    pcl::toROSMsg(cloud, cloud_msg_);
+    cloud_msg_.header.frame_id = frame_id;
+    cloud_msg_.header.stamp = stamp;
+    pub_cloud_.publish(cloud_msg_);
+  }
+
+  if (pub_compressed_.getNumSubscribers() > 0)
+  {
+    encoder_.encode(cloud, compressed_msg_);
+    compressed_msg_.header.frame_id = frame_id;
+    compressed_msg_.header.stamp = stamp;
+    pub_compressed_.publish(compressed_msg_);
+  }
+}
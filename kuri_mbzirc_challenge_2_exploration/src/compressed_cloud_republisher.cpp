@@ -0,0 +1,41 @@
+#include <ros/ros.h>
+#include <sensor_msgs/PointCloud2.h>
+#include <pcl_conversions/pcl_conversions.h>
+
+#include <kuri_mbzirc_challenge_2_exploration/compressed_cloud.h>
+#include <kuri_mbzirc_challenge_2_tools/async_logger.h>
+
+// Runs on the base station: subscribes to "in" (CompressedPointCloud) and
+// publishes the restored cloud on "out" (PointCloud2). Remap both per topic.
+
+ros::Publisher pub_cloud;
+pcl::PointCloud<pcl::PointXYZ> cloud_;
+sensor_msgs::PointCloud2 cloud_msg_;
+
+
+void callbackCompressed(const kuri_mbzirc_challenge_2_msgs::CompressedPointCloud::ConstPtr& msg)
+{
+  if (pub_cloud.getNumSubscribers() == 0)
+    return;
+
+  if (!decodeCompressedCloud(*msg, cloud_))
+    KURI_WARN_THROTTLE(1.0, "Compressed cloud truncated, restored %d of %d points",
+                       (int) cloud_.points.size(), (int) msg->num_points);
+
+  pcl::toROSMsg(cloud_, cloud_msg_);
+  cloud_msg_.header = msg->header;
+  pub_cloud.publish(cloud_msg_);
+}
+
+
+int main(int argc, char **argv)
+{
+  ros::init(argc, argv, "compressed_cloud_republisher");
+  ros::NodeHandle node_handle;
+
+  ros::Subscriber sub_compressed = node_handle.subscribe("in", 1, callbackCompressed);
+  pub_cloud = node_handle.advertise<sensor_msgs::PointCloud2>("out", 1);
+
+  ros::spin();
+  return 0;
+}
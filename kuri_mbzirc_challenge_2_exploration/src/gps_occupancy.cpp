@@ -1,7 +1,8 @@
 #include <kuri_mbzirc_challenge_2_exploration/gps_occupancy.h>
+#include <kuri_mbzirc_challenge_2_exploration/compressed_cloud.h>
 #include <pcl/filters/passthrough.h>
 
-ros::Publisher pub_points_occ;
+CompressedCloudPublisher pub_points_occ;
 
 void GPSOccupancy::createGrid()
 {
@@ -83,7 +84,10 @@ void GPSOccupancy::setGpsBounds(std::vector<GeoPoint> arena_bounds)
 {
   // start publisher
   ros::NodeHandle node_handle;
-  pub_points_occ = node_handle.advertise<sensor_msgs::PointCloud2>("/explore/points_to_origin", 10);
+  pub_points_occ.advertise(node_handle, "/explore/points_to_origin", 10);
+
+  ros::NodeHandle param_handle("mbzirc_ch2_exploration");
+  pub_points_occ.encoder().loadParams(param_handle, "cloud_compression/");
 
 
   gps_filter_.setBounds( arena_bounds );
@@ -150,11 +154,7 @@ void GPSOccupancy::updateOccupancy(PcCloudPtr input_cloud, PcCloudPtr original_c
   PcCloud::Ptr pc_rotated_vis (new PcCloud);
   pcl::transformPointCloud (*original_cloud, *pc_rotated_vis, Ti);
 
-  sensor_msgs::PointCloud2 cloud_cluster_msg;
-  pcl::toROSMsg(*pc_rotated_vis, cloud_cluster_msg);
-  cloud_cluster_msg.header.frame_id = "velodyne";
-  cloud_cluster_msg.header.stamp = ros::Time::now();
-  pub_points_occ.publish(cloud_cluster_msg);
+  pub_points_occ.publish(*pc_rotated_vis, "velodyne", ros::Time::now());
 
   // Convert to octomap pointcloud format
   octomap::Pointcloud ocCloud;
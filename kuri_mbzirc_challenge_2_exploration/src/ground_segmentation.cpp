@@ -0,0 +1,185 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include <kuri_mbzirc_challenge_2_exploration/ground_segmentation.h>
+
+GroundSegmenter::GroundSegmenter():
+  ground_count_(0)
+{
+  setParams(GroundSegmentationParams());
+}
+
+
+void GroundSegmenter::setParams(const GroundSegmentationParams& params)
+{
+  params_ = params;
+
+  size_t cells = size_t(params_.num_rings)*params_.num_sectors;
+  cell_min_z_.resize(cells);
+  cell_range_.resize(cells);
+  cell_ground_z_.resize(cells);
+}
+
+
+void GroundSegmenter::loadParams(ros::NodeHandle& nh, const std::string& ns, GroundSegmentationParams& params)
+{
+  double min_elevation_deg, elevation_step_deg, max_slope_deg;
+
+  nh.param(ns + "num_rings", params.num_rings, params.num_rings);
+  nh.param(ns + "min_elevation", min_elevation_deg, params.min_elevation*180/M_PI);
+  nh.param(ns + "elevation_step", elevation_step_deg, params.elevation_step*180/M_PI);
+  nh.param(ns + "num_sectors", params.num_sectors, params.num_sectors);
+  nh.param(ns + "sensor_height", params.sensor_height, params.sensor_height);
+  nh.param(ns + "height_tolerance", params.height_tolerance, params.height_tolerance);
+  nh.param(ns + "max_slope", max_slope_deg, params.max_slope*180/M_PI);
+  nh.param(ns + "max_step", params.max_step, params.max_step);
+  nh.param(ns + "ground_threshold", params.ground_threshold, params.ground_threshold);
+
+  params.min_elevation = min_elevation_deg*M_PI/180;
+  params.elevation_step = elevation_step_deg*M_PI/180;
+  params.max_slope = max_slope_deg*M_PI/180;
+}
+
+
+void GroundSegmenter::toRingScan(const PcCloud& cloud, RingScan& scan)
+{
+  scan.clear();
+  scan.reserve(cloud.points.size());
+
+  double sector_scale = params_.num_sectors/(2*M_PI);
+  int max_ring = params_.num_rings - 1;
+
+  for (size_t i=0; i < cloud.points.size(); i++)
+  {
+    const PcPoint& p = cloud.points[i];
+    if (!pcl_isfinite(p.x) || !pcl_isfinite(p.y) || !pcl_isfinite(p.z))
+      continue;
+
+    float r = std::sqrt(p.x*p.x + p.y*p.y);
+    if (r < 1e-3)
+      continue;
+
+    // Nearest ring to the elevation of the return
+    double elevation = std::atan2(p.z, r);
+    int ring = (int) std::floor((elevation - params_.min_elevation)/params_.elevation_step + 0.5);
+    ring = std::max(0, std::min(max_ring, ring));
+
+    int sector = (int) ((std::atan2(p.y, p.x) + M_PI)*sector_scale);
+    if (sector >= params_.num_sectors)
+      sector = 0;
+
+    scan.push_back(p.x, p.y, p.z, r, ring, sector, i);
+  }
+}
+
+
+void GroundSegmenter::segment(const PcCloud& cloud)
+{
+  toRingScan(cloud, scan_);
+  segment(scan_);
+}
+
+
+void GroundSegmenter::segmentSwap(RingScan& scan)
+{
+  scan_.swap(scan);
+  segment(scan_);
+}
+
+
+void GroundSegmenter::segment(const RingScan& scan)
+{
+  size_t n = scan.size();
+  ground_.assign(n, 0);
+  height_.resize(n);
+  ground_count_ = 0;
+
+  // ============
+  // Lowest return of each cell
+  // ============
+  std::fill(cell_min_z_.begin(), cell_min_z_.end(), std::numeric_limits<float>::max());
+
+  for (size_t i=0; i < n; i++)
+  {
+    size_t c = cell(scan.ring[i], scan.sector[i]);
+    if (scan.z[i] < cell_min_z_[c])
+    {
+      cell_min_z_[c] = scan.z[i];
+      cell_range_[c] = scan.range[i];
+    }
+  }
+
+  // ============
+  // Walk each sector outwards, following the ground
+  // ============
+  double slope = std::tan(params_.max_slope);
+
+  for (int s=0; s < params_.num_sectors; s++)
+  {
+    float prev_z = -params_.sensor_height;
+    float prev_r = 0;
+    bool has_ground = false;
+
+    for (int r=0; r < params_.num_rings; r++)
+    {
+      size_t c = cell(r, s);
+      cell_ground_z_[c] = prev_z;
+
+      if (cell_min_z_[c] == std::numeric_limits<float>::max())
+        continue;
+
+      // Nothing to follow yet, the slope from the sensor would allow meters at the nearest ring
+      float max_dz = params_.height_tolerance;
+      if (has_ground)
+      {
+        // Rings above the horizon never hit the ground, but may still be closer than the previous ground cell
+        float dr = std::max(0.0f, cell_range_[c] - prev_r);
+        max_dz = params_.max_step + slope*dr;
+      }
+
+      if (std::fabs(cell_min_z_[c] - prev_z) > max_dz)
+        continue;
+
+      has_ground = true;
+
+      cell_ground_z_[c] = cell_min_z_[c];
+      prev_z = cell_min_z_[c];
+      prev_r = cell_range_[c];
+    }
+  }
+
+  // ============
+  // Height above the local ground
+  // ============
+  for (size_t i=0; i < n; i++)
+  {
+    float h = scan.z[i] - cell_ground_z_[ cell(scan.ring[i], scan.sector[i]) ];
+    height_[i] = h;
+
+    if (h < params_.ground_threshold)
+    {
+      ground_[i] = 1;
+      ground_count_++;
+    }
+  }
+}
+
+
+void GroundSegmenter::extractObstacles(const PcCloud& cloud, double min_height, double max_height, PcCloud& cloud_out)
+{
+  cloud_out.points.clear();
+  cloud_out.points.reserve(scan_.size() - ground_count_);
+
+  for (size_t i=0; i < scan_.size(); i++)
+  {
+    if (ground_[i] || height_[i] < min_height || height_[i] > max_height)
+      continue;
+
+    cloud_out.points.push_back(cloud.points[ scan_.index[i] ]);
+  }
+
+  cloud_out.width = cloud_out.points.size();
+  cloud_out.height = 1;
+  cloud_out.is_dense = true;
+}
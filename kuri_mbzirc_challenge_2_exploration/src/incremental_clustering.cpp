@@ -0,0 +1,322 @@
+#include <algorithm>
+#include <cmath>
+
+#include <kuri_mbzirc_challenge_2_exploration/incremental_clustering.h>
+
+// 21 bits per axis, centered so that negative coordinates are valid. Adding
+// (dx + dy*2^21 + dz*2^42) to a key moves it by (dx, dy, dz) voxels.
+static const int64_t KEY_OFFSET = 1 << 20;
+static const uint64_t KEY_MASK = (1 << 21) - 1;
+
+
+IncrementalClusterer::IncrementalClusterer():
+  enabled_(false),
+  frame_id_("odom"),
+  leaf_size_(0.5),
+  connect_radius_(3),
+  max_missed_scans_(1),
+  min_cluster_size_(3),
+  max_cluster_size_(5000),
+  scan_(0),
+  num_removed_(0),
+  num_rebuilt_(0)
+{
+  computeOffsets();
+}
+
+
+void IncrementalClusterer::loadParams(ros::NodeHandle& nh, const std::string& ns)
+{
+  nh.param(ns + "enabled", enabled_, enabled_);
+  nh.param(ns + "frame_id", frame_id_, frame_id_);
+  nh.param(ns + "leaf_size", leaf_size_, leaf_size_);
+  nh.param(ns + "connect_radius", connect_radius_, connect_radius_);
+  nh.param(ns + "max_missed_scans", max_missed_scans_, max_missed_scans_);
+
+  computeOffsets();
+  clear();
+}
+
+
+void IncrementalClusterer::clear()
+{
+  scan_ = 0;
+  voxels_.clear();
+  active_.clear();
+  parent_.clear();
+  node_key_.clear();
+  members_.clear();
+  dirty_.clear();
+  free_nodes_.clear();
+  root_label_.clear();
+  root_label_scan_.clear();
+}
+
+
+void IncrementalClusterer::computeOffsets()
+{
+  neighbour_offsets_.clear();
+
+  int r = std::max(1, connect_radius_);
+  for (int dz=-r; dz <= r; dz++)
+    for (int dy=-r; dy <= r; dy++)
+      for (int dx=-r; dx <= r; dx++)
+        if (dx != 0 || dy != 0 || dz != 0)
+          neighbour_offsets_.push_back(int64_t(dx) + (int64_t(dy) << 21) + (int64_t(dz) << 42));
+}
+
+
+uint64_t IncrementalClusterer::key(const Eigen::Vector3f& p) const
+{
+  int64_t x = (int64_t) std::floor(p[0]/leaf_size_);
+  int64_t y = (int64_t) std::floor(p[1]/leaf_size_);
+  int64_t z = (int64_t) std::floor(p[2]/leaf_size_);
+
+  return (uint64_t(x + KEY_OFFSET) & KEY_MASK)
+      | ((uint64_t(y + KEY_OFFSET) & KEY_MASK) << 21)
+      | ((uint64_t(z + KEY_OFFSET) & KEY_MASK) << 42);
+}
+
+
+int IncrementalClusterer::newNode(uint64_t k)
+{
+  int n;
+  if (!free_nodes_.empty())
+  {
+    n = free_nodes_.back();
+    free_nodes_.pop_back();
+  }
+  else
+  {
+    n = parent_.size();
+    parent_.push_back(n);
+    node_key_.push_back(k);
+    members_.push_back(std::vector<int>());
+    dirty_.push_back(0);
+    root_label_.push_back(-1);
+    root_label_scan_.push_back(-1);
+  }
+
+  parent_[n] = n;
+  node_key_[n] = k;
+  members_[n].clear();
+  members_[n].push_back(n);
+  dirty_[n] = 0;
+  return n;
+}
+
+
+int IncrementalClusterer::find(int node)
+{
+  // Path halving
+  while (parent_[node] != node)
+  {
+    parent_[node] = parent_[ parent_[node] ];
+    node = parent_[node];
+  }
+  return node;
+}
+
+
+void IncrementalClusterer::unite(int a, int b)
+{
+  a = find(a);
+  b = find(b);
+  if (a == b)
+    return;
+
+  // The larger member list absorbs the smaller one
+  if (members_[a].size() < members_[b].size())
+    std::swap(a, b);
+
+  parent_[b] = a;
+  members_[a].insert(members_[a].end(), members_[b].begin(), members_[b].end());
+  members_[b].clear();
+
+  if (dirty_[b] && !dirty_[a])
+  {
+    dirty_[a] = 1;
+    dirty_roots_.push_back(a);
+  }
+}
+
+
+void IncrementalClusterer::markDirty(int node)
+{
+  int root = find(node);
+  if (!dirty_[root])
+  {
+    dirty_[root] = 1;
+    dirty_roots_.push_back(root);
+  }
+}
+
+
+void IncrementalClusterer::link(uint64_t k)
+{
+  boost::unordered_map<uint64_t, Voxel>::iterator it = voxels_.find(k);
+  int node = newNode(k);
+  it->second.node = node;
+
+  for (size_t i=0; i < neighbour_offsets_.size(); i++)
+  {
+    boost::unordered_map<uint64_t, Voxel>::const_iterator n = voxels_.find(k + neighbour_offsets_[i]);
+    if (n != voxels_.end() && n->second.node >= 0)
+      unite(node, n->second.node);
+  }
+}
+
+
+void IncrementalClusterer::rebuild(int root)
+{
+  // Unlink the voxels of the cluster that are still there, and recycle all its nodes
+  queue_.clear();
+  std::vector<int> nodes;
+  nodes.swap(members_[root]);
+
+  for (size_t i=0; i < nodes.size(); i++)
+  {
+    int n = nodes[i];
+    boost::unordered_map<uint64_t, Voxel>::iterator it = voxels_.find(node_key_[n]);
+    if (it != voxels_.end() && it->second.node == n)
+    {
+      it->second.node = -1;
+      queue_.push_back(it->first);
+    }
+
+    dirty_[n] = 0;
+    free_nodes_.push_back(n);
+  }
+
+  // Flood fill. Every occupied neighbour was united with this cluster, so the
+  // fill never leaves the unlinked voxels.
+  size_t num_voxels = queue_.size();
+  for (size_t i=0; i < num_voxels; i++)
+  {
+    uint64_t seed = queue_[i];
+    Voxel& v = voxels_.find(seed)->second;
+    if (v.node >= 0)
+      continue;
+
+    int cluster = newNode(seed);
+    v.node = cluster;
+
+    std::vector<uint64_t> stack (1, seed);
+    while (!stack.empty())
+    {
+      uint64_t k = stack.back();
+      stack.pop_back();
+
+      for (size_t j=0; j < neighbour_offsets_.size(); j++)
+      {
+        boost::unordered_map<uint64_t, Voxel>::iterator n = voxels_.find(k + neighbour_offsets_[j]);
+        if (n == voxels_.end() || n->second.node >= 0)
+          continue;
+
+        int child = newNode(n->first);
+        parent_[child] = cluster;
+        members_[child].clear();
+        members_[cluster].push_back(child);
+        n->second.node = child;
+        stack.push_back(n->first);
+      }
+    }
+  }
+
+  num_rebuilt_ += num_voxels;
+}
+
+
+void IncrementalClusterer::update(const pcl::PointCloud<pcl::PointXYZ>& cloud, const Eigen::Affine3f& to_frame, std::vector<pcl::PointIndices>& clusters)
+{
+  scan_++;
+  added_.clear();
+  dirty_roots_.clear();
+  num_removed_ = 0;
+  num_rebuilt_ = 0;
+
+  // ============
+  // Occupancy of this scan
+  // ============
+  point_keys_.resize(cloud.points.size());
+  for (size_t i=0; i < cloud.points.size(); i++)
+  {
+    const pcl::PointXYZ& p = cloud.points[i];
+    uint64_t k = key(to_frame*Eigen::Vector3f(p.x, p.y, p.z));
+    point_keys_[i] = k;
+
+    std::pair<boost::unordered_map<uint64_t, Voxel>::iterator, bool> r = voxels_.insert(std::make_pair(k, Voxel()));
+    Voxel& v = r.first->second;
+    if (r.second)
+    {
+      v.node = -1;
+      added_.push_back(k);
+    }
+    v.last_seen = scan_;
+  }
+
+  // ============
+  // Voxels gone for too long split their cluster
+  // ============
+  size_t kept = 0;
+  for (size_t i=0; i < active_.size(); i++)
+  {
+    boost::unordered_map<uint64_t, Voxel>::iterator it = voxels_.find(active_[i]);
+    if (scan_ - it->second.last_seen <= max_missed_scans_)
+    {
+      active_[kept++] = active_[i];
+      continue;
+    }
+
+    markDirty(it->second.node);
+    voxels_.erase(it);
+    num_removed_++;
+  }
+  active_.resize(kept);
+
+  // ============
+  // New voxels merge the clusters they touch
+  // ============
+  for (size_t i=0; i < added_.size(); i++)
+  {
+    link(added_[i]);
+    active_.push_back(added_[i]);
+  }
+
+  // A dirty root can be merged into another one later in the scan, only rebuild the final roots
+  for (size_t i=0; i < dirty_roots_.size(); i++)
+  {
+    int root = dirty_roots_[i];
+    if (parent_[root] == root && dirty_[root])
+      rebuild(root);
+  }
+
+  // ============
+  // Points of this scan by cluster
+  // ============
+  clusters.clear();
+  for (size_t i=0; i < point_keys_.size(); i++)
+  {
+    int root = find(voxels_.find(point_keys_[i])->second.node);
+    if (root_label_scan_[root] != scan_)
+    {
+      root_label_scan_[root] = scan_;
+      root_label_[root] = clusters.size();
+      clusters.push_back(pcl::PointIndices());
+    }
+    clusters[ root_label_[root] ].indices.push_back(i);
+  }
+
+  size_t out = 0;
+  for (size_t c=0; c < clusters.size(); c++)
+  {
+    int size = clusters[c].indices.size();
+    if (size < min_cluster_size_ || size > max_cluster_size_)
+      continue;
+
+    if (out != c)
+      clusters[out].indices.swap(clusters[c].indices);
+    out++;
+  }
+  clusters.resize(out);
+}
@@ -5,9 +5,9 @@
 #include <pcl/io/pcd_io.h>
 #include <pcl/point_cloud.h>
 #include <pcl/point_types.h>
-#include "kuri_mbzirc_challenge_2_exploration/detection.h"
-#include "kuri_mbzirc_challenge_2_exploration/panel_searching.h"
-#include "kuri_mbzirc_challenge_2_exploration/point_types.h"
+#include "kuri_mbzirc_challenge_2_exploration/old/detection.h"
+#include "kuri_mbzirc_challenge_2_exploration/old/panel_searching.h"
+#include "kuri_mbzirc_challenge_2_exploration/old/point_types.h"
 #include <pcl/common/transforms.h>
 #include <pcl/common/common.h>
 //#include <tf/transform_listener.h>
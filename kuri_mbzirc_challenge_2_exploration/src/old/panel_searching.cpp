@@ -2,7 +2,6 @@
 #include <pcl/point_types.h>
 #include <pcl/io/pcd_io.h>
 #include <pcl/filters/extract_indices.h>
-#include <pcl/filters/voxel_grid.h>
 #include <pcl/features/normal_3d.h>
 #include <pcl/kdtree/kdtree.h>
 #include <pcl/sample_consensus/method_types.h>
@@ -13,22 +12,24 @@
 #include <pcl/common/common.h>
 #include <Eigen/Dense>
 #include <pcl/visualization/pcl_visualizer.h>
-#include "kuri_mbzirc_challenge_2_exploration/panel_searching.h"
+#include "kuri_mbzirc_challenge_2_exploration/old/panel_searching.h"
+#include <kuri_mbzirc_challenge_2_tools/async_logger.h>
+#include <kuri_mbzirc_challenge_2_tools/multi_plane_extractor.h>
+#include <kuri_mbzirc_challenge_2_tools/voxel_downsampler.h>
 
 
 // Cluster the input pointcloud(raw input)
 void panel_searching::pointcloud_tree_clustering(pcl::PointCloud<pcl::PointXYZ>::Ptr input_pointcloud, pcl::PointCloud<pcl::PointXYZ>::Ptr cloud_filtered, std::vector<pcl::PointIndices>& cluster_indices)
 {
-  std::cout << "PointCloud before filtering has: " << input_pointcloud->points.size () << " data points." << std::endl; //*
+  KURI_DEBUG("PointCloud before filtering has: %lu data points.", (unsigned long) input_pointcloud->points.size ());
 
 
   // Create the filtering object: downsample the dataset using a leaf size of 1cm
 
-  pcl::VoxelGrid<pcl::PointXYZ> vg;
-  vg.setInputCloud (input_pointcloud);
-  vg.setLeafSize (0.01f, 0.01f, 0.01f);
-  vg.filter (*cloud_filtered);
-  std::cout << "PointCloud after filtering has: " << cloud_filtered->points.size ()  << " data points." << std::endl; //*
+  VoxelDownsampler vg;
+  vg.setLeafSize (0.01);
+  vg.filter (*input_pointcloud, *cloud_filtered);
+  KURI_DEBUG("PointCloud after filtering has: %lu data points.", (unsigned long) cloud_filtered->points.size ());
 
   // Creating the KdTree object for the search method of the extraction
   pcl::search::KdTree<pcl::PointXYZ>::Ptr tree (new pcl::search::KdTree<pcl::PointXYZ>);
@@ -42,68 +43,56 @@ void panel_searching::pointcloud_tree_clustering(pcl::PointCloud<pcl::PointXYZ>:
   ec.setSearchMethod (tree);
   ec.setInputCloud (cloud_filtered);
   ec.extract (cluster_indices);
-  std::cout<<"cluster no. :"<<cluster_indices.size()<<std::endl;
+  KURI_INFO("Clusters: %lu", (unsigned long) cluster_indices.size());
 }
 
 
 
-// Fit a plane model to each cluster
-void panel_searching::plane_fitting(pcl::PointCloud<pcl::PointXYZ>::Ptr input_pointcloud, int& plane_id,std::vector<pcl::PointCloud<pcl::PointXYZ>::Ptr>& pc_vector)
+// Fit vertical plane models to each cluster. The clusters are processed concurrently and
+// their index lists are reordered in place, so only the planes that are kept get copied.
+void panel_searching::plane_fitting(pcl::PointCloud<pcl::PointXYZ>::Ptr input_pointcloud, std::vector<pcl::PointIndices>& cluster_indices, int& plane_id,std::vector<pcl::PointCloud<pcl::PointXYZ>::Ptr>& pc_vector)
 {
-  pcl::PointCloud<pcl::PointXYZ>::Ptr cloud (new pcl::PointCloud<pcl::PointXYZ>), cloud_f (new      pcl::PointCloud<pcl::PointXYZ>);
-  // Create the segmentation object for the planar model and set all the parameters
-  pcl::SACSegmentation<pcl::PointXYZ> seg;
-  pcl::PointIndices::Ptr inliers (new pcl::PointIndices);
-  pcl::ModelCoefficients::Ptr coefficients (new pcl::ModelCoefficients);
-  pcl::PointCloud<pcl::PointXYZ>::Ptr cloud_plane (new pcl::PointCloud<pcl::PointXYZ> ());
-  pcl::PCDWriter writer;
-  seg.setOptimizeCoefficients (true);
+  MultiPlaneExtractor extractor;
   // vertial plane fitting
-  seg.setModelType (pcl::SACMODEL_PARALLEL_PLANE); 
-  seg.setAxis(Eigen::Vector3f(0,0,1));
-  seg.setEpsAngle (0.4);
-  seg.setMethodType (pcl::SAC_RANSAC);
-  seg.setMaxIterations (100);
-  seg.setDistanceThreshold (0.02);
-  int id=0;
-  int nr_points = (int) input_pointcloud->points.size ();
-  std::vector<pcl::PointCloud<pcl::PointXYZ>::Ptr> local_pc_vector;
-  while (input_pointcloud->points.size () > 0.3 * nr_points)
-  {
-    // Segment the largest planar component from the remaining cloud
-    seg.setInputCloud (input_pointcloud);
-    seg.segment (*inliers, *coefficients);
-    if (inliers->indices.size () == 0)
-    {
-      std::cout << "Could not estimate a planar model for the given dataset." << std::endl;
-      break;
-    }
-    // Extract the planar inliers from the input cloud
-    pcl::ExtractIndices<pcl::PointXYZ> extract;
-    extract.setInputCloud (input_pointcloud);
-    extract.setIndices (inliers);
-    extract.setNegative (false);
-
-    // Get the points associated with the planar surface
-    extract.filter (*cloud_plane);
-    std::cout << "PointCloud representing the planar component: " << cloud_plane->points.size () << " data points." << std::endl; 
-    ++plane_id;
-    // save the pc in the local pc vector
-    local_pc_vector.push_back(cloud_plane);
-    // Remove the planar inliers, extract the rest
-    extract.setNegative (true);
-    extract.filter (*cloud_f);
-    *input_pointcloud = *cloud_f;
-  }
+  extractor.setAxis(Eigen::Vector3f(0,0,1), 0.4);
+  extractor.setMaxIterations(100);
+  extractor.setDistanceThreshold(0.02);
+  extractor.setMinRemainingRatio(0.3);
 
+  std::vector<PlaneSpan> planes;
+  extractor.extract(*input_pointcloud, cluster_indices, planes);
 
-  if (local_pc_vector.size()<3)
+  // Planes of each cluster are contiguous in the list
+  for (size_t first = 0; first < planes.size(); )
   {
-    std::cout << "plane size"<<std::endl;
-    std::cout << local_pc_vector.size()<<std::endl;
-    std::cout << "plane appended"<<std::endl;
-    pc_vector.insert(pc_vector.end(), local_pc_vector.begin(), local_pc_vector.end());
+    size_t last = first;
+    while (last < planes.size() && planes[last].cluster == planes[first].cluster)
+      last++;
+
+    KURI_DEBUG("Cluster %d has %lu planes", planes[first].cluster, (unsigned long) (last - first));
+
+    if (last - first < 3)
+    {
+      const std::vector<int>& indices = cluster_indices[planes[first].cluster].indices;
+
+      for (size_t i = first; i < last; i++)
+      {
+        pcl::PointCloud<pcl::PointXYZ>::Ptr cloud_plane (new pcl::PointCloud<pcl::PointXYZ> ());
+        cloud_plane->points.reserve(planes[i].size());
+        for (int k = planes[i].begin; k < planes[i].end; k++)
+          cloud_plane->points.push_back(input_pointcloud->points[indices[k]]);
+
+        cloud_plane->width = cloud_plane->points.size();
+        cloud_plane->height = 1;
+        cloud_plane->is_dense = true;
+
+        KURI_DEBUG("PointCloud representing the planar component: %lu data points.", (unsigned long) cloud_plane->points.size ());
+        ++plane_id;
+        pc_vector.push_back(cloud_plane);
+      }
+    }
 
+    first = last;
   }
 }
 
@@ -128,7 +117,6 @@ Eigen::Vector3f one_dimension;
      cloud_plane=*iterator; 
     ++id;
     //detect bounding box
-    std::cout<<"Start finding bounding box"<<std::endl;
     // find bounding box
     // Compute principal directions
     Eigen::Vector4f pcaCentroid;
@@ -183,11 +171,8 @@ void panel_searching::assembler(std::vector<pcl::PointCloud<pcl::PointXYZ>::Ptr>
     //filtered with plane dimension
     one_dimension=dimension_list[idx];
     one_centroid=centroid_list[idx];
-    std::cout<<one_dimension<<std::endl;
-    std::cout<<"inside"<<std::endl;
-    std::cout<<one_dimension[0,1]<<std::endl;
-    std::cout<<one_dimension[0,2]<<std::endl;
-    if( one_dimension[0,1]<1.5  && one_dimension[0,2]<1.5 && one_dimension[0,2]/one_dimension[0,1]<2&&one_dimension[0,1]>0.5)
+    KURI_DEBUG("Plane dimensions: %f %f %f", one_dimension[0], one_dimension[1], one_dimension[2]);
+    if( one_dimension[1]<1.5  && one_dimension[2]<1.5 && one_dimension[2]/one_dimension[1]<2&&one_dimension[1]>0.5)
     {
       //append centroid list to the sifted_centroid_list
 
@@ -224,28 +209,12 @@ void panel_searching::panel_extraction(pcl::PointCloud<pcl::PointXYZ>::Ptr input
 
 
   int plane_id=0;
-  int j = 0;
-  int id=0;
-  for (std::vector<pcl::PointIndices>::const_iterator it = cluster_indices.begin (); it != cluster_indices.end (); ++it)
-  {
-    pcl::PointCloud<pcl::PointXYZ>::Ptr cloud_cluster (new pcl::PointCloud<pcl::PointXYZ>);
-    for (std::vector<int>::const_iterator pit = it->indices.begin (); pit != it->indices.end (); ++pit)
-      cloud_cluster->points.push_back (input_pointcloud->points[*pit]); //*
-    cloud_cluster->width = cloud_cluster->points.size ();
-    cloud_cluster->height = 1;
-    cloud_cluster->is_dense = true;
-    id++;
-    j++;
-    // fit planer 
-    plane_fitting(cloud_cluster, plane_id,pc_vector);    
-  } 
+  // fit planes on the clusters in place, without copying them out
+  plane_fitting(input_pointcloud, cluster_indices, plane_id, pc_vector);
   // find bounding box
   std::vector<Eigen::Vector3f> dimension_list;
   std::vector<Eigen::Vector4f> centroid_list;
   bounding_box_detection(input_pointcloud, pc_vector, dimension_list, centroid_list); 
-  Eigen::Vector3f one_dimension;
-  Eigen::Vector4f one_centroid;
-  one_centroid=centroid_list[0];
   assembler(pc_vector, plane_assemble,dimension_list, centroid_list, sifted_centroid_list );
 }
 
@@ -0,0 +1,349 @@
+#include <algorithm>
+#include <cmath>
+
+#include <kuri_mbzirc_challenge_2_exploration/sector_streaming.h>
+
+// 21 bits per axis, centered so that negative coordinates are valid. Adding
+// (dx + dy*2^21 + dz*2^42) to a key moves it by (dx, dy, dz) voxels.
+static const int64_t KEY_OFFSET = 1 << 20;
+static const uint64_t KEY_MASK = (1 << 21) - 1;
+
+
+SectorStreamer::SectorStreamer():
+  enabled_(false),
+  leaf_size_(0.5),
+  connect_radius_(2),
+  min_cluster_size_(3),
+  max_cluster_size_(5000),
+  min_height_(0.5),
+  max_height_(1.8),
+  r_min_(1.0),
+  r_max_(60.0),
+  a_min_(-M_PI),
+  a_max_(M_PI),
+  num_sectors_(GroundSegmentationParams().num_sectors),
+  has_start_(false),
+  sweep_done_(false),
+  start_azimuth_(0),
+  last_angle_(0)
+{
+  computeOffsets();
+}
+
+
+void SectorStreamer::loadParams(ros::NodeHandle& nh, const std::string& ns)
+{
+  nh.param(ns + "enabled", enabled_, enabled_);
+  nh.param(ns + "leaf_size", leaf_size_, leaf_size_);
+  nh.param(ns + "connect_radius", connect_radius_, connect_radius_);
+  nh.param(ns + "min_cluster_size", min_cluster_size_, min_cluster_size_);
+  nh.param(ns + "max_cluster_size", max_cluster_size_, max_cluster_size_);
+
+  computeOffsets();
+  startSweep();
+}
+
+
+void SectorStreamer::setGroundSegmentation(const GroundSegmentationParams& params, double min_height, double max_height)
+{
+  ground_segmenter_.setParams(params);
+  num_sectors_ = params.num_sectors;
+  min_height_ = min_height;
+  max_height_ = max_height;
+}
+
+
+void SectorStreamer::setLimits(double r_min, double r_max, double a_min, double a_max)
+{
+  r_min_ = r_min;
+  r_max_ = r_max;
+  a_min_ = a_min;
+  a_max_ = a_max;
+}
+
+
+void SectorStreamer::computeOffsets()
+{
+  neighbour_offsets_.clear();
+
+  int r = std::max(1, connect_radius_);
+  for (int dz=-r; dz <= r; dz++)
+    for (int dy=-r; dy <= r; dy++)
+      for (int dx=-r; dx <= r; dx++)
+        if (dx != 0 || dy != 0 || dz != 0)
+          neighbour_offsets_.push_back(int64_t(dx) + (int64_t(dy) << 21) + (int64_t(dz) << 42));
+
+  // Points of connected voxels are less than r + 1 voxels apart on each axis
+  reach_ = (r + 1)*leaf_size_*std::sqrt(2.0);
+}
+
+
+uint64_t SectorStreamer::key(float x, float y, float z) const
+{
+  int64_t vx = (int64_t) std::floor(x/leaf_size_);
+  int64_t vy = (int64_t) std::floor(y/leaf_size_);
+  int64_t vz = (int64_t) std::floor(z/leaf_size_);
+
+  return (uint64_t(vx + KEY_OFFSET) & KEY_MASK)
+      | ((uint64_t(vy + KEY_OFFSET) & KEY_MASK) << 21)
+      | ((uint64_t(vz + KEY_OFFSET) & KEY_MASK) << 42);
+}
+
+
+void SectorStreamer::startSweep()
+{
+  has_start_ = false;
+  sweep_done_ = false;
+  last_angle_ = 0;
+
+  pending_.clear();
+  pending_intensity_.clear();
+  pending_angle_.clear();
+
+  obstacles_.points.clear();
+  obstacle_intensity_.clear();
+
+  voxels_.clear();
+  parent_.clear();
+  clusters_.clear();
+  done_.clear();
+  open_.clear();
+  finished_.clear();
+}
+
+
+int SectorStreamer::find(int node)
+{
+  // Path halving
+  while (parent_[node] != node)
+  {
+    parent_[node] = parent_[ parent_[node] ];
+    node = parent_[node];
+  }
+  return node;
+}
+
+
+int SectorStreamer::unite(int a, int b)
+{
+  a = find(a);
+  b = find(b);
+  if (a == b)
+    return a;
+
+  // The larger cluster absorbs the smaller one
+  if (clusters_[a].points.size() < clusters_[b].points.size())
+    std::swap(a, b);
+
+  Cluster& ca = clusters_[a];
+  Cluster& cb = clusters_[b];
+  ca.points.insert(ca.points.end(), cb.points.begin(), cb.points.end());
+  ca.min_range = std::min(ca.min_range, cb.min_range);
+  ca.first_angle = std::min(ca.first_angle, cb.first_angle);
+  ca.last_angle = std::max(ca.last_angle, cb.last_angle);
+  cb.points.clear();
+
+  parent_[b] = a;
+  return a;
+}
+
+
+size_t SectorStreamer::add(const pcl::PointCloud<pcl::PointXYZ>& cloud, const std::vector<float>& intensity, const RingScan& scan, size_t begin)
+{
+  finished_.clear();
+  if (sweep_done_)
+    return begin;
+
+  bool has_intensity = (intensity.size() == cloud.points.size());
+
+  size_t i = begin;
+  for (; i < scan.size(); i++)
+  {
+    // Clockwise, so that the sweep angle grows
+    float azimuth = std::atan2(-scan.y[i], scan.x[i]);
+    if (!has_start_)
+    {
+      start_azimuth_ = azimuth;
+      last_angle_ = 0;
+      has_start_ = true;
+    }
+
+    float angle = azimuth - start_azimuth_;
+    if (angle < 0)
+      angle += 2*M_PI;
+
+    // Back around to the start, this point belongs to the next revolution
+    if (angle < last_angle_ - M_PI)
+    {
+      sweep_done_ = true;
+      break;
+    }
+    last_angle_ = std::max(last_angle_, angle);
+
+    pending_.push_back(scan.x[i], scan.y[i], scan.z[i], scan.range[i], scan.ring[i], scan.sector[i], pending_.size());
+    pending_intensity_.push_back(has_intensity ? intensity[ scan.index[i] ] : 0.0f);
+    pending_angle_.push_back(angle);
+  }
+
+  if (sweep_done_)
+  {
+    processPending(pending_.size());
+    finish(last_angle_, true);
+    return i;
+  }
+
+  if (pending_.size() == 0)
+    return i;
+
+  // Every sector before the one of the last point is complete
+  uint16_t current = pending_.sector.back();
+  size_t n = 0;
+  while (n < pending_.size() && pending_.sector[n] != current)
+    n++;
+
+  processPending(n);
+
+  // Nothing before the first pending point is still to come
+  finish(pending_angle_[0], false);
+  return i;
+}
+
+
+void SectorStreamer::processPending(size_t n)
+{
+  if (n == 0)
+    return;
+
+  complete_.clear();
+  complete_.reserve(n);
+  for (size_t k=0; k < n; k++)
+    complete_.push_back(pending_.x[k], pending_.y[k], pending_.z[k], pending_.range[k], pending_.ring[k], pending_.sector[k], k);
+
+  ground_segmenter_.segment(complete_);
+  const std::vector<uint8_t>& ground = ground_segmenter_.groundMask();
+  const std::vector<float>& heights = ground_segmenter_.heights();
+
+  double r2_min = r_min_*r_min_;
+  double r2_max = r_max_*r_max_;
+  bool check_angle = !(a_max_ >= M_PI && a_min_ <= -M_PI);
+
+  // Same gates as the whole scan filter of the box detector
+  for (size_t k=0; k < n; k++)
+  {
+    if (ground[k] || heights[k] > max_height_ || heights[k] < min_height_)
+      continue;
+
+    double r2 = complete_.range[k]*complete_.range[k];
+    if (r2 > r2_max || r2 < r2_min)
+      continue;
+
+    if (check_angle)
+    {
+      double angle = std::atan2(complete_.y[k], complete_.x[k]);
+      if (angle > a_max_ || angle < a_min_)
+        continue;
+    }
+
+    insert(complete_.x[k], complete_.y[k], complete_.z[k], pending_intensity_[k], complete_.range[k], pending_angle_[k]);
+  }
+
+  // Keep the points of the current sector
+  pending_.x.erase(pending_.x.begin(), pending_.x.begin() + n);
+  pending_.y.erase(pending_.y.begin(), pending_.y.begin() + n);
+  pending_.z.erase(pending_.z.begin(), pending_.z.begin() + n);
+  pending_.range.erase(pending_.range.begin(), pending_.range.begin() + n);
+  pending_.ring.erase(pending_.ring.begin(), pending_.ring.begin() + n);
+  pending_.sector.erase(pending_.sector.begin(), pending_.sector.begin() + n);
+  pending_.index.erase(pending_.index.begin(), pending_.index.begin() + n);
+  pending_intensity_.erase(pending_intensity_.begin(), pending_intensity_.begin() + n);
+  pending_angle_.erase(pending_angle_.begin(), pending_angle_.begin() + n);
+}
+
+
+void SectorStreamer::insert(float x, float y, float z, float intensity, float range, float angle)
+{
+  int point = obstacles_.points.size();
+  obstacles_.points.push_back(pcl::PointXYZ(x, y, z));
+  obstacle_intensity_.push_back(intensity);
+
+  uint64_t k = key(x, y, z);
+  std::pair<boost::unordered_map<uint64_t, int>::iterator, bool> r = voxels_.insert(std::make_pair(k, (int) parent_.size()));
+
+  int root;
+  if (r.second)
+  {
+    // New voxel, joins the open clusters around it
+    root = parent_.size();
+    parent_.push_back(root);
+    done_.push_back(0);
+    clusters_.push_back(Cluster());
+    clusters_[root].min_range = range;
+    clusters_[root].first_angle = angle;
+    clusters_[root].last_angle = angle;
+    open_.push_back(root);
+
+    for (size_t j=0; j < neighbour_offsets_.size(); j++)
+    {
+      boost::unordered_map<uint64_t, int>::const_iterator n = voxels_.find(k + neighbour_offsets_[j]);
+      if (n == voxels_.end())
+        continue;
+
+      int other = find(n->second);
+      if (!done_[other])
+        root = unite(root, other);
+    }
+  }
+  else
+  {
+    // Finished clusters never grow, the sweep was past their reach
+    root = find(r.first->second);
+    if (done_[root])
+      return;
+  }
+
+  Cluster& c = clusters_[root];
+  c.points.push_back(point);
+  c.min_range = std::min(c.min_range, range);
+  c.first_angle = std::min(c.first_angle, angle);
+  c.last_angle = std::max(c.last_angle, angle);
+}
+
+
+void SectorStreamer::finish(float sweep_angle, bool all)
+{
+  size_t kept = 0;
+  for (size_t i=0; i < open_.size(); i++)
+  {
+    int id = open_[i];
+    if (parent_[id] != id || done_[id])
+      continue;
+
+    Cluster& c = clusters_[id];
+
+    // A point still to come can only join if it is within asin(reach/range) of the cluster.
+    // Around the start of the sweep, that includes the end of the revolution.
+    bool can_finish = all;
+    if (!all && reach_ < c.min_range)
+    {
+      float margin = std::asin(reach_/c.min_range);
+      can_finish = c.first_angle > margin && sweep_angle - c.last_angle > margin;
+    }
+
+    if (!can_finish)
+    {
+      open_[kept++] = id;
+      continue;
+    }
+
+    done_[id] = 1;
+
+    int size = c.points.size();
+    if (size < min_cluster_size_ || size > max_cluster_size_)
+      continue;
+
+    finished_.push_back(pcl::PointIndices());
+    finished_.back().indices = c.points;
+  }
+
+  open_.resize(kept);
+}
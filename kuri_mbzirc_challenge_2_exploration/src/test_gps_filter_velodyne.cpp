@@ -12,6 +12,7 @@
 #include <pcl_conversions/pcl_conversions.h>
 
 #include <kuri_mbzirc_challenge_2_exploration/pointcloud_gps_filter.h>
+#include <kuri_mbzirc_challenge_2_tools/async_logger.h>
 #include <kuri_mbzirc_challenge_2_tools/pose_conversion.h>
 
 PointcloudGpsFilter gps_filter;
@@ -32,7 +33,7 @@ void callbackVelo(const sensor_msgs::PointCloud2::ConstPtr& cloud_msg)
   // Check if filter was updated with all other values (position, orientation)
   if (!gps_filter.isReady())
   {
-    printf("Not ready\n");
+    KURI_WARN_THROTTLE(1.0, "Not ready");
     return;
   }
 
@@ -48,7 +49,7 @@ void callbackVelo(const sensor_msgs::PointCloud2::ConstPtr& cloud_msg)
   // Debug message
   //GeoPoint curr_gps = gps_filter.getRefGPS();
   //printf("Current GPS: %lf \t %lf \n", curr_gps.lat, curr_gps.lon);
-  printf("Total points: %ld \t Time taken: %lf sec\n", final_cloud->points.size(), elapsed_secs);
+  KURI_INFO_THROTTLE(1.0, "Total points: %ld \t Time taken: %lf sec", final_cloud->points.size(), elapsed_secs);
 
   //Publish message
   sensor_msgs::PointCloud2 cloud_cluster_msg;
@@ -1,31 +1,43 @@
 #include <ros/ros.h>
 #include <ctime>
 
+#include <nav_msgs/Odometry.h>
+
 #include <octomap_msgs/Octomap.h>
 
 #include <pcl/point_cloud.h>
 #include <pcl/common/common.h>
 #include <pcl/common/transforms.h>
 #include <pcl/features/normal_3d.h>
-#include <pcl/filters/passthrough.h>
 #include <pcl/filters/extract_indices.h>
 #include <pcl/filters/voxel_grid.h>
 #include <pcl/segmentation/extract_clusters.h>
 #include <pcl/segmentation/sac_segmentation.h>
 #include <pcl_conversions/pcl_conversions.h>
 
+#include <kuri_mbzirc_challenge_2_exploration/compressed_cloud.h>
 #include <kuri_mbzirc_challenge_2_exploration/gps_occupancy.h>
+#include <kuri_mbzirc_challenge_2_exploration/ground_segmentation.h>
+#include <kuri_mbzirc_challenge_2_tools/async_logger.h>
+#include <kuri_mbzirc_challenge_2_tools/cluster_features.h>
+#include <kuri_mbzirc_challenge_2_tools/motion_gated_scheduler.h>
 #include <kuri_mbzirc_challenge_2_tools/pose_conversion.h>
+#include <kuri_mbzirc_challenge_2_tools/stats_reporter.h>
 
 typedef pcl::PointXYZ PcPoint;
 typedef pcl::PointCloud<PcPoint> PcCloud;
 typedef pcl::PointCloud<PcPoint>::Ptr PcCloudPtr;
 typedef std::vector<PcCloudPtr> PcCloudPtrList;
 
-ros::Publisher pub_points;
+CompressedCloudPublisher pub_points;
 ros::Publisher pub_tree;
 
 GPSOccupancy gps_occ;
+GroundSegmenter ground_segmenter;
+ClusterFeatureExtractor feature_extractor;
+ClusterClassifier cluster_classifier;
+MotionGatedScheduler scheduler;
+StatsReporter* stats;
 
 // Parameters from YAML file
 double panel_max_height, panel_min_height, panel_max_range, panel_min_range, panel_max_width, panel_min_width;
@@ -51,9 +63,18 @@ PcCloudPtrList getCloudClusters(PcCloudPtr cloud_ptr)
   ec.setInputCloud (cloud_ptr);
   ec.extract (cluster_indices);
 
+  // The cloud is GPS filtered by now, which drops the intensity, so only the geometric rules apply
+  std::vector<float> no_intensity;
+
   // Get the cloud representing each cluster
   for (std::vector<pcl::PointIndices>::const_iterator it = cluster_indices.begin (); it != cluster_indices.end (); ++it)
   {
+    // Reject clusters that cannot be a panel before copying them
+    ClusterFeatures features;
+    feature_extractor.compute(*cloud_ptr, it->indices, no_intensity, features);
+    if (!cluster_classifier.accept(features))
+      continue;
+
     PcCloudPtr cloud_cluster (new PcCloud);
     for (std::vector<int>::const_iterator pit = it->indices.begin (); pit != it->indices.end (); ++pit)
       cloud_cluster->points.push_back (cloud_ptr->points[*pit]);
@@ -171,6 +192,15 @@ PcCloudPtrList extractBoxClusters(PcCloudPtr cloud_ptr)
 
 void callbackVelo(const sensor_msgs::PointCloud2::ConstPtr& cloud_msg)
 {
+  // A still robot sees the same scene, only update the grid at the heartbeat rate
+  bool process = scheduler.shouldProcess();
+  stats->set("skipped_scans", scheduler.numSkipped());
+  stats->set("motion_gated", scheduler.isGated());
+  stats->publishIfDue();
+
+  if (!process)
+    return;
+
   // Convert msg to pointcloud
   PcCloud cloud;
 
@@ -181,20 +211,15 @@ void callbackVelo(const sensor_msgs::PointCloud2::ConstPtr& cloud_msg)
   // Check if filter was updated with all other values (position, orientation)
   if (!gps_occ.isReady())
   {
-    printf("Not ready\n");
+    KURI_WARN_THROTTLE(1.0, "Not ready");
     return;
   }
 
 
-  PcCloud::Ptr processed_cloud = input_cloud;
-
-
-  // Filter based on cloud bounds
-  pcl::PassThrough<pcl::PointXYZ> pass;
-  pass.setInputCloud (processed_cloud);
-  pass.setFilterFieldName ("z");
-  pass.setFilterLimits (panel_min_height, panel_max_height);
-  pass.filter (*processed_cloud);
+  // Remove the ground and keep points at panel height above it
+  PcCloud::Ptr processed_cloud (new PcCloud);
+  ground_segmenter.segment(*input_cloud);
+  ground_segmenter.extractObstacles(*input_cloud, panel_min_height, panel_max_height, *processed_cloud);
 
 
   // Filter cloud based on gps bounds
@@ -230,11 +255,7 @@ void callbackVelo(const sensor_msgs::PointCloud2::ConstPtr& cloud_msg)
   processed_cloud->height = 1;
   processed_cloud->width = processed_cloud->points.size();
 
-  sensor_msgs::PointCloud2 cloud_cluster_msg;
-  pcl::toROSMsg(*processed_cloud, cloud_cluster_msg);
-  cloud_cluster_msg.header.frame_id = cloud_msg->header.frame_id;
-  cloud_cluster_msg.header.stamp = ros::Time::now();
-  pub_points.publish(cloud_cluster_msg);
+  pub_points.publish(*processed_cloud, cloud_msg->header.frame_id, ros::Time::now());
 
   // Publish occupancy
   octomap_msgs::Octomap octo_msg;
@@ -255,6 +276,12 @@ void callbackIMU(const sensor_msgs::Imu::ConstPtr& msg)
   gps_occ.setRefOrientation(msg->orientation);
 }
 
+void callbackOdom(const nav_msgs::Odometry::ConstPtr& msg)
+{
+  const geometry_msgs::Twist& t = msg->twist.twist;
+  scheduler.updateTwist(sqrt(t.linear.x*t.linear.x + t.linear.y*t.linear.y), t.angular.z);
+}
+
 
 int main(int argc, char **argv)
 {
@@ -299,6 +326,16 @@ int main(int argc, char **argv)
 
   node_handle.param("occupancy_grid_settings/decay_rate", occupancy_decay_rate, 0.9);
 
+  GroundSegmentationParams ground_params;
+  GroundSegmenter::loadParams(node_handle, "ground_segmentation/", ground_params);
+  ground_segmenter.setParams(ground_params);
+
+  feature_extractor.loadParams(node_handle, "cluster_classifier/");
+  cluster_classifier.loadParams(node_handle, "cluster_classifier/rules/");
+
+  scheduler.loadParams(node_handle, "motion_gating/");
+  stats = new StatsReporter("exploration/gps_occupancy");
+
 
   double grid_resolution, grid_prob_hit, grid_prob_miss;
   node_handle.param("occupancy_grid_settings/resolution", grid_resolution, 1.0);
@@ -325,7 +362,9 @@ int main(int argc, char **argv)
   ros::Subscriber sub_gps   = node_handle.subscribe("/gps/fix", 1, callbackGPS);
   ros::Subscriber sub_imu   = node_handle.subscribe("/imu/data", 1, callbackIMU);
   ros::Subscriber sub_velo  = node_handle.subscribe("/velodyne_points", 1, callbackVelo);
-  pub_points = node_handle.advertise<sensor_msgs::PointCloud2>("/explore/filtered_gps_points", 10);
+  ros::Subscriber sub_odom  = node_handle.subscribe("/odometry/filtered", 1, callbackOdom);
+  pub_points.advertise(node_handle, "/explore/filtered_gps_points", 10);
+  pub_points.encoder().loadParams(node_handle, "cloud_compression/");
   pub_tree   = node_handle.advertise<octomap_msgs::Octomap>("/explore/octomap", 10);
 
   // Every 1 second, get the most probable panel candidate and move towards it
@@ -349,5 +388,6 @@ int main(int argc, char **argv)
     rate.sleep();
   }
 
+  delete stats;
   return 0;
 }
@@ -1,5 +1,6 @@
 #include "ros/ros.h"
 #include <iostream>
+#include <algorithm>
 
 #include <geometry_msgs/Pose.h>
 #include <geometry_msgs/PoseArray.h>
@@ -30,6 +31,9 @@
 #include <kuri_mbzirc_challenge_2_msgs/BoxPositionAction.h>
 #include "../include/kuri_mbzirc_challenge_2_exploration/velodyne_box_detector.h"
 
+#define KURI_ALLOCATION_COUNTER_IMPLEMENTATION
+#include <kuri_mbzirc_challenge_2_tools/allocation_counter.h>
+#include <kuri_mbzirc_challenge_2_tools/async_logger.h>
 #include <kuri_mbzirc_challenge_2_tools/pose_conversion.h>
 
 #include <unistd.h>
@@ -37,10 +41,14 @@
 
 
 BoxPositionActionHandler::BoxPositionActionHandler(std::string name, std::vector<GeoPoint> bounds) :
-  as_(nh_, name, boost::bind(&BoxPositionActionHandler::executeCB, this, _1), false)
+  as_(nh_, name, boost::bind(&BoxPositionActionHandler::executeCB, this, _1), false),
+  stats_("exploration/velodyne_box_detector")
 {
   action_name_ = name;
   is_initiatializing_ = false;
+  range_max_ = range_min_ = 0;
+  angle_max_ = angle_min_ = 0;
+  start_version_ = 0;
 
   detect_new_distance_ = 20; //Look for new clusters past this range
 
@@ -49,19 +57,94 @@ BoxPositionActionHandler::BoxPositionActionHandler(std::string name, std::vector
   confidence_update_lambda_ = 0.0325;
   max_match_distance_ = 3.0;
 
+  min_height_ = 0.5;
+  max_height_ = 1.8;
+
+  roi_enabled_ = true;
+  roi_min_confidence_ = 0.8;
+  roi_radius_ = max_match_distance_;
+  roi_full_scan_interval_ = 10;
+  frame_count_ = 0;
+  has_odom_ = false;
+  has_prev_odom_ = false;
+
+  has_sensor_to_map_ = false;
+  background_dropped_ = 0;
+  use_incremental_clustering_ = false;
+
+  tracker_settled_ = false;
+  last_seq_ = 0;
+  has_last_seq_ = false;
+  scan_gap_ = false;
+  missed_scans_ = 0;
+  decoded_ring_scan_ = NULL;
+  stream_sweep_started_ = false;
+  stream_initializing_ = false;
+  throughput_start_ = ros::WallTime::now();
+  throughput_scans_ = 0;
+
   // Set up GPS filter
   gps_filter_.setBounds(bounds);
 
   // Topic handlers
-  pub_wall  = nh_.advertise<sensor_msgs::PointCloud2>("/explore/PCL", 10);
+  pub_wall.advertise(nh_, "/explore/PCL", 10);
   pub_lines = nh_.advertise<visualization_msgs::Marker>("/explore/HoughLines", 10);
   pub_points= nh_.advertise<visualization_msgs::Marker>("/explore/points", 10);
 
+  cluster_view_ = vis_sink_.addChannel<CloudView>(
+        boost::bind(&CompressedCloudPublisher::getNumSubscribers, &pub_wall),
+        boost::bind(&BoxPositionActionHandler::publishClusterView, this, _1));
+  points_view_ = vis_sink_.addChannel<PointsView>(
+        boost::bind(&ros::Publisher::getNumSubscribers, &pub_points),
+        boost::bind(publishPointsView, boost::cref(pub_points), _1));
+
   tf_listener = new tf::TransformListener();
 
+  // One thread per queue. The action server stays on the global queue.
+  gps_version_ = 0;
+  orientation_version_ = 0;
+  scan_count_ = 0;
+  scan_arena_enabled_ = true;
+  cluster_tree_.reset(new pcl::search::KdTree<PcPoint>);
+  nh_velo_.setCallbackQueue(&velo_queue_);
+  nh_state_.setCallbackQueue(&state_queue_);
+  velo_spinner_.reset(new ros::AsyncSpinner(1, &velo_queue_));
+  state_spinner_.reset(new ros::AsyncSpinner(1, &state_queue_));
+  velo_spinner_->start();
+  state_spinner_->start();
+
+  // Scans are decoded on the velodyne queue thread and clustered on their own thread
+  startPipeline(2);
+
   as_.start();
 }
 
+BoxPositionActionHandler::~BoxPositionActionHandler()
+{
+  velo_spinner_->stop();
+  stopPipeline();
+  state_spinner_->stop();
+  vis_sink_.stop();
+}
+
+void BoxPositionActionHandler::startPipeline(int depth)
+{
+  scan_ring_.reset(new PipelineRing<DecodedScan>(depth));
+  cluster_thread_ = boost::thread(&BoxPositionActionHandler::clusterLoop, this);
+}
+
+void BoxPositionActionHandler::stopPipeline()
+{
+  if (!scan_ring_)
+    return;
+
+  // The cluster thread finishes the scans already decoded
+  scan_ring_->close();
+  if (cluster_thread_.joinable())
+    cluster_thread_.join();
+  scan_ring_.reset();
+}
+
 void BoxPositionActionHandler::executeCB(const GoalConstPtr &goal)
 {
   if (goal->request == goal->REQUEST_START)
@@ -81,19 +164,23 @@ void BoxPositionActionHandler::executeCB(const GoalConstPtr &goal)
       return;
     }
 
-    range_max_ = goal->range_max;
-    range_min_ = goal->range_min;
-    angle_max_ = goal->angle_max;
-    angle_min_ = goal->angle_min;
-
-    // Enable node
-    is_initiatializing_ = true;
+    // Enable node, the cluster thread reinitializes with these limits before its next scan
+    StartRequest request;
+    request.range_max = goal->range_max;
+    request.range_min = goal->range_min;
+    request.angle_max = goal->angle_max;
+    request.angle_min = goal->angle_min;
+    start_request_.store(request);
+    scheduler_.wake();
 
     // Enable callbacks
-    sub_velo  = nh_.subscribe("/velodyne_points", 1, &BoxPositionActionHandler::callbackVelo, this);
-    sub_odom  = nh_.subscribe("/odometry/filtered", 1, &BoxPositionActionHandler::callbackOdom, this);
-    sub_gps  = nh_.subscribe("/gps/fix", 1, &BoxPositionActionHandler::callbackGPS, this);
-    sub_imu  = nh_.subscribe("/imu/data", 1, &BoxPositionActionHandler::callbackIMU, this);
+    if (packet_decoder_.isEnabled())
+      sub_velo  = nh_velo_.subscribe(packet_decoder_.getTopic(), 1, &BoxPositionActionHandler::callbackPackets, this);
+    else
+      sub_velo  = nh_velo_.subscribe("/velodyne_points", 1, &BoxPositionActionHandler::callbackVelo, this);
+    sub_odom  = nh_state_.subscribe("/odometry/filtered", 1, &BoxPositionActionHandler::callbackOdom, this);
+    sub_gps  = nh_state_.subscribe("/gps/fix", 1, &BoxPositionActionHandler::callbackGPS, this);
+    sub_imu  = nh_state_.subscribe("/imu/data", 1, &BoxPositionActionHandler::callbackIMU, this);
 
     setSuccess(true);
   }
@@ -110,6 +197,27 @@ void BoxPositionActionHandler::executeCB(const GoalConstPtr &goal)
 
   else if(goal->request == goal->REQUEST_QUERY)
   {
+    ros::WallTime start = ros::WallTime::now();
+
+    // The next scans are processed at full rate, even if the robot is still
+    scheduler_.wake();
+
+    // Never waits for the scan being processed
+    PanelSnapshotConstPtr snapshot = getSnapshot();
+
+    result_.waypoints.poses.clear();
+    if (snapshot)
+    {
+      result_.waypoints.header.frame_id = snapshot->frame_id;
+      result_.waypoints.header.stamp = snapshot->stamp;
+
+      for (int i=0; i < snapshot->panels.size(); i++)
+        result_.waypoints.poses.push_back(snapshot->panels[i].pose);
+    }
+
+    stats_.set("query_latency_ms", (ros::WallTime::now() - start).toSec()*1000);
+    stats_.increment("queries");
+
     // set the action state to succeeded
     setSuccess(true);
   }
@@ -127,33 +235,336 @@ void BoxPositionActionHandler::setSuccess(bool success)
   as_.setSucceeded(result_);
 }
 
+void BoxPositionActionHandler::setRoiMode(ros::NodeHandle& nh, const std::string& ns)
+{
+  nh.param(ns + "enabled", roi_enabled_, roi_enabled_);
+  nh.param(ns + "min_confidence", roi_min_confidence_, roi_min_confidence_);
+  nh.param(ns + "radius", roi_radius_, roi_radius_);
+  nh.param(ns + "full_scan_interval", roi_full_scan_interval_, roi_full_scan_interval_);
+
+  if (roi_full_scan_interval_ < 1)
+    roi_full_scan_interval_ = 1;
+}
+
+void BoxPositionActionHandler::setScanArena(ros::NodeHandle& nh, const std::string& ns)
+{
+  // Applied on the cluster thread at the start of processScan or processChunk, while no arena buffer is alive
+  nh.param(ns + "enabled", scan_arena_enabled_, scan_arena_enabled_);
+}
+
+void BoxPositionActionHandler::setCloudCompression(ros::NodeHandle& nh, const std::string& ns)
+{
+  pub_wall.encoder().loadParams(nh, ns);
+}
+
+void BoxPositionActionHandler::setBackgroundMap(ros::NodeHandle& nh, const std::string& ns)
+{
+  background_map_.loadParams(nh, ns);
+  if (!background_map_.isEnabled())
+    return;
+
+  if (background_map_.isReady())
+    KURI_INFO("Background map: %lu static voxels from %s", background_map_.size(), background_map_.getFile().c_str());
+  else if (background_map_.isLearning())
+    KURI_INFO("Background map: learning over the first %d scans", background_map_.scansToLearn());
+}
+
+void BoxPositionActionHandler::setIncrementalClustering(ros::NodeHandle& nh, const std::string& ns)
+{
+  incremental_clusterer_.loadParams(nh, ns);
+}
+
+void BoxPositionActionHandler::setMotionGating(ros::NodeHandle& nh, const std::string& ns)
+{
+  scheduler_.loadParams(nh, ns);
+}
+
+void BoxPositionActionHandler::setPipeline(ros::NodeHandle& nh, const std::string& ns)
+{
+  int depth = scan_ring_ ? scan_ring_->size() : 2;
+  nh.param(ns + "depth", depth, depth);
+
+  if (scan_ring_ && depth == (int) scan_ring_->size())
+    return;
+
+  stopPipeline();
+  startPipeline(depth);
+}
+
+void BoxPositionActionHandler::setPacketDecoding(ros::NodeHandle& nh, const std::string& ns)
+{
+  packet_decoder_.loadParams(nh, ns);
+  packet_decoder_.setNumSectors(ground_segmenter_.getParams().num_sectors);
+
+  if (packet_decoder_.isEnabled() && ground_segmenter_.getParams().num_rings != 16)
+    KURI_WARN("Velodyne packets: decoded as VLP-16, but ground_segmentation/num_rings is %d", ground_segmenter_.getParams().num_rings);
+}
+
+void BoxPositionActionHandler::setSectorStreaming(ros::NodeHandle& nh, const std::string& ns)
+{
+  sector_streamer_.loadParams(nh, ns);
+  sector_streamer_.setGroundSegmentation(ground_segmenter_.getParams(), min_height_, max_height_);
+
+  // Chunks of a revolution only come from the packet decoder
+  if (sector_streamer_.isEnabled() && !packet_decoder_.isEnabled())
+    KURI_WARN("Sector streaming needs velodyne_packets/enabled, whole scans are processed instead");
+}
+
+void BoxPositionActionHandler::setVisualizationRate(double rate)
+{
+  vis_sink_.setMaxRate(rate);
+}
+
+void BoxPositionActionHandler::setClusterClassifier(ros::NodeHandle& nh, const std::string& ns)
+{
+  feature_extractor_.loadParams(nh, ns);
+  cluster_classifier_.loadParams(nh, ns + "rules/");
+}
+
+void BoxPositionActionHandler::setGroundSegmentation(const GroundSegmentationParams& params, double min_height, double max_height)
+{
+  ground_segmenter_.setParams(params);
+  min_height_ = min_height;
+  max_height_ = max_height;
+}
+
 
 
 void   BoxPositionActionHandler::callbackOdom(const nav_msgs::Odometry::ConstPtr& odom_msg)
 {
-  current_odom = *odom_msg;
+  const geometry_msgs::Pose& p = odom_msg->pose.pose;
+
+  PoseSample sample;
+  sample.x = p.position.x;
+  sample.y = p.position.y;
+  sample.z = p.position.z;
+  sample.qx = p.orientation.x;
+  sample.qy = p.orientation.y;
+  sample.qz = p.orientation.z;
+  sample.qw = p.orientation.w;
+  latest_odom_.store(sample);
+
+  const geometry_msgs::Twist& t = odom_msg->twist.twist;
+  scheduler_.updateTwist(sqrt(t.linear.x*t.linear.x + t.linear.y*t.linear.y), t.angular.z);
 }
 
 
 void   BoxPositionActionHandler::callbackGPS(const sensor_msgs::NavSatFix::ConstPtr& msg)
 {
-  gps_filter_.setRefGPS(msg->latitude, msg->longitude, msg->header.seq);
+  GpsSample sample;
+  sample.lat = msg->latitude;
+  sample.lon = msg->longitude;
+  sample.seq = msg->header.seq;
+  latest_gps_.store(sample);
 }
 
 
 void   BoxPositionActionHandler::callbackIMU(const sensor_msgs::Imu::ConstPtr& msg)
 {
-  gps_filter_.setRefOrientation(msg->orientation);
+  OrientationSample sample;
+  sample.x = msg->orientation.x;
+  sample.y = msg->orientation.y;
+  sample.z = msg->orientation.z;
+  sample.w = msg->orientation.w;
+  latest_orientation_.store(sample);
+}
+
+
+void   BoxPositionActionHandler::applyStartRequest()
+{
+  StartRequest request;
+  uint32_t version;
+  if (!start_request_.load(request, version) || version == start_version_)
+    return;
+
+  range_max_ = request.range_max;
+  range_min_ = request.range_min;
+  angle_max_ = request.angle_max;
+  angle_min_ = request.angle_min;
+  is_initiatializing_ = true;
+  start_version_ = version;
+
+  // The motion since the last goal is not one step to replay on the new clusters
+  has_prev_odom_ = false;
+}
+
+
+void   BoxPositionActionHandler::updateSensorState()
+{
+  // Apply the latest state from the state thread
+  GpsSample gps;
+  uint32_t version;
+  if (latest_gps_.load(gps, version) && version != gps_version_)
+  {
+    gps_filter_.setRefGPS(gps.lat, gps.lon, gps.seq);
+    gps_version_ = version;
+  }
+
+  OrientationSample o;
+  if (latest_orientation_.load(o, version) && version != orientation_version_)
+  {
+    geometry_msgs::Quaternion q;
+    q.x = o.x;
+    q.y = o.y;
+    q.z = o.z;
+    q.w = o.w;
+    gps_filter_.setRefOrientation(q);
+    orientation_version_ = version;
+  }
+
+  PoseSample pose;
+  if (latest_odom_.load(pose))
+  {
+    current_odom.pose.pose.position.x = pose.x;
+    current_odom.pose.pose.position.y = pose.y;
+    current_odom.pose.pose.position.z = pose.z;
+    current_odom.pose.pose.orientation.x = pose.qx;
+    current_odom.pose.pose.orientation.y = pose.qy;
+    current_odom.pose.pose.orientation.z = pose.qz;
+    current_odom.pose.pose.orientation.w = pose.qw;
+    has_odom_ = true;
+  }
 }
 
 
 void   BoxPositionActionHandler::callbackVelo(const sensor_msgs::PointCloud2::ConstPtr& cloud_msg)
 {
+  ros::WallTime received = ros::WallTime::now();
+
+  DecodedScan* scan = beginScan(cloud_msg->header);
+  if (!scan)
+    return;
+
   // Convert msg to pointcloud
-  PcCloud cloud;
+  pcl::fromROSMsg (*cloud_msg, *scan->cloud);
+  readCloudIntensity(*cloud_msg, scan->intensity);
+  scan->has_ring_scan = false;
 
-  pcl::fromROSMsg (*cloud_msg, cloud);
-  pc_current_ = cloud.makeShared();
+  endScan(scan, cloud_msg->header, received);
+}
+
+
+void   BoxPositionActionHandler::callbackPackets(const velodyne_msgs::VelodyneScan::ConstPtr& scan_msg)
+{
+  ros::WallTime received = ros::WallTime::now();
+
+  DecodedScan* scan = beginScan(scan_msg->header);
+  if (!scan)
+    return;
+
+  // Straight from the packets into the cloud and the ring layout of the ground segmentation
+  packet_decoder_.decode(*scan_msg, *scan->cloud, scan->intensity, scan->ring_scan);
+  scan->has_ring_scan = true;
+
+  endScan(scan, scan_msg->header, received);
+}
+
+
+DecodedScan* BoxPositionActionHandler::beginScan(const std_msgs::Header& header)
+{
+  // The subscriber queue holds a single scan, so scans that arrive while this thread is busy are lost
+  uint32_t seq = header.seq;
+  if (has_last_seq_ && seq > last_seq_ + 1)
+  {
+    missed_scans_ += seq - last_seq_ - 1;
+    scan_gap_ = true;
+  }
+  last_seq_ = seq;
+  has_last_seq_ = true;
+  stats_.set("missed_scans", missed_scans_);
+
+  // Skip the scan before converting it if the robot is still and nothing is left to confirm.
+  // A streamed revolution is never cut short, the chunks are too small to be worth skipping.
+  if (!sector_streamer_.isEnabled() && !scheduler_.isDue(tracker_settled_.load()))
+  {
+    stats_.set("skipped_scans", scheduler_.numSkipped());
+    stats_.set("motion_gated", 1);
+    return NULL;
+  }
+
+  // Every slot is held by the cluster thread, drop the scan rather than let the latency grow
+  DecodedScan* scan = scan_ring_->acquire();
+  if (!scan)
+  {
+    stats_.set("dropped_scans", scan_ring_->dropped());
+    scan_gap_ = true;
+    return NULL;
+  }
+
+  scan->follows_gap = scan_gap_;
+  scan_gap_ = false;
+  return scan;
+}
+
+
+void   BoxPositionActionHandler::endScan(DecodedScan* scan, const std_msgs::Header& header, const ros::WallTime& received)
+{
+  scan->header = header;
+  scan->received = received;
+
+  // Pose of the sensor in the background map and in the clustering frame for this scan
+  scan->has_sensor_to_map = background_map_.isEnabled()
+      && lookupSensorTransform(background_map_.getFrameId(), header.frame_id, scan->sensor_to_map);
+  scan->has_sensor_to_cluster_frame = incremental_clusterer_.isEnabled()
+      && lookupSensorTransform(incremental_clusterer_.getFrameId(), header.frame_id, scan->sensor_to_cluster_frame);
+
+  scan_ring_->push(scan);
+
+  // Only a scan that reached the cluster thread starts the next heartbeat period
+  scheduler_.markProcessed();
+
+  stats_.set("decode_ms", (ros::WallTime::now() - received).toSec()*1000);
+  stats_.set("queue_depth", scan_ring_->queued());
+}
+
+
+void   BoxPositionActionHandler::clusterLoop()
+{
+  DecodedScan* scan;
+  while ((scan = scan_ring_->wait()) != NULL)
+  {
+    if (sector_streamer_.isEnabled() && scan->has_ring_scan)
+      processChunk(*scan);
+    else
+      processScan(*scan);
+
+    // The slot goes back to the velodyne thread, nothing may keep its cloud
+    pc_current_.reset();
+    decoded_ring_scan_ = NULL;
+    scan_ring_->release(scan);
+
+    tracker_settled_ = isTrackerSettled();
+  }
+}
+
+
+void   BoxPositionActionHandler::processScan(DecodedScan& scan)
+{
+  ros::WallTime start = ros::WallTime::now();
+  unsigned long mallocs_start = allocation_counter::count();
+
+  // Everything taken from the arena below is released when the scan is done
+  scan_arena_.setEnabled(scan_arena_enabled_);
+  cloud_pool_.setEnabled(scan_arena_enabled_);
+  cloud_pool_.reset();
+  ScanArena::Scope arena_scope(scan_arena_);
+
+  // The slot keeps the previous buffer, so neither side reallocates
+  pc_current_ = scan.cloud;
+  intensity_current_.swap(scan.intensity);
+  decoded_ring_scan_ = scan.has_ring_scan ? &scan.ring_scan : NULL;
+  const std_msgs::Header& header = scan.header;
+
+  updateSensorState();
+  applyStartRequest();
+
+  // Move the tracked clusters along with the robot
+  predictClusters();
+
+  // Decide whether this scan is processed in full or only around the tracked panels
+  ScanFlagList in_roi((ArenaAllocator<bool>(scan_arena_)));
+  bool is_roi_frame = !is_initiatializing_ && selectRoi(in_roi);
+  frame_count_++;
 
   // ============
   // Perform GPS bounds filtering
@@ -163,32 +574,54 @@ void   BoxPositionActionHandler::callbackVelo(const sensor_msgs::PointCloud2::Co
   // Check if filter was updated with all other values (position, orientation)
   if (!gps_filter_.isReady())
   {
-    printf("GPS filter not ready\n");
+    KURI_WARN_THROTTLE(1.0, "GPS filter not ready");
     return;
   }
 
-  PcCloud::Ptr final_cloud (new PcCloud);
-  gps_filter_.filterBounds(final_cloud);
+  if (!is_roi_frame)
+  {
+    PcCloudPtr final_cloud = cloud_pool_.acquire();
+    gps_filter_.filterBounds(final_cloud);
+
+    // Transform to odom frame
+    transformToFrame(final_cloud, final_cloud, header.frame_id, "odom");
+  }
+
+
+  // Pose of the sensor in the background map for this scan
+  has_sensor_to_map_ = scan.has_sensor_to_map;
+  sensor_to_map_ = scan.sensor_to_map;
+
+  // Incremental clustering only sees full scans, a region of interest would look like the rest of the scene vanished
+  use_incremental_clustering_ = scan.has_sensor_to_cluster_frame && !is_roi_frame;
+  sensor_to_cluster_frame_ = scan.sensor_to_cluster_frame;
 
 
   // =============
   // Get Clusters
   // =============
-  // Transform to odom frame
-  transformToFrame(final_cloud, final_cloud, cloud_msg->header.frame_id, "odom");
-
   if (is_initiatializing_)
   {
     getInitialBoxClusters();
+    publishSnapshot(header.frame_id, header.stamp);
     drawClusters("odom");
 
     return;
   }
 
+  PcCloudPtr cloud_input = pc_current_;
+  if (is_roi_frame)
+    cloud_input = filterCloudRoi(pc_current_, in_roi);
 
-  PcCloudPtr cloud_filtered = filterCloudRangeAngle(pc_current_, range_min_, range_max_, angle_min_, angle_max_);
-  PcCloudPtrList pc_vector = extractBoxClusters(cloud_filtered);
-  std::vector<geometry_msgs::Pose> poses = getPanelPose(pc_vector);
+  PcCloudPtr cloud_filtered = filterCloudRangeAngle(cloud_input, range_min_, range_max_, angle_min_, angle_max_);
+
+  // Whole scans only, the region of interest would leave the rest of the arena unseen
+  if (!is_roi_frame && has_sensor_to_map_ && background_map_.isLearning())
+    learnBackground(cloud_filtered);
+
+  std::vector<OrientedRect> footprints;
+  PcCloudPtrList pc_vector = extractBoxClusters(cloud_filtered, footprints);
+  std::vector<geometry_msgs::Pose> poses = getPanelPose(pc_vector, footprints);
 
   // Create vector to track updates
   /*
@@ -198,11 +631,7 @@ void   BoxPositionActionHandler::callbackVelo(const sensor_msgs::PointCloud2::Co
   */
 
   int pc_size = pc_vector.size();
-  std::vector<bool> is_inserted_current;
-  for (int ib=0; ib < pc_size; ib++)
-  {
-    is_inserted_current.push_back(false);
-  }
+  ScanFlagList is_inserted_current(pc_size, false, ArenaAllocator<bool>(scan_arena_));
 
 
   //
@@ -210,6 +639,10 @@ void   BoxPositionActionHandler::callbackVelo(const sensor_msgs::PointCloud2::Co
   //
   for (int i_prev=0; i_prev<cluster_list.size(); i_prev++)
   {
+    // Clusters outside the region of interest were not observed in this scan
+    if (is_roi_frame && !in_roi[i_prev])
+      continue;
+
     BoxCluster b1 = cluster_list[i_prev];
 
     // Find closest box
@@ -236,9 +669,10 @@ void   BoxPositionActionHandler::callbackVelo(const sensor_msgs::PointCloud2::Co
     {
       // Match found, update it
       cluster_list[i_prev].point_cloud = pc_vector[idx];
+      cluster_list[i_prev].footprint = footprints[idx];
       cluster_list[i_prev].pose = poses[idx];
 
-      double dist = computeDistance(cluster_list[idx].pose); //distance from origin
+      double dist = computeDistance(poses[idx]); //distance from origin
       double p = 0.5 + confidence_update_base_*exp(-confidence_update_lambda_*dist);
 
       cluster_list[i_prev].confidence.updateProbability(p);
@@ -274,6 +708,7 @@ void   BoxPositionActionHandler::callbackVelo(const sensor_msgs::PointCloud2::Co
 
     BoxCluster b1;
     b1.point_cloud = pc_vector[i_curr];
+    b1.footprint = footprints[i_curr];
     b1.pose = poses[i_curr];
     b1.confidence.setProbability(0.5);
 
@@ -297,152 +732,477 @@ void   BoxPositionActionHandler::callbackVelo(const sensor_msgs::PointCloud2::Co
       }
   }
 
+  // Hand the result to queries and visualization
+  publishSnapshot(header.frame_id, header.stamp);
+
   // Display clouds
   drawClusters("odom");
 
-  pc_prev_ = pc_current_;
+  // Throughput of the whole pipeline, and latency from the arrival of the scan
+  ros::WallTime done = ros::WallTime::now();
+  throughput_scans_++;
+  double window = (done - throughput_start_).toSec();
+  if (window >= 1.0)
+  {
+    stats_.set("throughput_hz", throughput_scans_/window);
+    throughput_start_ = done;
+    throughput_scans_ = 0;
+  }
+
+  stats_.set("latency_ms", (done - start).toSec()*1000);
+  stats_.set("pipeline_latency_ms", (done - scan.received).toSec()*1000);
+  stats_.set("queue_depth", scan_ring_->queued());
+  stats_.set("dropped_scans", scan_ring_->dropped());
+  stats_.set("input_points", pc_current_->points.size());
+  stats_.set("processed_points", cloud_input->points.size());
+  stats_.set("roi_mode", is_roi_frame);
+  stats_.set("tracked_clusters", cluster_list.size());
+  stats_.set("arena_peak_kb", scan_arena_.peak()/1024.0);
+  stats_.set("pooled_clouds", cloud_pool_.size());
+  stats_.set("motion_gated", scheduler_.isGated());
+  if (use_incremental_clustering_)
+  {
+    stats_.set("cluster_voxels", incremental_clusterer_.numVoxels());
+    stats_.set("cluster_voxels_changed", incremental_clusterer_.numAdded() + incremental_clusterer_.numRemoved());
+    stats_.set("cluster_voxels_rebuilt", incremental_clusterer_.numRebuilt());
+  }
+  if (background_map_.isEnabled())
+  {
+    stats_.set("background_voxels", background_map_.size());
+    stats_.set("background_dropped", background_dropped_);
+  }
+  if (allocation_counter::enabled())
+    stats_.set("mallocs_per_scan", allocation_counter::count() - mallocs_start);
+  stats_.publishIfDue();
 }
 
 
-double BoxPositionActionHandler::computeDistance(geometry_msgs::Pose p1)
+void   BoxPositionActionHandler::processChunk(DecodedScan& scan)
 {
-  double x = p1.position.x, y = p1.position.y, z = p1.position.z;
-  return sqrt(x*x + y*y + z*z);
+  ros::WallTime start = ros::WallTime::now();
+
+  // Everything taken from the arena below is released when the chunk is done
+  scan_arena_.setEnabled(scan_arena_enabled_);
+  cloud_pool_.setEnabled(scan_arena_enabled_);
+  cloud_pool_.reset();
+  ScanArena::Scope arena_scope(scan_arena_);
+
+  pc_current_ = scan.cloud;
+  const std_msgs::Header& header = scan.header;
+
+  updateSensorState();
+  applyStartRequest();
+
+  // A lost chunk leaves a hole in the revolution, the open clusters may be missing its points
+  if (scan.follows_gap && stream_sweep_started_)
+    restartStreamedSweep();
+
+  // A chunk may hold the end of one revolution and the start of the next
+  int updated = 0;
+  int finished = 0;
+  size_t i = 0;
+  while (i < scan.ring_scan.size())
+  {
+    if (!stream_sweep_started_)
+      startStreamedSweep();
+
+    i = sector_streamer_.add(*scan.cloud, scan.intensity, scan.ring_scan, i);
+    finished += sector_streamer_.finished().size();
+    updated += matchStreamedClusters();
+
+    if (sector_streamer_.sweepDone())
+    {
+      finishStreamedSweep();
+      updated++;
+    }
+  }
+
+  // Hand the result to queries and visualization as soon as a cluster is seen
+  if (updated > 0)
+  {
+    publishSnapshot(header.frame_id, header.stamp);
+    drawClusters("odom");
+  }
+
+  ros::WallTime done = ros::WallTime::now();
+  if (finished > 0)
+    stats_.set("detection_latency_ms", (done - scan.received).toSec()*1000);
+
+  stats_.set("latency_ms", (done - start).toSec()*1000);
+  stats_.set("pipeline_latency_ms", (done - scan.received).toSec()*1000);
+  stats_.set("queue_depth", scan_ring_->queued());
+  stats_.set("dropped_scans", scan_ring_->dropped());
+  stats_.set("input_points", pc_current_->points.size());
+  stats_.set("stream_open_clusters", sector_streamer_.numOpen());
+  stats_.increment("stream_finished_clusters", finished);
+  stats_.set("tracked_clusters", cluster_list.size());
+  stats_.publishIfDue();
 }
 
 
-double BoxPositionActionHandler::computeDistance(geometry_msgs::Pose p1, geometry_msgs::Pose p2)
+void BoxPositionActionHandler::restartStreamedSweep()
 {
-  double x = p1.position.x - p2.position.x;
-  double y = p1.position.y - p2.position.y;
-  double z = p1.position.z - p2.position.z;
-  return sqrt(x*x + y*y + z*z);
+  // The clusters matched so far keep their update, the misses of this revolution are not counted
+  stream_sweep_started_ = false;
+  stats_.increment("stream_restarted_sweeps");
+}
+
+
+void BoxPositionActionHandler::startStreamedSweep()
+{
+  // Move the tracked clusters along with the robot, once per revolution
+  predictClusters();
+
+  stream_initializing_ = is_initiatializing_;
+  if (stream_initializing_)
+  {
+    cluster_list.clear();
+    setDefaultLimits();
+  }
+
+  sector_streamer_.startSweep();
+  sector_streamer_.setLimits(range_min_, range_max_, angle_min_, angle_max_);
+  stream_matched_.assign(cluster_list.size(), 0);
+  stream_sweep_started_ = true;
+}
+
+
+int BoxPositionActionHandler::matchStreamedClusters()
+{
+  const std::vector<pcl::PointIndices>& clusters = sector_streamer_.finished();
+  if (clusters.empty())
+    return 0;
+
+  PcCloudPtrList pc_vector = getClusterClouds(sector_streamer_.obstacles(), clusters, sector_streamer_.obstacleIntensity());
+  std::vector<OrientedRect> footprints;
+  pc_vector = filterBoxSize(pc_vector, footprints);
+  std::vector<geometry_msgs::Pose> poses = getPanelPose(pc_vector, footprints);
+
+  for (int i_curr=0; i_curr < pc_vector.size(); i_curr++)
+  {
+    if (stream_initializing_)
+    {
+      BoxCluster b;
+      b.point_cloud = pc_vector[i_curr];
+      b.footprint = footprints[i_curr];
+      b.pose = poses[i_curr];
+      b.confidence.setProbability(0.5);
+
+      cluster_list.push_back(b);
+      stream_matched_.push_back(1);
+      continue;
+    }
+
+    // Closest tracked cluster not seen yet in this revolution
+    double r_min = 1/.0;
+    int idx = -1;
+
+    for (int i_prev=0; i_prev < cluster_list.size(); i_prev++)
+    {
+      if (stream_matched_[i_prev])
+        continue;
+
+      double r = computeDistance(cluster_list[i_prev].pose, poses[i_curr]);
+      if (r < r_min && r < max_match_distance_)
+      {
+        r_min = r;
+        idx = i_prev;
+      }
+    }
+
+    if (idx < 0)
+      continue;
+
+    cluster_list[idx].point_cloud = pc_vector[i_curr];
+    cluster_list[idx].footprint = footprints[i_curr];
+    cluster_list[idx].pose = poses[i_curr];
+
+    double dist = computeDistance(poses[i_curr]); //distance from origin
+    double p = 0.5 + confidence_update_base_*exp(-confidence_update_lambda_*dist);
+
+    cluster_list[idx].confidence.updateProbability(p);
+    stream_matched_[idx] = 1;
+  }
+
+  return pc_vector.size();
 }
 
 
-void   BoxPositionActionHandler::computeBoundingBox(PcCloudPtrList& pc_vector,std::vector<Eigen::Vector3f>& dimension_list, std::vector<Eigen::Vector4f>& centroid_list, std::vector<std::vector<PcPoint> >& corners)
+void BoxPositionActionHandler::finishStreamedSweep()
 {
-  PcCloudPtr cloud_plane (new PcCloud ());
-  Eigen::Vector3f one_dimension;
+  // The whole revolution went past the clusters that were not matched
+  double weight = 1;
+  if (cluster_list.size() < 5)
+    weight = double(cluster_list.size())/15;
 
-  for (PcCloudPtrList::const_iterator iterator = pc_vector.begin(), end = pc_vector.end(); iterator != end; ++iterator)
+  for (int i_prev=0; i_prev < cluster_list.size(); i_prev++)
   {
-    cloud_plane=*iterator;
+    if (stream_matched_[i_prev])
+      continue;
+
+    double dist = computeDistance(cluster_list[i_prev].pose); //distance from origin
+    double p = 0.5 - weight*confidence_update_base_*exp(-confidence_update_lambda_*dist);
+
+    cluster_list[i_prev].confidence.updateProbability(p);
+  }
+
+  // Delete any entries below a threshold
+  int i=0;
+  while ( i < cluster_list.size() )
+  {
+      double p = cluster_list[i].confidence.getProbability();
+      if ( p < 0.3 || !std::isfinite(p) )
+      {
+          cluster_list.erase( cluster_list.begin() + i );
+      } else
+      {
+          i++;
+      }
+  }
+
+  if (stream_initializing_)
+    is_initiatializing_ = false;
+
+  stream_sweep_started_ = false;
+  frame_count_++;
+}
+
+
+static bool moreConfident(const PanelState& a, const PanelState& b)
+{
+  return a.confidence > b.confidence;
+}
+
+
+void BoxPositionActionHandler::publishSnapshot(const std::string& frame_id, const ros::Time& stamp)
+{
+  boost::shared_ptr<PanelSnapshot> snapshot (new PanelSnapshot);
+  snapshot->stamp = stamp;
+  snapshot->frame_id = frame_id;
+  snapshot->scan = scan_count_++;
+
+  for (int i=0; i < cluster_list.size(); i++)
+  {
+    const BoxCluster& b = cluster_list[i];
+
+    PanelState panel;
+    panel.pose = b.pose;
+    panel.confidence = cluster_list[i].confidence.getProbability();
+    panel.num_points = b.point_cloud->points.size();
+
+    if (b.footprint.valid)
+    {
+      panel.extents.x = b.footprint.width;
+      panel.extents.y = b.footprint.depth;
+      panel.extents.z = b.footprint.max_z - b.footprint.min_z;
+    }
 
-    // Compute principal directions
-    Eigen::Vector4f pcaCentroid;
-    pcl::compute3DCentroid(*cloud_plane, pcaCentroid);
+    snapshot->panels.push_back(panel);
+    snapshot->cloud += *b.point_cloud;
+  }
 
-    Eigen::Matrix3f covariance;
-    computeCovarianceMatrixNormalized(*cloud_plane, pcaCentroid, covariance);
-    Eigen::SelfAdjointEigenSolver<Eigen::Matrix3f> eigen_solver(covariance, Eigen::ComputeEigenvectors);
-    Eigen::Matrix3f eigenVectorsPCA = eigen_solver.eigenvectors();
-    eigenVectorsPCA.col(2) = eigenVectorsPCA.col(0).cross(eigenVectorsPCA.col(1));
+  std::stable_sort(snapshot->panels.begin(), snapshot->panels.end(), moreConfident);
 
-    // Transform the original cloud to the origin where the principal components correspond to the axes.
-    Eigen::Matrix4f projectionTransform(Eigen::Matrix4f::Identity());
-    projectionTransform.block<3,3>(0,0) = eigenVectorsPCA.transpose();
-    projectionTransform.block<3,1>(0,3) = -1.f * (projectionTransform.block<3,3>(0,0) * pcaCentroid.head<3>());
-    PcCloudPtr cloudPointsProjected (new PcCloud);
+  boost::atomic_store(&snapshot_, PanelSnapshotConstPtr(snapshot));
+}
 
 
+PanelSnapshotConstPtr BoxPositionActionHandler::getSnapshot() const
+{
+  return boost::atomic_load(&snapshot_);
+}
 
-    pcl::transformPointCloud(*cloud_plane, *cloudPointsProjected, projectionTransform);
 
-    // Get the minimum and maximum points of the transformed cloud.
-    PcPoint minPoint, maxPoint;
+void BoxPositionActionHandler::predictClusters()
+{
+  // Cluster poses are in the sensor frame. Use the planar motion of the robot
+  // since the last scan, assuming the velodyne sits above the odometry frame origin.
+  // Before the first odometry sample current_odom is a zero pose, not a position to move from.
+  if (!has_odom_)
+    return;
 
-    pcl::getMinMax3D(*cloudPointsProjected, minPoint, maxPoint);
+  geometry_msgs::Pose odom_pose = current_odom.pose.pose;
+  double yaw = pose_conversion::getYawFromQuaternion(odom_pose.orientation);
 
-    // save the centroid into the centroid vector
-    centroid_list.push_back(pcaCentroid);
-    // save dimenstion into dimension list
-    one_dimension[0] = maxPoint.x - minPoint.x;
-    one_dimension[1] = maxPoint.y - minPoint.y;
-    one_dimension[2] = maxPoint.z - minPoint.z;
-    dimension_list.push_back(one_dimension);
+  if (has_prev_odom_)
+  {
+    double prev_yaw = pose_conversion::getYawFromQuaternion(prev_odom_pose_.orientation);
+    double dyaw = yaw - prev_yaw;
+
+    // Robot displacement, expressed in the current robot frame
+    double dx_w = odom_pose.position.x - prev_odom_pose_.position.x;
+    double dy_w = odom_pose.position.y - prev_odom_pose_.position.y;
+    double dx =  cos(yaw)*dx_w + sin(yaw)*dy_w;
+    double dy = -sin(yaw)*dx_w + cos(yaw)*dy_w;
+
+    for (int i=0; i < cluster_list.size(); i++)
+    {
+      geometry_msgs::Point& p = cluster_list[i].pose.position;
+      double x =  cos(dyaw)*p.x + sin(dyaw)*p.y - dx;
+      double y = -sin(dyaw)*p.x + cos(dyaw)*p.y - dy;
+      p.x = x;
+      p.y = y;
+
+      geometry_msgs::Quaternion& q = cluster_list[i].pose.orientation;
+      q = pose_conversion::getQuaternionFromYaw(pose_conversion::getYawFromQuaternion(q) - dyaw);
+    }
+  }
 
+  prev_odom_pose_ = odom_pose;
+  has_prev_odom_ = true;
+}
 
-    // Transform back
-    Eigen::Matrix4f bboxTransform(Eigen::Matrix4f::Identity());
-    bboxTransform.block<3,3>(0,0) = eigenVectorsPCA;
 
-    PcCloudPtr cloud_corners_pca  (new PcCloud);
-    PcCloudPtr cloud_corners_base (new PcCloud);
+bool BoxPositionActionHandler::selectRoi(ScanFlagList& in_roi)
+{
+  in_roi.assign(cluster_list.size(), false);
 
-    cloud_corners_pca->points.push_back(minPoint);
-    cloud_corners_pca->points.push_back(maxPoint);
+  if (!roi_enabled_ || frame_count_ % roi_full_scan_interval_ == 0)
+    return false;
 
-    for (int i=0; i<cloud_corners_pca->points.size(); i++)
+  bool any = false;
+  for (int i=0; i < cluster_list.size(); i++)
+  {
+    if (cluster_list[i].confidence.getProbability() >= roi_min_confidence_)
     {
-      cloud_corners_pca->points[i].x -= projectionTransform(0,3);
-      cloud_corners_pca->points[i].y -= projectionTransform(1,3);
-      cloud_corners_pca->points[i].z -= projectionTransform(2,3);
+      in_roi[i] = true;
+      any = true;
     }
+  }
 
-    pcl::transformPointCloud(*cloud_corners_pca, *cloud_corners_base, bboxTransform);
+  return any;
+}
 
-    // Extract corners
-    std::vector<PcPoint> c;
-    for (int i=0; i<cloud_corners_base->points.size(); i++)
-      c.push_back(cloud_corners_base->points[i]);
 
-    // Save list of corners
-    corners.push_back(c);
+bool BoxPositionActionHandler::isTrackerSettled()
+{
+  // Candidates below the confirmation threshold still need scans to be confirmed or dropped
+  for (int i=0; i < cluster_list.size(); i++)
+  {
+    if (cluster_list[i].confidence.getProbability() < roi_min_confidence_)
+      return false;
   }
+
+  return !is_initiatializing_;
+}
+
+
+PcCloudPtr     BoxPositionActionHandler::filterCloudRoi(PcCloudPtr cloud_ptr, const ScanFlagList& in_roi)
+{
+  std::vector<geometry_msgs::Point, ArenaAllocator<geometry_msgs::Point> > centers((ArenaAllocator<geometry_msgs::Point>(scan_arena_)));
+  for (int i=0; i < cluster_list.size(); i++)
+  {
+    if (in_roi[i])
+      centers.push_back(cluster_list[i].pose.position);
+  }
+
+  bool has_intensity = (intensity_current_.size() == cloud_ptr->points.size());
+  roi_intensity_.clear();
+  double r2 = roi_radius_*roi_radius_;
+
+  // Keep the points within roi_radius_ (horizontally) of a tracked panel
+  PcCloudPtr cloud_roi = cloud_pool_.acquire();
+  for (int i=0; i < cloud_ptr->points.size(); i++)
+  {
+    const PcPoint& p = cloud_ptr->points[i];
+
+    for (int c=0; c < centers.size(); c++)
+    {
+      double dx = p.x - centers[c].x;
+      double dy = p.y - centers[c].y;
+      if (dx*dx + dy*dy > r2)
+        continue;
+
+      cloud_roi->points.push_back(p);
+      if (has_intensity)
+        roi_intensity_.push_back(intensity_current_[i]);
+      break;
+    }
+  }
+
+  // The intensity stays indexed like the cloud that is filtered next
+  intensity_current_.swap(roi_intensity_);
+
+  return cloud_roi;
+}
+
+
+double BoxPositionActionHandler::computeDistance(geometry_msgs::Pose p1)
+{
+  double x = p1.position.x, y = p1.position.y, z = p1.position.z;
+  return sqrt(x*x + y*y + z*z);
+}
+
+
+double BoxPositionActionHandler::computeDistance(geometry_msgs::Pose p1, geometry_msgs::Pose p2)
+{
+  double x = p1.position.x - p2.position.x;
+  double y = p1.position.y - p2.position.y;
+  double z = p1.position.z - p2.position.z;
+  return sqrt(x*x + y*y + z*z);
 }
 
 
 void   BoxPositionActionHandler::drawClusters(std::string frame_id)
 {
-  PcCloud final_cloud;
+  PanelSnapshotConstPtr snapshot = getSnapshot();
+  if (!snapshot)
+    return;
 
-  printf("\nCluster | Points | Distance |  Angle  | Confidence\n");
-  for (int i=0; i<cluster_list.size(); i++)
+  // Print the cluster table at most once per second
+  static LogRateLimiter table_limiter(1.0);
+  if (table_limiter.ready())
   {
-    BoxCluster b = cluster_list[i];
-    final_cloud += *b.point_cloud;
+    KURI_INFO("Cluster | Points | Distance |  Angle  | Confidence");
 
-    printf("  %3d     %4lu    \t%2.1f \t%4.1f \t%2.1f\n",
-           i,
-           b.point_cloud->points.size(),
-           computeDistance(b.pose),
-           RAD2DEG( atan2(-b.pose.position.y, b.pose.position.x) ),
-           b.confidence.getProbability()*100);
+    for (int i=0; i<snapshot->panels.size(); i++)
+    {
+      const PanelState& b = snapshot->panels[i];
+
+      KURI_INFO("  %3d     %4d    \t%2.1f \t%4.1f \t%2.1f",
+                i,
+                b.num_points,
+                computeDistance(b.pose),
+                RAD2DEG( atan2(-b.pose.position.y, b.pose.position.x) ),
+                b.confidence*100);
+    }
   }
 
-  //Publish message
+  // Hand the points to the visualization thread, sharing them with the snapshot
+  if (!cluster_view_->wanted())
+    return;
 
-  sensor_msgs::PointCloud2 cloud_cluster_msg;
-  pcl::toROSMsg(final_cloud, cloud_cluster_msg);
-  cloud_cluster_msg.header.frame_id = frame_id;
-  cloud_cluster_msg.header.stamp = ros::Time::now();
-  pub_wall.publish(cloud_cluster_msg);
+  CloudView view;
+  view.cloud = boost::shared_ptr<const PcCloud>(snapshot, &snapshot->cloud);
+  view.frame_id = frame_id;
+  view.stamp = ros::Time::now();
+  cluster_view_->post(view);
 }
 
 
-void   BoxPositionActionHandler::drawPoints(std::vector<geometry_msgs::Point> points, std::string frame_id)
+void   BoxPositionActionHandler::publishClusterView(const CloudView& view)
 {
-  // Publish
-  visualization_msgs::Marker marker_msg;
-  marker_msg.header.frame_id = frame_id;
-  marker_msg.header.stamp = ros::Time::now();
-  marker_msg.type = marker_msg.POINTS;
+  pub_wall.publish(*view.cloud, view.frame_id, view.stamp);
+}
 
-  marker_msg.scale.x = 0.05;
-  marker_msg.scale.y = 0.05;
-  marker_msg.color.a = 1.0;
-  marker_msg.color.g = 1.0;
 
-  marker_msg.points = points;
+void   BoxPositionActionHandler::drawPoints(std::vector<geometry_msgs::Point> points, std::string frame_id)
+{
+  if (!points_view_->wanted())
+    return;
 
-  pub_points.publish(marker_msg);
+  PointsView view;
+  view.points.swap(points);
+  view.frame_id = frame_id;
+  view.stamp = ros::Time::now();
+  points_view_->post(view);
 }
 
 
-PcCloudPtrList BoxPositionActionHandler::extractBoxClusters(PcCloudPtr cloud_ptr)
+PcCloudPtrList BoxPositionActionHandler::extractBoxClusters(PcCloudPtr cloud_ptr, std::vector<OrientedRect>& footprints)
 {
   PcCloudPtrList pc_vector;
+  footprints.clear();
 
   if (cloud_ptr->points.size() == 0)
     return pc_vector;
@@ -450,18 +1210,30 @@ PcCloudPtrList BoxPositionActionHandler::extractBoxClusters(PcCloudPtr cloud_ptr
   // Get clusters
   pc_vector = getCloudClusters(cloud_ptr);
 
-  // Get size of each cluster
-  std::vector<Eigen::Vector3f> dimension_list;
-  std::vector<Eigen::Vector4f> centroid_list;
-  std::vector<std::vector<PcPoint> > corners_list;
-  computeBoundingBox(pc_vector, dimension_list, centroid_list, corners_list);
+  return filterBoxSize(pc_vector, footprints);
+}
+
 
-  // Only keep the clusters that are likely to be panels
+PcCloudPtrList BoxPositionActionHandler::filterBoxSize(PcCloudPtrList& pc_vector, std::vector<OrientedRect>& footprints)
+{
+  // Minimum area rectangle of the footprint rather than PCA, which is unstable
+  // for the few points of an L-shaped return from a panel corner. The fit of
+  // each kept cluster is returned alongside it, for the pose and the snapshot.
   PcCloudPtrList pc_vector_clustered;
-  for (int i = 0; i< dimension_list.size(); i++)
+  footprints.clear();
+
+  for (int i = 0; i< pc_vector.size(); i++)
   {
-    if (dimension_list[i][2] <= 1.5 && dimension_list[i][1] <= 1.5)
-      pc_vector_clustered.push_back(pc_vector[i]);
+    OrientedRect rect;
+    rect_fitter_.fit(*pc_vector[i], rect);
+
+    // Only keep the clusters that are likely to be panels. A cluster without a
+    // footprint has no extent to reject it on.
+    if (rect.valid && (rect.width > 1.5 || rect.max_z - rect.min_z > 1.5))
+      continue;
+
+    pc_vector_clustered.push_back(pc_vector[i]);
+    footprints.push_back(rect);
   }
 
   return pc_vector_clustered;
@@ -479,31 +1251,60 @@ PcCloudPtr     BoxPositionActionHandler::filterCloudRangeAngle(PcCloudPtr cloud_
   if (a_max >= M_PI && a_min <= -M_PI)
     check_angle = false;
 
+  // Label the ground so that heights are measured from the local ground. A scan decoded
+  // from packets is binned already, unless the region of interest filtered it since.
+  if (decoded_ring_scan_ && cloud_ptr == pc_current_)
+  {
+    ground_segmenter_.segmentSwap(*decoded_ring_scan_);
+    decoded_ring_scan_ = NULL;
+  }
+  else
+    ground_segmenter_.segment(*cloud_ptr);
+  const RingScan& scan = ground_segmenter_.scan();
+  const std::vector<uint8_t>& ground = ground_segmenter_.groundMask();
+  const std::vector<float>& heights = ground_segmenter_.heights();
+
+  // Intensity of the kept points, if the input cloud has it
+  bool has_intensity = (intensity_current_.size() == cloud_ptr->points.size());
+  filtered_intensity_.clear();
+
+  // Points in known static voxels are dropped
+  bool drop_background = has_sensor_to_map_ && background_map_.isReady();
+  Eigen::Affine3f to_map = sensor_to_map_;
+  background_dropped_ = 0;
+
   // Filter out points that are too close or too far, or out of range
-  PcCloudPtr cloud_filtered (new PcCloud);
+  PcCloudPtr cloud_filtered = cloud_pool_.acquire();
+  cloud_filtered->points.reserve(scan.size() - ground_segmenter_.groundCount());
 
-  for (int i=0; i < cloud_ptr->points.size(); i++)
+  for (int i=0; i < scan.size(); i++)
   {
-    PcPoint p = cloud_ptr->points[i];
-
-    // Ignore points high above velodyne or on the floor
-    if (p.z > 1.8 || p.z < 0.5)
+    // Ignore the ground and points high above it
+    if (ground[i] || heights[i] > max_height_ || heights[i] < min_height_)
     {
       continue;
     }
 
-    double r = p.x*p.x + p.y*p.y;
+    double r = scan.range[i]*scan.range[i];
     if (r > laser_max_range || r < laser_min_range)
       continue;
 
     if (check_angle)
     {
-      double angle = atan2(p.y, p.x);
+      double angle = atan2(scan.y[i], scan.x[i]);
       if (angle > laser_max_angle || angle < laser_min_angle)
         continue;
     }
 
-    cloud_filtered->points.push_back (p);
+    if (drop_background && background_map_.isStatic(to_map*Eigen::Vector3f(scan.x[i], scan.y[i], scan.z[i])))
+    {
+      background_dropped_++;
+      continue;
+    }
+
+    cloud_filtered->points.push_back (cloud_ptr->points[ scan.index[i] ]);
+    if (has_intensity)
+      filtered_intensity_.push_back (intensity_current_[ scan.index[i] ]);
   }
 
   return cloud_filtered;
@@ -512,27 +1313,49 @@ PcCloudPtr     BoxPositionActionHandler::filterCloudRangeAngle(PcCloudPtr cloud_
 
 PcCloudPtrList BoxPositionActionHandler::getCloudClusters(PcCloudPtr cloud_ptr)
 {
-   PcCloudPtrList pc_vector;
+  std::vector<pcl::PointIndices>& cluster_indices = cluster_indices_;
 
-  // Creating the KdTree object for the search method of the extraction
-  pcl::search::KdTree<PcPoint>::Ptr tree (new pcl::search::KdTree<PcPoint>);
-  tree->setInputCloud (cloud_ptr);
+  if (use_incremental_clustering_)
+  {
+    // Only the voxels that changed since the last full scan are relinked
+    Eigen::Affine3f to_frame = sensor_to_cluster_frame_;
+    incremental_clusterer_.update(*cloud_ptr, to_frame, cluster_indices);
+  }
+  else
+  {
+    // The KdTree object for the search method of the extraction is kept between scans
+    cluster_tree_->setInputCloud (cloud_ptr);
+
+    pcl::EuclideanClusterExtraction<PcPoint> ec;
+    ec.setClusterTolerance (1.5); // up to 150cm btw points - big since we're sure the panel is far from other obstacles
+    ec.setMinClusterSize (3);     // at least 3 points
+    ec.setMaxClusterSize (5000);
+    ec.setSearchMethod (cluster_tree_);
+    ec.setInputCloud (cloud_ptr);
+    ec.extract (cluster_indices);
+  }
+
+  return getClusterClouds(*cloud_ptr, cluster_indices, filtered_intensity_);
+}
 
-  std::vector<pcl::PointIndices> cluster_indices;
-  pcl::EuclideanClusterExtraction<PcPoint> ec;
-  ec.setClusterTolerance (1.5); // up to 150cm btw points - big since we're sure the panel is far from other obstacles
-  ec.setMinClusterSize (3);     // at least 3 points
-  ec.setMaxClusterSize (5000);
-  ec.setSearchMethod (tree);
-  ec.setInputCloud (cloud_ptr);
-  ec.extract (cluster_indices);
+
+PcCloudPtrList BoxPositionActionHandler::getClusterClouds(const PcCloud& cloud, const std::vector<pcl::PointIndices>& cluster_indices, const std::vector<float>& intensity)
+{
+  PcCloudPtrList pc_vector;
 
   // Get the cloud representing each cluster
   for (std::vector<pcl::PointIndices>::const_iterator it = cluster_indices.begin (); it != cluster_indices.end (); ++it)
   {
-    PcCloudPtr cloud_cluster (new PcCloud);
+    // Reject clusters that cannot be a panel before copying them
+    ClusterFeatures features;
+    feature_extractor_.compute(cloud, it->indices, intensity, features);
+    if (!cluster_classifier_.accept(features))
+      continue;
+
+    PcCloudPtr cloud_cluster = cloud_pool_.acquire();
+    cloud_cluster->points.reserve (it->indices.size ());
     for (std::vector<int>::const_iterator pit = it->indices.begin (); pit != it->indices.end (); ++pit)
-      cloud_cluster->points.push_back (cloud_ptr->points[*pit]);
+      cloud_cluster->points.push_back (cloud.points[*pit]);
 
     cloud_cluster->width = cloud_cluster->points.size ();
     cloud_cluster->height = 1;
@@ -551,28 +1374,19 @@ void BoxPositionActionHandler::getInitialBoxClusters()
   // Initialize
   // >>>>>>>>>
   cluster_list.clear();
-
-  if (range_max_ == 0 && range_max_ == 0)
-  {
-    range_max_ = 60.0;
-    range_min_ = 1.0;
-  }
-
-  if (angle_max_ == 0 && angle_min_ == 0)
-  {
-    angle_max_ = M_PI;
-    angle_min_ = -M_PI;
-  }
+  setDefaultLimits();
 
   PcCloudPtr cloud_filtered = filterCloudRangeAngle(pc_current_, range_min_, range_max_, angle_min_, angle_max_);
 
-  PcCloudPtrList pc_vector = extractBoxClusters(cloud_filtered);
-  std::vector<geometry_msgs::Pose> poses = getPanelPose(pc_vector);
+  std::vector<OrientedRect> footprints;
+  PcCloudPtrList pc_vector = extractBoxClusters(cloud_filtered, footprints);
+  std::vector<geometry_msgs::Pose> poses = getPanelPose(pc_vector, footprints);
 
   for (int i=0; i<pc_vector.size(); i++)
   {
     BoxCluster b;
     b.point_cloud = pc_vector[i];
+    b.footprint = footprints[i];
     b.pose = poses[i];
     b.confidence.setProbability(0.5);
 
@@ -584,11 +1398,27 @@ void BoxPositionActionHandler::getInitialBoxClusters()
 }
 
 
-std::vector<geometry_msgs::Pose> BoxPositionActionHandler::getPanelPose(PcCloudPtrList clusters)
+void BoxPositionActionHandler::setDefaultLimits()
+{
+  if (range_max_ == 0 && range_max_ == 0)
+  {
+    range_max_ = 60.0;
+    range_min_ = 1.0;
+  }
+
+  if (angle_max_ == 0 && angle_min_ == 0)
+  {
+    angle_max_ = M_PI;
+    angle_min_ = -M_PI;
+  }
+}
+
+
+std::vector<geometry_msgs::Pose> BoxPositionActionHandler::getPanelPose(const PcCloudPtrList& clusters, const std::vector<OrientedRect>& footprints)
 {
   std::vector<geometry_msgs::Pose> poses;
 
-  // Compute centroid of each box
+  // Center and yaw of the footprint of each box, height of its centroid
   for (int ic=0; ic<clusters.size(); ic++)
   {
     PcCloudPtr pc = clusters[ic];
@@ -607,6 +1437,15 @@ std::vector<geometry_msgs::Pose> BoxPositionActionHandler::getPanelPose(PcCloudP
     p.position.x /= pc_size;
     p.position.y /= pc_size;
     p.position.z /= pc_size;
+    p.orientation.w = 1;
+
+    const OrientedRect& rect = footprints[ic];
+    if (rect.valid)
+    {
+      p.position.x = rect.center_x;
+      p.position.y = rect.center_y;
+      p.orientation = pose_conversion::getQuaternionFromYaw(rect.yaw);
+    }
 
     poses.push_back(p);
   }
@@ -616,6 +1455,53 @@ std::vector<geometry_msgs::Pose> BoxPositionActionHandler::getPanelPose(PcCloudP
 }
 
 
+bool BoxPositionActionHandler::lookupSensorTransform(const std::string& frame_out, const std::string& sensor_frame, Eigen::Transform<float, 3, Eigen::Affine, Eigen::DontAlign>& transform)
+{
+  tf::StampedTransform tf_transform;
+  try
+  {
+    tf_listener->lookupTransform(frame_out, sensor_frame, ros::Time(0), tf_transform);
+  }
+  catch (tf::TransformException ex)
+  {
+    KURI_WARN_THROTTLE(1.0, "%s", ex.what());
+    return false;
+  }
+
+  transform.matrix() = pose_conversion::convertStampedTransform2Matrix4d(tf_transform).cast<float>();
+  return true;
+}
+
+
+void BoxPositionActionHandler::learnBackground(PcCloudPtr cloud_ptr)
+{
+  Eigen::Affine3f to_map = sensor_to_map_;
+  background_map_.learnScan(*cloud_ptr, to_map);
+
+  if (background_map_.learnedScans() < background_map_.scansToLearn())
+    return;
+
+  // Keep the panel candidates seen so far out of the background
+  std::vector<Eigen::Vector3f> candidates;
+  for (int i=0; i < cluster_list.size(); i++)
+  {
+    const geometry_msgs::Point& p = cluster_list[i].pose.position;
+    candidates.push_back(to_map*Eigen::Vector3f(p.x, p.y, p.z));
+  }
+
+  background_map_.finishLearning(candidates);
+  KURI_INFO("Background map: %lu static voxels learned over %d scans", background_map_.size(), background_map_.learnedScans());
+
+  if (background_map_.saveLearned() && !background_map_.getFile().empty())
+  {
+    if (background_map_.save(background_map_.getFile()))
+      KURI_INFO("Background map saved to %s", background_map_.getFile().c_str());
+    else
+      KURI_WARN("Could not save the background map to %s", background_map_.getFile().c_str());
+  }
+}
+
+
 void BoxPositionActionHandler::transformToFrame(PcCloudPtr cloud_in, PcCloudPtr& cloud_out, std::string frame_in, std::string frame_out)
 {
   // Transform to the more stable odom frame
@@ -666,10 +1552,32 @@ int main(int argc, char **argv)
     arena_bounds.push_back(c);
   }
 
+  GroundSegmentationParams ground_params;
+  GroundSegmenter::loadParams(node_handle, "ground_segmentation/", ground_params);
+
+  double min_height, max_height;
+  node_handle.param("panel_information/min_height", min_height, 0.5);
+  node_handle.param("panel_information/max_height", max_height, 1.8);
+
   // Action server
   BoxPositionActionHandler *action_handler;
   std::string actionlib_topic = "get_box_cluster";
   action_handler = new BoxPositionActionHandler(actionlib_topic, arena_bounds);
+  action_handler->setGroundSegmentation(ground_params, min_height, max_height);
+  action_handler->setClusterClassifier(node_handle, "cluster_classifier/");
+  action_handler->setRoiMode(node_handle, "roi_mode/");
+  action_handler->setScanArena(node_handle, "scan_arena/");
+  action_handler->setCloudCompression(node_handle, "cloud_compression/");
+  action_handler->setBackgroundMap(node_handle, "background_map/");
+  action_handler->setIncrementalClustering(node_handle, "incremental_clustering/");
+  action_handler->setMotionGating(node_handle, "motion_gating/");
+  action_handler->setPipeline(node_handle, "pipeline/");
+  action_handler->setPacketDecoding(node_handle, "velodyne_packets/");
+  action_handler->setSectorStreaming(node_handle, "sector_streaming/");
+
+  double visualization_rate;
+  node_handle.param("visualization_rate", visualization_rate, 10.0);
+  action_handler->setVisualizationRate(visualization_rate);
 
   std::cout << "Waiting for messages on the \"" << actionlib_topic << "\" actionlib topic\n";
 
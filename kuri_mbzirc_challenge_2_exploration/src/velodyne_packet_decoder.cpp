@@ -0,0 +1,168 @@
+#include <algorithm>
+#include <cmath>
+
+#include <kuri_mbzirc_challenge_2_exploration/velodyne_packet_decoder.h>
+
+// VLP-16 packet layout: 12 blocks of a flag, an azimuth and 32 channels
+// (two firing sequences of the 16 lasers), then a timestamp and two factory bytes
+static const int BLOCKS_PER_PACKET = 12;
+static const int BLOCK_SIZE = 100;
+static const int LASERS = 16;
+static const int FIRINGS_PER_BLOCK = 2;
+static const uint16_t BLOCK_FLAG = 0xeeff;
+
+static const int AZIMUTH_STEPS = 36000;           // 0.01 degree
+static const float DISTANCE_RESOLUTION = 0.002f;  // m
+
+// Laser firing times, used to interpolate the azimuth of each return within a block
+static const double FIRING_PERIOD = 55.296e-6;    // s, between firing sequences
+static const double LASER_PERIOD = 2.304e-6;      // s, between lasers of a sequence
+
+// Elevation of each laser id, degrees
+static const double VLP16_ELEVATION[LASERS] = {-15, 1, -13, 3, -11, 5, -9, 7, -7, 9, -5, 11, -3, 13, -1, 15};
+
+
+VelodynePacketDecoder::VelodynePacketDecoder():
+  enabled_(false),
+  topic_("/velodyne_packets"),
+  min_range_(0.4),
+  max_range_(130.0),
+  num_sectors_(GroundSegmentationParams().num_sectors)
+{
+  computeTables();
+}
+
+
+void VelodynePacketDecoder::loadParams(ros::NodeHandle& nh, const std::string& ns)
+{
+  nh.param(ns + "enabled", enabled_, enabled_);
+  nh.param(ns + "topic", topic_, topic_);
+  nh.param(ns + "min_range", min_range_, min_range_);
+  nh.param(ns + "max_range", max_range_, max_range_);
+}
+
+
+void VelodynePacketDecoder::setNumSectors(int num_sectors)
+{
+  if (num_sectors == num_sectors_)
+    return;
+
+  num_sectors_ = num_sectors;
+  computeTables();
+}
+
+
+void VelodynePacketDecoder::computeTables()
+{
+  cos_azimuth_.resize(AZIMUTH_STEPS);
+  sin_azimuth_.resize(AZIMUTH_STEPS);
+  sector_.resize(AZIMUTH_STEPS);
+
+  double sector_scale = num_sectors_/(2*M_PI);
+
+  for (int a=0; a < AZIMUTH_STEPS; a++)
+  {
+    double azimuth = a*(2*M_PI/AZIMUTH_STEPS);
+    cos_azimuth_[a] = std::cos(azimuth);
+    sin_azimuth_[a] = std::sin(azimuth);
+
+    // Same binning as GroundSegmenter::toRingScan. The azimuth turns clockwise, so the point is at -azimuth.
+    int sector = (int) ((std::atan2(-sin_azimuth_[a], cos_azimuth_[a]) + M_PI)*sector_scale);
+    if (sector >= num_sectors_)
+      sector = 0;
+    sector_[a] = sector;
+  }
+
+  cos_elevation_.resize(LASERS);
+  sin_elevation_.resize(LASERS);
+  ring_.resize(LASERS);
+
+  for (int l=0; l < LASERS; l++)
+  {
+    double elevation = VLP16_ELEVATION[l]*M_PI/180;
+    cos_elevation_[l] = std::cos(elevation);
+    sin_elevation_[l] = std::sin(elevation);
+
+    // Ring 0 is the lowest laser, as in the RingScan
+    ring_[l] = (VLP16_ELEVATION[l] + 15)/2;
+  }
+}
+
+
+size_t VelodynePacketDecoder::decode(const velodyne_msgs::VelodyneScan& msg, pcl::PointCloud<pcl::PointXYZ>& cloud, std::vector<float>& intensity, RingScan& scan)
+{
+  size_t max_points = msg.packets.size()*BLOCKS_PER_PACKET*FIRINGS_PER_BLOCK*LASERS;
+
+  cloud.points.clear();
+  cloud.points.reserve(max_points);
+  intensity.clear();
+  intensity.reserve(max_points);
+  scan.clear();
+  scan.reserve(max_points);
+
+  float min_range = min_range_;
+  float max_range = max_range_;
+  int azimuth_gap = 0;
+
+  for (size_t p=0; p < msg.packets.size(); p++)
+  {
+    const uint8_t* data = &msg.packets[p].data[0];
+
+    for (int b=0; b < BLOCKS_PER_PACKET; b++)
+    {
+      const uint8_t* block = data + b*BLOCK_SIZE;
+      if ((block[0] | (block[1] << 8)) != BLOCK_FLAG)
+        continue;
+
+      int azimuth = block[2] | (block[3] << 8);
+
+      // The azimuth step to the next block spreads the returns of this one. The last
+      // block of a packet reuses the previous step.
+      if (b + 1 < BLOCKS_PER_PACKET)
+      {
+        const uint8_t* next = block + BLOCK_SIZE;
+        int gap = ((next[2] | (next[3] << 8)) - azimuth + AZIMUTH_STEPS) % AZIMUTH_STEPS;
+
+        // A large step means a missing block, keep the last good one
+        if (gap < 100)
+          azimuth_gap = gap;
+      }
+
+      const uint8_t* channel = block + 4;
+      for (int f=0; f < FIRINGS_PER_BLOCK; f++)
+      {
+        for (int l=0; l < LASERS; l++, channel += 3)
+        {
+          int raw = channel[0] | (channel[1] << 8);
+          if (raw == 0)
+            continue;
+
+          float distance = raw*DISTANCE_RESOLUTION;
+          if (distance < min_range || distance > max_range)
+            continue;
+
+          int a = azimuth + (int) (azimuth_gap*(l*LASER_PERIOD + f*FIRING_PERIOD)/(FIRINGS_PER_BLOCK*FIRING_PERIOD));
+          if (a >= AZIMUTH_STEPS)
+            a -= AZIMUTH_STEPS;
+
+          // velodyne_pointcloud axes: x forward, y left, z up
+          float xy = distance*cos_elevation_[l];
+          float x =  xy*cos_azimuth_[a];
+          float y = -xy*sin_azimuth_[a];
+          float z = distance*sin_elevation_[l];
+
+          scan.push_back(x, y, z, xy, ring_[l], sector_[a], cloud.points.size());
+          cloud.points.push_back(pcl::PointXYZ(x, y, z));
+          intensity.push_back(channel[2]);
+        }
+      }
+    }
+  }
+
+  cloud.header.frame_id = msg.header.frame_id;
+  cloud.width = cloud.points.size();
+  cloud.height = 1;
+  cloud.is_dense = true;
+
+  return cloud.points.size();
+}
@@ -0,0 +1,201 @@
+#ifndef KURI_MBZIRC_CHALLENGE_2_PANEL_DETECTION_LIDAR_ODOMETRY_H_
+#define KURI_MBZIRC_CHALLENGE_2_PANEL_DETECTION_LIDAR_ODOMETRY_H_
+
+#include <vector>
+#include <stdint.h>
+
+#include <boost/unordered_map.hpp>
+#include <boost/unordered_set.hpp>
+#include <Eigen/Dense>
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+typedef pcl::PointXYZ PcPoint;
+typedef pcl::PointCloud<PcPoint> PcCloud;
+
+
+struct LidarOdometryParams
+{
+  double scan_leaf_size;          // Downsampling of the incoming scan (m)
+  double min_range;               // Drop returns from the robot itself (m)
+  double max_range;               // (m)
+
+  double voxel_size;              // Map voxel size (m)
+  int    max_points_per_voxel;    // Stop updating a voxel after this many points
+  int    min_points_per_voxel;    // Voxels with fewer points are not used for matching
+  double max_plane_ratio;         // Smallest over middle covariance eigenvalue for a voxel to count as planar
+  double map_radius;              // Voxels further than this from the sensor are dropped (m)
+
+  int    max_iterations;
+  double max_correspondence_distance;  // Point-to-plane distance gate (m)
+  double reassociate_distance;    // Redo data association after this much translation (m)
+  double reassociate_angle;       // ... or rotation (rad)
+  double convergence_epsilon;     // Stop when the update is smaller than this
+  double min_inlier_ratio;        // Below this the registration is rejected and the prediction kept
+  double huber_delta;             // Robust kernel width (m)
+
+  LidarOdometryParams():
+    scan_leaf_size(0.2),
+    min_range(1.0),
+    max_range(60.0),
+    voxel_size(0.5),
+    max_points_per_voxel(20),
+    min_points_per_voxel(5),
+    max_plane_ratio(0.3),
+    map_radius(40.0),
+    max_iterations(20),
+    max_correspondence_distance(0.5),
+    reassociate_distance(0.05),
+    reassociate_angle(0.01),
+    convergence_epsilon(1e-4),
+    min_inlier_ratio(0.2),
+    huber_delta(0.1)
+  { }
+};
+
+
+struct LidarOdometryStats
+{
+  int    scan_points;       // After downsampling
+  int    iterations;
+  int    associations;      // Number of times correspondences were recomputed
+  int    correspondences;
+  size_t map_voxels;
+  double inlier_ratio;
+  bool   accepted;
+
+  LidarOdometryStats():
+    scan_points(0), iterations(0), associations(0), correspondences(0),
+    map_voxels(0), inlier_ratio(0), accepted(false)
+  { }
+};
+
+
+struct MapVoxel
+{
+  int n;
+  Eigen::Vector3d sum;
+  Eigen::Matrix3d sum_sq;
+
+  // Derived from the sums after each update
+  Eigen::Vector3d mean;
+  Eigen::Vector3d normal;
+  bool planar;
+
+  MapVoxel():
+    n(0),
+    sum(Eigen::Vector3d::Zero()),
+    sum_sq(Eigen::Matrix3d::Zero()),
+    mean(Eigen::Vector3d::Zero()),
+    normal(Eigen::Vector3d::UnitZ()),
+    planar(false)
+  { }
+};
+
+
+/**
+ * Local map of point statistics indexed by a 64-bit voxel key. Each voxel
+ * keeps the first and second moments of its points, so its plane (mean and
+ * normal) is updated in constant time per inserted point and matching needs
+ * no KD-tree.
+ */
+class VoxelHashMap
+{
+public:
+  VoxelHashMap();
+
+  void setParams(const LidarOdometryParams& params);
+
+  // Points in the map frame
+  void insert(const std::vector<Eigen::Vector3d>& points);
+
+  // Safe to call concurrently as long as no insert/prune is running
+  const MapVoxel* find(const Eigen::Vector3d& p) const;
+
+  // Planar voxel around p whose plane is closest to it, NULL if none within a voxel size
+  const MapVoxel* findPlane(const Eigen::Vector3d& p) const;
+
+  void prune(const Eigen::Vector3d& center, double radius);
+  void clear() { voxels_.clear(); }
+  size_t size() const { return voxels_.size(); }
+
+protected:
+  typedef boost::unordered_map<uint64_t, MapVoxel> VoxelMap;
+
+  VoxelMap voxels_;
+  double voxel_size_;
+  int    max_points_;
+  int    min_points_;
+  double max_plane_ratio_;
+  std::vector<uint64_t> touched_;
+
+  uint64_t key(const Eigen::Vector3d& p) const;
+  void updatePlane(MapVoxel& v);
+};
+
+
+/**
+ * Scan-to-map lidar odometry.
+ *
+ * Each downsampled scan is registered against the VoxelHashMap with
+ * point-to-plane Gauss-Newton. Correspondences (the closest voxel plane around
+ * each point) are computed once and reused across iterations until the pose
+ * estimate has moved by more than reassociate_distance/reassociate_angle. The
+ * normal equations are accumulated in parallel with OpenMP. The registered
+ * scan is then merged into the map, and the map is cropped around the sensor.
+ */
+class LidarOdometry
+{
+public:
+  LidarOdometry();
+
+  void setParams(const LidarOdometryParams& params);
+  const LidarOdometryParams& getParams() { return params_; }
+
+  // Register a scan given in the sensor frame. Returns false if the registration was rejected.
+  bool processScan(const PcCloud& scan);
+
+  void reset();
+
+  // Pose of the sensor in the odometry frame
+  const Eigen::Matrix3d& getRotation()    { return R_; }
+  const Eigen::Vector3d& getTranslation() { return t_; }
+
+  // Motion of the last scan, in the sensor frame of the previous scan
+  const Eigen::Matrix3d& getDeltaRotation()    { return dR_; }
+  const Eigen::Vector3d& getDeltaTranslation() { return dt_; }
+
+  const LidarOdometryStats& getStats() { return stats_; }
+
+protected:
+  struct Correspondence
+  {
+    int index;                // Into scan_
+    Eigen::Vector3d mean;     // Plane point
+    Eigen::Vector3d normal;
+  };
+
+  LidarOdometryParams params_;
+  LidarOdometryStats  stats_;
+  VoxelHashMap map_;
+
+  bool initialized_;
+  int  frames_;
+  Eigen::Matrix3d R_, dR_;
+  Eigen::Vector3d t_, dt_;
+
+  // Reused buffers
+  std::vector<Eigen::Vector3d> scan_;
+  std::vector<Eigen::Vector3d> transformed_;
+  std::vector<Correspondence> correspondences_;
+  std::vector<char> valid_;
+  boost::unordered_set<uint64_t> occupied_leaves_;
+
+  void downsample(const PcCloud& scan);
+  void associate(const Eigen::Matrix3d& R, const Eigen::Vector3d& t);
+  double buildSystem(const Eigen::Matrix3d& R, const Eigen::Vector3d& t,
+                     Eigen::Matrix<double, 6, 6>& H, Eigen::Matrix<double, 6, 1>& g);
+};
+
+#endif
@@ -28,6 +28,12 @@
 
 #include <actionlib/server/simple_action_server.h>
 #include <kuri_mbzirc_challenge_2_msgs/PanelPositionAction.h>
+#include <kuri_mbzirc_challenge_2_tools/async_logger.h>
+#include <kuri_mbzirc_challenge_2_tools/min_area_rect.h>
+#include <kuri_mbzirc_challenge_2_tools/motion_gated_scheduler.h>
+#include <kuri_mbzirc_challenge_2_tools/stats_reporter.h>
+#include <kuri_mbzirc_challenge_2_tools/visualization_sink.h>
+#include <kuri_mbzirc_challenge_2_tools/visualization_views.h>
 
 #include <unistd.h>
 
@@ -40,6 +46,10 @@ typedef kuri_mbzirc_challenge_2_msgs::PanelPositionFeedback PanelPositionFeedbac
 typedef kuri_mbzirc_challenge_2_msgs::PanelPositionResult PanelPositionResult;
 typedef kuri_mbzirc_challenge_2_msgs::PanelPositionGoalConstPtr PanelPositionGoalConstPtr;
 
+// Only one scan per heartbeat while the robot stands still
+MotionGatedScheduler scheduler;
+StatsReporter* stats;
+
 
 class PanelPositionActionHandler
 {
@@ -68,6 +78,9 @@ public:
   {
     is_node_enabled = true;
 
+    // A new goal always gets the next scan
+    scheduler.wake();
+
     ros::Rate r(30);
     while (1)
     {
@@ -127,6 +140,7 @@ void callbackScan(const sensor_msgs::LaserScan::ConstPtr& scan_msg);
 void callbackOdom(const nav_msgs::Odometry::ConstPtr& odom_msg);
 
 
+
 // =====
 // Variables
 // =====
@@ -137,6 +151,12 @@ ros::Publisher  pub_points;
 ros::Publisher  pub_poses;
 tf::TransformListener *tf_listener;
 
+// Builds and publishes the RViz topics off the scan callback
+VisualizationSink* vis_sink;
+boost::shared_ptr<VisualizationChannel<ClustersView> > clusters_view;
+boost::shared_ptr<VisualizationChannel<PointsView> > points_view;
+boost::shared_ptr<VisualizationChannel<geometry_msgs::PoseArray> > poses_view;
+
 PanelPositionActionHandler *action_handler;
 bool bypass_action_handler = false;
 std::string actionlib_topic = "get_panel_cluster";
@@ -146,6 +166,10 @@ int main(int argc, char **argv)
 {
   ros::init(argc, argv, "circumnavigation_waypoints");
   ros::NodeHandle node;
+  ros::NodeHandle node_private("~");
+
+  scheduler.loadParams(node_private, "motion_gating/");
+  stats = new StatsReporter("panel_detection/circumnavigation_waypoints");
 
   // Topic handlers
   sub_scan  = node.subscribe("/scan", 1, callbackScan);
@@ -157,6 +181,11 @@ int main(int argc, char **argv)
   pub_points= node.advertise<visualization_msgs::Marker>("/explore/points", 10);
   pub_poses = node.advertise<geometry_msgs::PoseArray>("/explore/poses", 10);
 
+  vis_sink = new VisualizationSink(10.0);
+  clusters_view = vis_sink->addChannel<ClustersView>(boost::bind(&ros::Publisher::getNumSubscribers, &pub_wall), boost::bind(publishClustersView, boost::cref(pub_wall), _1));
+  points_view   = vis_sink->addChannel<PointsView>(boost::bind(&ros::Publisher::getNumSubscribers, &pub_points), boost::bind(publishPointsView, boost::cref(pub_points), _1));
+  poses_view    = vis_sink->addChannel<geometry_msgs::PoseArray>(boost::bind(&ros::Publisher::getNumSubscribers, &pub_poses), boost::bind(publishPosesView, boost::cref(pub_poses), _1));
+
   tf_listener = new tf::TransformListener();
 
   // Parse input
@@ -172,6 +201,9 @@ int main(int argc, char **argv)
   }
 
   ros::spin();
+
+  delete vis_sink;
+  delete stats;
   return 0;
 }
 
@@ -232,10 +264,26 @@ geometry_msgs::PoseArray computeSimpleWaypoints(pcl::PointCloud<pcl::PointXYZ>::
 
   double box_size = size/2;
 
-  // Find center of bounds (rough)
-  pcl::getMinMax3D(*cloud, minPoint, maxPoint);
-  center.x = (minPoint.x + maxPoint.x)/2;
-  center.y = (minPoint.y + maxPoint.y)/2;
+  // Center and orientation of the panel footprint, so the grid lines up with its faces
+  static MinAreaRectFitter rect_fitter;
+  OrientedRect rect;
+  double yaw_panel = 0;
+
+  if (rect_fitter.fit(*cloud, rect))
+  {
+    center.x = rect.center_x;
+    center.y = rect.center_y;
+    yaw_panel = rect.yaw;
+  }
+  else
+  {
+    // Find center of bounds (rough)
+    pcl::getMinMax3D(*cloud, minPoint, maxPoint);
+    center.x = (minPoint.x + maxPoint.x)/2;
+    center.y = (minPoint.y + maxPoint.y)/2;
+  }
+
+  double c = cos(yaw_panel), s = sin(yaw_panel);
 
 
   // Make sure we generate waypoints in clockwise order in 3x3 grid
@@ -256,11 +304,15 @@ geometry_msgs::PoseArray computeSimpleWaypoints(pcl::PointCloud<pcl::PointXYZ>::
     int i = ij_pairs[m];
     int j = ij_pairs[m+1];
 
+    // Grid axes along and across the long side of the panel
+    double dx = box_size*(i*c - j*s);
+    double dy = box_size*(i*s + j*c);
+
     geometry_msgs::Pose p;
-    p.position.x = center.x + box_size*i;
-    p.position.y = center.y + box_size*j;
+    p.position.x = center.x + dx;
+    p.position.y = center.y + dy;
 
-    double yaw = atan2(-j,-i);
+    double yaw = atan2(-dy,-dx);
     p.orientation = getQuaternionFromYaw(yaw);
 
     temp_poses.push_back(p);
@@ -295,6 +347,9 @@ geometry_msgs::PoseArray computeSimpleWaypoints(pcl::PointCloud<pcl::PointXYZ>::
 
 void callbackOdom(const nav_msgs::Odometry::ConstPtr& odom_msg)
 {
+  const geometry_msgs::Twist& t = odom_msg->twist.twist;
+  scheduler.updateTwist(sqrt(t.linear.x*t.linear.x + t.linear.y*t.linear.y), t.angular.z);
+
   if (!action_handler->is_node_enabled && !bypass_action_handler)
     return;
 
@@ -306,6 +361,14 @@ void callbackScan(const sensor_msgs::LaserScan::ConstPtr& scan_msg)
   if (!action_handler->is_node_enabled && !bypass_action_handler)
     return;
 
+  bool process = scheduler.shouldProcess();
+  stats->set("skipped_scans", scheduler.numSkipped());
+  stats->set("motion_gated", scheduler.isGated());
+  stats->publishIfDue();
+
+  if (!process)
+    return;
+
   // Convert scan message to cloud message
   sensor_msgs::PointCloud2 cloud_msg;
   laser_geometry::LaserProjection projector_;
@@ -338,7 +401,7 @@ void callbackScan(const sensor_msgs::LaserScan::ConstPtr& scan_msg)
 
   if (cloud_filtered->points.size() == 0)
   {
-    std::cout << "No laser points detected nearby.\n";
+    KURI_WARN_THROTTLE(1.0, "No laser points detected nearby.");
     action_handler->setFailure();
     return;
   }
@@ -366,27 +429,24 @@ void callbackScan(const sensor_msgs::LaserScan::ConstPtr& scan_msg)
 
   if (pc_vector_clustered.size() == 0)
   {
-    std::cout << "Could not find panel cluster.\n";
+    KURI_WARN_THROTTLE(1.0, "Could not find panel cluster.");
     action_handler->setFailure();
     return;
   }
 
   if (pc_vector_clustered.size() > 1)
   {
-    std::cout << "Found multiple panel clusters. Using the first one.\n";
+    KURI_INFO_THROTTLE(1.0, "Found multiple panel clusters. Using the first one.");
   }
 
   // Publish cluster clouds
-  for (int i=0; i<pc_vector_clustered.size(); i++)
+  if (clusters_view->wanted())
   {
-    sensor_msgs::PointCloud2 cloud_cluster_msg;
-    pcl::toROSMsg(*pc_vector_clustered[i], cloud_cluster_msg);
-    cloud_cluster_msg.header.frame_id = scan_msg->header.frame_id;
-    cloud_cluster_msg.header.stamp = ros::Time::now();
-    pub_wall.publish(cloud_cluster_msg);
-
-    if (pc_vector_clustered.size() > 1)
-      usleep(100*1000);
+    ClustersView view;
+    view.clusters = pc_vector_clustered;
+    view.frame_id = scan_msg->header.frame_id;
+    view.stamp = ros::Time::now();
+    clusters_view->post(view);
   }
 
   pcl::PointCloud<pcl::PointXYZ>::Ptr cluster_cloud = pc_vector_clustered[0];
@@ -412,7 +472,8 @@ void callbackScan(const sensor_msgs::LaserScan::ConstPtr& scan_msg)
 
     // Publish waypoints
     waypoints.header.frame_id = "/odom";
-    pub_poses.publish(waypoints);
+    if (poses_view->wanted())
+      poses_view->post(waypoints);
 
     action_handler->setSuccess(waypoints);
   }
@@ -498,20 +559,14 @@ void computeBoundingBox(std::vector<pcl::PointCloud<pcl::PointXYZ>::Ptr>& pc_vec
 
 void drawPoints(std::vector<geometry_msgs::Point> points, std::string frame_id)
 {
-  // Publish
-  visualization_msgs::Marker marker_msg;
-  marker_msg.header.frame_id = frame_id;
-  marker_msg.header.stamp = ros::Time::now();
-  marker_msg.type = marker_msg.POINTS;
-
-  marker_msg.scale.x = 0.05;
-  marker_msg.scale.y = 0.05;
-  marker_msg.color.a = 1.0;
-  marker_msg.color.g = 1.0;
-
-  marker_msg.points = points;
+  if (!points_view->wanted())
+    return;
 
-  pub_points.publish(marker_msg);
+  PointsView view;
+  view.points.swap(points);
+  view.frame_id = frame_id;
+  view.stamp = ros::Time::now();
+  points_view->post(view);
 }
 
 std::vector<double> generateRange(double start, double end, double step)
@@ -0,0 +1,411 @@
+#include <cmath>
+
+#include <Eigen/Geometry>
+
+#include <kuri_mbzirc_challenge_2_panel_detection/lidar_odometry.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// 21 bits per axis, centered so that negative coordinates are valid
+static inline uint64_t packVoxelKey(int64_t x, int64_t y, int64_t z)
+{
+  const int64_t offset = 1 << 20;
+  const uint64_t mask = (1 << 21) - 1;
+  return (uint64_t(x + offset) & mask)
+      | ((uint64_t(y + offset) & mask) << 21)
+      | ((uint64_t(z + offset) & mask) << 42);
+}
+
+// Rotation from a rotation vector
+static inline Eigen::Matrix3d expSO3(const Eigen::Vector3d& w)
+{
+  double angle = w.norm();
+  if (angle < 1e-12)
+    return Eigen::Matrix3d::Identity();
+
+  return Eigen::AngleAxisd(angle, w/angle).toRotationMatrix();
+}
+
+static inline double rotationAngle(const Eigen::Matrix3d& R)
+{
+  double c = 0.5*(R.trace() - 1);
+  return std::acos(std::max(-1.0, std::min(1.0, c)));
+}
+
+
+
+/* ===========================
+ * VoxelHashMap
+ * ===========================
+ */
+VoxelHashMap::VoxelHashMap()
+{
+  setParams(LidarOdometryParams());
+}
+
+void VoxelHashMap::setParams(const LidarOdometryParams& params)
+{
+  voxel_size_ = params.voxel_size;
+  max_points_ = params.max_points_per_voxel;
+  min_points_ = params.min_points_per_voxel;
+  max_plane_ratio_ = params.max_plane_ratio;
+}
+
+uint64_t VoxelHashMap::key(const Eigen::Vector3d& p) const
+{
+  return packVoxelKey((int64_t) std::floor(p[0]/voxel_size_),
+                      (int64_t) std::floor(p[1]/voxel_size_),
+                      (int64_t) std::floor(p[2]/voxel_size_));
+}
+
+void VoxelHashMap::insert(const std::vector<Eigen::Vector3d>& points)
+{
+  touched_.clear();
+
+  for (size_t i=0; i < points.size(); i++)
+  {
+    uint64_t k = key(points[i]);
+    MapVoxel& v = voxels_[k];
+
+    if (v.n >= max_points_)
+      continue;
+
+    // Refit when the voxel becomes usable, when it is full, and every few points in between
+    if (v.n == 0 || v.n+1 == min_points_ || v.n+1 == max_points_ || (v.n % 4) == 3)
+      touched_.push_back(k);
+
+    v.n++;
+    v.sum += points[i];
+    v.sum_sq += points[i]*points[i].transpose();
+  }
+
+  // Refresh the planes of the voxels that changed noticeably
+  for (size_t i=0; i < touched_.size(); i++)
+    updatePlane(voxels_[ touched_[i] ]);
+}
+
+void VoxelHashMap::updatePlane(MapVoxel& v)
+{
+  v.mean = v.sum/v.n;
+
+  if (v.n < min_points_)
+  {
+    v.planar = false;
+    return;
+  }
+
+  Eigen::Matrix3d cov = v.sum_sq/v.n - v.mean*v.mean.transpose();
+  Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> solver(cov);
+
+  // Eigenvalues in increasing order
+  const Eigen::Vector3d& ev = solver.eigenvalues();
+  v.normal = solver.eigenvectors().col(0);
+  v.planar = (ev[1] > 0) && (ev[0] < max_plane_ratio_*ev[1]);
+}
+
+const MapVoxel* VoxelHashMap::find(const Eigen::Vector3d& p) const
+{
+  VoxelMap::const_iterator it = voxels_.find(key(p));
+  if (it == voxels_.end())
+    return NULL;
+
+  return &it->second;
+}
+
+const MapVoxel* VoxelHashMap::findPlane(const Eigen::Vector3d& p) const
+{
+  // The 2x2x2 block of voxels closest to p, so that surfaces lying near a
+  // voxel boundary are still found when p falls on the other side of it
+  int64_t base[3], step[3];
+  for (int a=0; a < 3; a++)
+  {
+    double f = p[a]/voxel_size_;
+    base[a] = (int64_t) std::floor(f);
+    step[a] = (f - base[a] < 0.5) ? -1 : 1;
+  }
+
+  const MapVoxel* best = NULL;
+  double best_distance = voxel_size_;
+
+  for (int i=0; i < 8; i++)
+  {
+    VoxelMap::const_iterator it = voxels_.find(packVoxelKey(base[0] + ((i & 1) ? step[0] : 0),
+                                                            base[1] + ((i & 2) ? step[1] : 0),
+                                                            base[2] + ((i & 4) ? step[2] : 0)));
+    if (it == voxels_.end() || !it->second.planar)
+      continue;
+
+    const MapVoxel& v = it->second;
+    if ((p - v.mean).squaredNorm() > voxel_size_*voxel_size_)
+      continue;
+
+    double d = std::fabs(v.normal.dot(p - v.mean));
+    if (d < best_distance)
+    {
+      best_distance = d;
+      best = &v;
+    }
+  }
+
+  return best;
+}
+
+void VoxelHashMap::prune(const Eigen::Vector3d& center, double radius)
+{
+  double r2 = radius*radius;
+
+  VoxelMap::iterator it = voxels_.begin();
+  while (it != voxels_.end())
+  {
+    if ((it->second.mean - center).squaredNorm() > r2)
+      it = voxels_.erase(it);
+    else
+      ++it;
+  }
+}
+
+
+
+/* ===========================
+ * LidarOdometry
+ * ===========================
+ */
+LidarOdometry::LidarOdometry()
+{
+  setParams(LidarOdometryParams());
+  reset();
+}
+
+void LidarOdometry::setParams(const LidarOdometryParams& params)
+{
+  params_ = params;
+  map_.setParams(params);
+}
+
+void LidarOdometry::reset()
+{
+  initialized_ = false;
+  frames_ = 0;
+  R_.setIdentity();
+  dR_.setIdentity();
+  t_.setZero();
+  dt_.setZero();
+  map_.clear();
+}
+
+void LidarOdometry::downsample(const PcCloud& scan)
+{
+  // Keep the first point in each leaf
+  occupied_leaves_.clear();
+  scan_.clear();
+
+  double min_r2 = params_.min_range*params_.min_range;
+  double max_r2 = params_.max_range*params_.max_range;
+  double leaf = params_.scan_leaf_size;
+
+  for (size_t i=0; i < scan.points.size(); i++)
+  {
+    const PcPoint& p = scan.points[i];
+    if (!pcl_isfinite(p.x) || !pcl_isfinite(p.y) || !pcl_isfinite(p.z))
+      continue;
+
+    double r2 = p.x*p.x + p.y*p.y + p.z*p.z;
+    if (r2 < min_r2 || r2 > max_r2)
+      continue;
+
+    uint64_t k = packVoxelKey((int64_t) std::floor(p.x/leaf),
+                              (int64_t) std::floor(p.y/leaf),
+                              (int64_t) std::floor(p.z/leaf));
+
+    if (occupied_leaves_.insert(k).second)
+      scan_.push_back(Eigen::Vector3d(p.x, p.y, p.z));
+  }
+}
+
+void LidarOdometry::associate(const Eigen::Matrix3d& R, const Eigen::Vector3d& t)
+{
+  int n = scan_.size();
+  correspondences_.resize(n);
+  valid_.assign(n, 0);
+
+  #pragma omp parallel for schedule(static)
+  for (int i=0; i < n; i++)
+  {
+    Eigen::Vector3d q = R*scan_[i] + t;
+    const MapVoxel* v = map_.findPlane(q);
+    if (v == NULL)
+      continue;
+
+    if (std::fabs(v->normal.dot(q - v->mean)) > params_.max_correspondence_distance)
+      continue;
+
+    correspondences_[i].index = i;
+    correspondences_[i].mean = v->mean;
+    correspondences_[i].normal = v->normal;
+    valid_[i] = 1;
+  }
+
+  // Compact
+  size_t count = 0;
+  for (int i=0; i < n; i++)
+  {
+    if (valid_[i])
+      correspondences_[count++] = correspondences_[i];
+  }
+  correspondences_.resize(count);
+
+  stats_.associations++;
+}
+
+double LidarOdometry::buildSystem(const Eigen::Matrix3d& R, const Eigen::Vector3d& t,
+                                  Eigen::Matrix<double, 6, 6>& H, Eigen::Matrix<double, 6, 1>& g)
+{
+  H.setZero();
+  g.setZero();
+  double cost = 0;
+
+  int n = correspondences_.size();
+  double delta = params_.huber_delta;
+
+  #pragma omp parallel
+  {
+    Eigen::Matrix<double, 6, 6> H_local = Eigen::Matrix<double, 6, 6>::Zero();
+    Eigen::Matrix<double, 6, 1> g_local = Eigen::Matrix<double, 6, 1>::Zero();
+    double cost_local = 0;
+
+    #pragma omp for schedule(static) nowait
+    for (int i=0; i < n; i++)
+    {
+      const Correspondence& c = correspondences_[i];
+      Eigen::Vector3d q = R*scan_[c.index] + t;
+      double r = c.normal.dot(q - c.mean);
+
+      // Left perturbation: dq = -[q]x w + v
+      Eigen::Matrix<double, 6, 1> J;
+      J.head<3>() = q.cross(c.normal);
+      J.tail<3>() = c.normal;
+
+      // Huber weight
+      double abs_r = std::fabs(r);
+      double w = (abs_r <= delta) ? 1.0 : delta/abs_r;
+
+      H_local += w*J*J.transpose();
+      g_local += w*r*J;
+      cost_local += (abs_r <= delta) ? 0.5*r*r : delta*(abs_r - 0.5*delta);
+    }
+
+    #pragma omp critical
+    {
+      H += H_local;
+      g += g_local;
+      cost += cost_local;
+    }
+  }
+
+  return cost;
+}
+
+bool LidarOdometry::processScan(const PcCloud& scan)
+{
+  stats_ = LidarOdometryStats();
+  frames_++;
+
+  downsample(scan);
+  stats_.scan_points = scan_.size();
+
+  if (scan_.empty())
+    return false;
+
+  transformed_.resize(scan_.size());
+
+  // The first scan starts the map
+  if (!initialized_)
+  {
+    for (size_t i=0; i < scan_.size(); i++)
+      transformed_[i] = R_*scan_[i] + t_;
+
+    map_.insert(transformed_);
+    initialized_ = true;
+    stats_.accepted = true;
+    stats_.map_voxels = map_.size();
+    return true;
+  }
+
+  // Constant velocity prediction
+  Eigen::Matrix3d R = R_*dR_;
+  Eigen::Vector3d t = R_*dt_ + t_;
+  Eigen::Matrix3d R_pred = R;
+  Eigen::Vector3d t_pred = t;
+
+  Eigen::Matrix3d R_assoc = R;
+  Eigen::Vector3d t_assoc = t;
+  associate(R, t);
+
+  Eigen::Matrix<double, 6, 6> H;
+  Eigen::Matrix<double, 6, 1> g;
+
+  for (int iter=0; iter < params_.max_iterations; iter++)
+  {
+    stats_.iterations++;
+
+    if (correspondences_.size() < 6)
+      break;
+
+    buildSystem(R, t, H, g);
+    Eigen::Matrix<double, 6, 1> dx = H.ldlt().solve(-g);
+
+    Eigen::Matrix3d dR = expSO3(dx.head<3>());
+    R = dR*R;
+    t = dR*t + dx.tail<3>();
+
+    if (dx.norm() < params_.convergence_epsilon)
+      break;
+
+    // Reuse the correspondences until the pose has moved noticeably
+    if ((t - t_assoc).norm() > params_.reassociate_distance
+        || rotationAngle(R_assoc.transpose()*R) > params_.reassociate_angle)
+    {
+      R_assoc = R;
+      t_assoc = t;
+      associate(R, t);
+    }
+  }
+
+  // Re-orthonormalize
+  Eigen::Quaterniond q(R);
+  q.normalize();
+  R = q.toRotationMatrix();
+
+  stats_.correspondences = correspondences_.size();
+  stats_.inlier_ratio = double(correspondences_.size())/scan_.size();
+  stats_.accepted = (stats_.inlier_ratio >= params_.min_inlier_ratio);
+
+  if (!stats_.accepted)
+  {
+    // Keep the prediction, but do not pollute the map with a bad scan
+    R = R_pred;
+    t = t_pred;
+  }
+
+  // Update the motion model and pose
+  dR_ = R_.transpose()*R;
+  dt_ = R_.transpose()*(t - t_);
+  R_ = R;
+  t_ = t;
+
+  if (stats_.accepted)
+  {
+    for (size_t i=0; i < scan_.size(); i++)
+      transformed_[i] = R_*scan_[i] + t_;
+
+    map_.insert(transformed_);
+
+    if (frames_ % 10 == 0)
+      map_.prune(t_, params_.map_radius);
+  }
+
+  stats_.map_voxels = map_.size();
+  return stats_.accepted;
+}
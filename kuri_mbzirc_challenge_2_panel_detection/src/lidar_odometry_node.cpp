@@ -0,0 +1,149 @@
+#include <Eigen/Geometry>
+
+#include <ros/ros.h>
+#include <sensor_msgs/PointCloud2.h>
+#include <nav_msgs/Odometry.h>
+#include <pcl_conversions/pcl_conversions.h>
+#include <tf/transform_broadcaster.h>
+
+#include <kuri_mbzirc_challenge_2_panel_detection/lidar_odometry.h>
+#include <kuri_mbzirc_challenge_2_tools/async_logger.h>
+#include <kuri_mbzirc_challenge_2_tools/stats_reporter.h>
+
+
+// Registration
+LidarOdometry odometry_;
+PcCloud cloud_;
+
+// Publishing
+ros::Publisher pub_odom;
+tf::TransformBroadcaster* broadcaster;
+std::string odom_frame_;
+std::string child_frame_;
+bool publish_tf_;
+
+StatsReporter* stats;
+ros::Time last_stamp_;
+
+
+void callbackVelo(const sensor_msgs::PointCloud2::ConstPtr& cloud_msg)
+{
+  ros::WallTime start = ros::WallTime::now();
+
+  // Scans from a rosbag played in a loop
+  if (!last_stamp_.isZero() && cloud_msg->header.stamp < last_stamp_)
+  {
+    KURI_WARN("Time went backwards, resetting lidar odometry");
+    odometry_.reset();
+  }
+
+  double dt = last_stamp_.isZero() ? 0 : (cloud_msg->header.stamp - last_stamp_).toSec();
+  last_stamp_ = cloud_msg->header.stamp;
+
+  pcl::fromROSMsg (*cloud_msg, cloud_);
+
+  if (!odometry_.processScan(cloud_))
+    KURI_WARN_THROTTLE(1.0, "Scan registration rejected (inlier ratio %.2f), using constant velocity prediction",
+                       odometry_.getStats().inlier_ratio);
+
+
+  // Pose and velocity of the sensor
+  Eigen::Quaterniond q(odometry_.getRotation());
+  const Eigen::Vector3d& t = odometry_.getTranslation();
+
+  nav_msgs::Odometry odom;
+  odom.header.stamp = cloud_msg->header.stamp;
+  odom.header.frame_id = odom_frame_;
+  odom.child_frame_id = child_frame_;
+
+  odom.pose.pose.position.x = t[0];
+  odom.pose.pose.position.y = t[1];
+  odom.pose.pose.position.z = t[2];
+  odom.pose.pose.orientation.x = q.x();
+  odom.pose.pose.orientation.y = q.y();
+  odom.pose.pose.orientation.z = q.z();
+  odom.pose.pose.orientation.w = q.w();
+
+  if (dt > 0)
+  {
+    const Eigen::Vector3d& dt_sensor = odometry_.getDeltaTranslation();
+    Eigen::AngleAxisd dr(odometry_.getDeltaRotation());
+
+    odom.twist.twist.linear.x = dt_sensor[0]/dt;
+    odom.twist.twist.linear.y = dt_sensor[1]/dt;
+    odom.twist.twist.linear.z = dt_sensor[2]/dt;
+    odom.twist.twist.angular.x = dr.axis()[0]*dr.angle()/dt;
+    odom.twist.twist.angular.y = dr.axis()[1]*dr.angle()/dt;
+    odom.twist.twist.angular.z = dr.axis()[2]*dr.angle()/dt;
+  }
+
+  pub_odom.publish(odom);
+
+  if (publish_tf_)
+  {
+    tf::Transform transform;
+    transform.setOrigin( tf::Vector3(t[0], t[1], t[2]) );
+    transform.setRotation( tf::Quaternion(q.x(), q.y(), q.z(), q.w()) );
+    broadcaster->sendTransform(tf::StampedTransform(transform, cloud_msg->header.stamp, odom_frame_, child_frame_));
+  }
+
+
+  // Statistics
+  const LidarOdometryStats& s = odometry_.getStats();
+  stats->set("latency_ms", (ros::WallTime::now() - start).toSec()*1000);
+  stats->set("scan_points", s.scan_points);
+  stats->set("iterations", s.iterations);
+  stats->set("associations", s.associations);
+  stats->set("inlier_ratio", s.inlier_ratio);
+  stats->set("map_voxels", s.map_voxels);
+  if (!s.accepted)
+    stats->increment("rejected_scans");
+  stats->publishIfDue();
+
+  KURI_DEBUG("Lidar odometry: %d iterations, %d associations, inlier ratio %.2f",
+             s.iterations, s.associations, s.inlier_ratio);
+}
+
+
+
+int main (int argc, char **argv)
+{
+  ros::init(argc, argv, "lidar_odometry");
+  ros::NodeHandle node;
+  ros::NodeHandle node_private("~");
+
+  LidarOdometryParams params;
+  node_private.param("scan_leaf_size", params.scan_leaf_size, params.scan_leaf_size);
+  node_private.param("min_range", params.min_range, params.min_range);
+  node_private.param("max_range", params.max_range, params.max_range);
+  node_private.param("voxel_size", params.voxel_size, params.voxel_size);
+  node_private.param("max_points_per_voxel", params.max_points_per_voxel, params.max_points_per_voxel);
+  node_private.param("min_points_per_voxel", params.min_points_per_voxel, params.min_points_per_voxel);
+  node_private.param("max_plane_ratio", params.max_plane_ratio, params.max_plane_ratio);
+  node_private.param("map_radius", params.map_radius, params.map_radius);
+  node_private.param("max_iterations", params.max_iterations, params.max_iterations);
+  node_private.param("max_correspondence_distance", params.max_correspondence_distance, params.max_correspondence_distance);
+  node_private.param("reassociate_distance", params.reassociate_distance, params.reassociate_distance);
+  node_private.param("reassociate_angle", params.reassociate_angle, params.reassociate_angle);
+  node_private.param("convergence_epsilon", params.convergence_epsilon, params.convergence_epsilon);
+  node_private.param("min_inlier_ratio", params.min_inlier_ratio, params.min_inlier_ratio);
+  node_private.param("huber_delta", params.huber_delta, params.huber_delta);
+  odometry_.setParams(params);
+
+  node_private.param<std::string>("odom_frame", odom_frame_, "odom");
+  node_private.param<std::string>("child_frame", child_frame_, "velodyne");
+  // Off by default, the robot description already gives the velodyne frame a parent
+  node_private.param("publish_tf", publish_tf_, false);
+
+  std::string cloud_topic;
+  node_private.param<std::string>("cloud_topic", cloud_topic, "/velodyne_points");
+
+  broadcaster = new tf::TransformBroadcaster();
+  stats = new StatsReporter("panel_detection/lidar_odometry");
+
+  pub_odom = node.advertise<nav_msgs::Odometry>("/lidar_odom", 10);
+  ros::Subscriber sub_velo = node.subscribe(cloud_topic, 1, callbackVelo);
+
+  ros::spin();
+  return 0;
+}
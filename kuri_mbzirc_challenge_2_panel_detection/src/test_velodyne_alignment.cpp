@@ -3,7 +3,6 @@
 #include <pcl/point_types.h>
 #include <pcl/point_cloud.h>
 #include <pcl/common/time.h>
-#include <pcl/filters/voxel_grid.h>
 #include <pcl/filters/filter.h>
 #include <pcl/filters/passthrough.h>
 #include <pcl/registration/icp.h>
@@ -17,6 +16,7 @@
 #include <tf/transform_listener.h>
 
 #include <kuri_mbzirc_challenge_2_tools/pose_conversion.h>
+#include <kuri_mbzirc_challenge_2_tools/voxel_downsampler.h>
 
 
 
@@ -83,16 +83,13 @@ void pairAlign (const PointCloud::Ptr cloud_src, const PointCloud::Ptr cloud_tgt
   // \note enable this for large datasets
   PointCloud::Ptr src (new PointCloud);
   PointCloud::Ptr tgt (new PointCloud);
-  pcl::VoxelGrid<PointT> grid;
+  static VoxelDownsampler grid;
   if (downsample)
   {
     double leaf = 0.2;
-    grid.setLeafSize (leaf, leaf, leaf);
-    grid.setInputCloud (cloud_src);
-    grid.filter (*src);
-
-    grid.setInputCloud (cloud_tgt);
-    grid.filter (*tgt);
+    grid.setLeafSize (leaf);
+    grid.filter (*cloud_src, *src);
+    grid.filter (*cloud_tgt, *tgt);
   }
   else
   {
@@ -0,0 +1,124 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+#include <pcl/common/time.h>
+#include <pcl/filters/voxel_grid.h>
+#include <pcl/io/pcd_io.h>
+
+#include <kuri_mbzirc_challenge_2_tools/voxel_downsampler.h>
+
+// Benchmark of VoxelDownsampler against pcl::VoxelGrid.
+//
+// Usage: test_voxel_downsample [cloud.pcd] [repetitions]
+// Without a file, a synthetic scan of an arena with a few walls is used.
+
+typedef pcl::PointXYZ PointT;
+typedef pcl::PointCloud<PointT> PointCloud;
+
+
+void makeSyntheticScan(PointCloud& cloud)
+{
+  srand(1);
+
+  // Ground out to 60 m, and walls around a 100 x 60 m arena
+  for (int i=0; i < 120000; i++)
+  {
+    double r = 60.0*rand()/RAND_MAX;
+    double a = 2*M_PI*rand()/RAND_MAX;
+    cloud.points.push_back(PointT(r*cos(a), r*sin(a), 0.02*rand()/RAND_MAX));
+  }
+
+  for (int i=0; i < 40000; i++)
+  {
+    double t = (double) rand()/RAND_MAX;
+    double z = 3.0*rand()/RAND_MAX;
+
+    switch (i % 4)
+    {
+      case 0: cloud.points.push_back(PointT(-50 + 100*t, -30, z)); break;
+      case 1: cloud.points.push_back(PointT(-50 + 100*t,  30, z)); break;
+      case 2: cloud.points.push_back(PointT(-50, -30 + 60*t, z)); break;
+      case 3: cloud.points.push_back(PointT( 50, -30 + 60*t, z)); break;
+    }
+  }
+
+  cloud.width = cloud.points.size();
+  cloud.height = 1;
+  cloud.is_dense = true;
+}
+
+
+int main (int argc, char **argv)
+{
+  PointCloud::Ptr cloud (new PointCloud);
+  int repetitions = 20;
+
+  if (argc > 1)
+  {
+    if (pcl::io::loadPCDFile<PointT>(argv[1], *cloud) < 0)
+    {
+      printf("Could not read %s\n", argv[1]);
+      return 1;
+    }
+  }
+  else
+    makeSyntheticScan(*cloud);
+
+  if (argc > 2)
+    repetitions = std::max(1, atoi(argv[2]));
+
+  printf("%lu points, %d repetitions\n", cloud->points.size(), repetitions);
+  printf("  leaf (m) |  VoxelGrid (ms) pts  | centroid (ms) pts  | first (ms) pts\n");
+
+  // 1 cm is the panel_searching leaf, 0.2 m the alignment one
+  const double leaves[] = {0.01, 0.05, 0.1, 0.2, 0.5};
+  const int num_leaves = sizeof(leaves)/sizeof(leaves[0]);
+
+  PointCloud out_grid, out_centroid, out_first;
+  pcl::VoxelGrid<PointT> grid;
+  VoxelDownsampler centroid, first;
+  first.setMode(VoxelDownsampler::FIRST_POINT);
+
+  for (int l=0; l < num_leaves; l++)
+  {
+    double leaf = leaves[l];
+    grid.setLeafSize(leaf, leaf, leaf);
+    grid.setInputCloud(cloud);
+    centroid.setLeafSize(leaf);
+    first.setLeafSize(leaf);
+
+    // Warm up, so that all the buffers are allocated
+    grid.filter(out_grid);
+    centroid.filter(*cloud, out_centroid);
+    first.filter(*cloud, out_first);
+
+    pcl::StopWatch watch;
+    for (int r=0; r < repetitions; r++)
+      grid.filter(out_grid);
+    double t_grid = watch.getTime()/repetitions;
+
+    watch.reset();
+    for (int r=0; r < repetitions; r++)
+      centroid.filter(*cloud, out_centroid);
+    double t_centroid = watch.getTime()/repetitions;
+
+    watch.reset();
+    for (int r=0; r < repetitions; r++)
+      first.filter(*cloud, out_first);
+    double t_first = watch.getTime()/repetitions;
+
+    printf("  %8.2f | %8.2f %9lu | %8.2f %9lu | %8.2f %9lu\n",
+           leaf,
+           t_grid, out_grid.points.size(),
+           t_centroid, out_centroid.points.size(),
+           t_first, out_first.points.size());
+  }
+
+  return 0;
+}
@@ -0,0 +1,57 @@
+#ifndef KURI_MBZIRC_CHALLENGE_2_TOOLS_ALLOCATION_COUNTER_H_
+#define KURI_MBZIRC_CHALLENGE_2_TOOLS_ALLOCATION_COUNTER_H_
+
+#include <cstddef>
+#include <cstdlib>
+
+/**
+ * Counts the heap allocations (malloc, calloc, realloc, and new through them)
+ * made by the calling thread, to measure how many a callback does.
+ *
+ * Only active when built with KURI_COUNT_ALLOCATIONS (glibc only), otherwise
+ * count() is always 0. Exactly one source file of the executable must define
+ * KURI_ALLOCATION_COUNTER_IMPLEMENTATION before including this header.
+ */
+namespace allocation_counter
+{
+#ifdef KURI_COUNT_ALLOCATIONS
+  extern __thread unsigned long thread_count;
+
+  inline bool enabled()          { return true; }
+  inline unsigned long count()   { return thread_count; }
+#else
+  inline bool enabled()          { return false; }
+  inline unsigned long count()   { return 0; }
+#endif
+}
+
+
+#if defined(KURI_COUNT_ALLOCATIONS) && defined(KURI_ALLOCATION_COUNTER_IMPLEMENTATION)
+
+extern "C" void* __libc_malloc(size_t size);
+extern "C" void* __libc_calloc(size_t n, size_t size);
+extern "C" void* __libc_realloc(void* p, size_t size);
+
+__thread unsigned long allocation_counter::thread_count = 0;
+
+extern "C" void* malloc(size_t size) throw()
+{
+  allocation_counter::thread_count++;
+  return __libc_malloc(size);
+}
+
+extern "C" void* calloc(size_t n, size_t size) throw()
+{
+  allocation_counter::thread_count++;
+  return __libc_calloc(n, size);
+}
+
+extern "C" void* realloc(void* p, size_t size) throw()
+{
+  allocation_counter::thread_count++;
+  return __libc_realloc(p, size);
+}
+
+#endif
+
+#endif
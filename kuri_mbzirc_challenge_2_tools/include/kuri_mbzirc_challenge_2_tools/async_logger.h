@@ -0,0 +1,268 @@
+#ifndef KURI_MBZIRC_CHALLENGE_2_TOOLS_ASYNC_LOGGER_H_
+#define KURI_MBZIRC_CHALLENGE_2_TOOLS_ASYNC_LOGGER_H_
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <boost/atomic.hpp>
+#include <boost/thread/thread.hpp>
+
+/**
+ * Asynchronous console logging for the perception callbacks.
+ *
+ * Messages are formatted straight into a slot of a bounded lock-free ring
+ * (multi-producer, single-consumer) and written to the console by a
+ * background thread, so a callback never waits on terminal I/O. When the
+ * ring is full the message is dropped and counted instead of blocking.
+ *
+ * Debug messages are removed at compile time unless KURI_LOG_LEVEL is set to
+ * KURI_LOG_LEVEL_DEBUG before including this file (or with -DKURI_LOG_LEVEL=0).
+ * The *_THROTTLE variants rate limit each call site independently.
+ */
+
+#define KURI_LOG_LEVEL_DEBUG 0
+#define KURI_LOG_LEVEL_INFO  1
+#define KURI_LOG_LEVEL_WARN  2
+#define KURI_LOG_LEVEL_ERROR 3
+#define KURI_LOG_LEVEL_NONE  4
+
+#ifndef KURI_LOG_LEVEL
+#define KURI_LOG_LEVEL KURI_LOG_LEVEL_INFO
+#endif
+
+
+static inline double kuriLogMonotonicTime()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+
+// Allows one message per period; one instance lives at each throttled call site
+class LogRateLimiter
+{
+protected:
+  double period_;
+  boost::atomic<double> last_;
+
+public:
+  LogRateLimiter(double period):
+    period_(period),
+    last_(-1e9)
+  { }
+
+  bool ready()
+  {
+    double now  = kuriLogMonotonicTime();
+    double last = last_.load(boost::memory_order_relaxed);
+    if (now - last < period_)
+      return false;
+
+    // Only one thread wins the slot if several hit the same call site
+    return last_.compare_exchange_strong(last, now, boost::memory_order_relaxed);
+  }
+};
+
+
+class AsyncLogger
+{
+public:
+  static const size_t RING_SIZE    = 1024;  // Must be a power of two
+  static const size_t MESSAGE_SIZE = 256;
+
+  static AsyncLogger& instance()
+  {
+    static AsyncLogger logger;
+    return logger;
+  }
+
+  void log(int level, const char* fmt, ...)
+  {
+    size_t pos = enqueue_pos_.load(boost::memory_order_relaxed);
+    Slot* slot;
+
+    // Claim a slot (Vyukov bounded queue)
+    for (;;)
+    {
+      slot = &ring_[pos & (RING_SIZE-1)];
+      size_t seq = slot->sequence.load(boost::memory_order_acquire);
+      intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+      if (diff == 0)
+      {
+        if (enqueue_pos_.compare_exchange_weak(pos, pos+1, boost::memory_order_relaxed))
+          break;
+      }
+      else if (diff < 0)
+      {
+        // Ring full, the writer is behind
+        dropped_.fetch_add(1, boost::memory_order_relaxed);
+        return;
+      }
+      else
+      {
+        pos = enqueue_pos_.load(boost::memory_order_relaxed);
+      }
+    }
+
+    slot->level = level;
+
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(slot->text, MESSAGE_SIZE, fmt, args);
+    va_end(args);
+
+    slot->sequence.store(pos+1, boost::memory_order_release);
+  }
+
+  uint64_t dropped()
+  {
+    return dropped_.load(boost::memory_order_relaxed);
+  }
+
+  ~AsyncLogger()
+  {
+    running_ = false;
+    writer_.join();
+  }
+
+protected:
+  struct Slot
+  {
+    boost::atomic<size_t> sequence;
+    int level;
+    char text[MESSAGE_SIZE];
+  };
+
+  Slot ring_[RING_SIZE];
+  boost::atomic<size_t> enqueue_pos_;
+  size_t dequeue_pos_;
+  boost::atomic<uint64_t> dropped_;
+  boost::atomic<bool> running_;
+  boost::thread writer_;
+
+  AsyncLogger():
+    enqueue_pos_(0),
+    dequeue_pos_(0),
+    dropped_(0),
+    running_(true)
+  {
+    for (size_t i=0; i < RING_SIZE; i++)
+      ring_[i].sequence.store(i, boost::memory_order_relaxed);
+
+    writer_ = boost::thread(&AsyncLogger::writerLoop, this);
+  }
+
+  bool writeNext()
+  {
+    Slot* slot = &ring_[dequeue_pos_ & (RING_SIZE-1)];
+    size_t seq = slot->sequence.load(boost::memory_order_acquire);
+
+    if (seq != dequeue_pos_+1)
+      return false;
+
+    static const char* const tags[] = {"[DEBUG] ", "[ INFO] ", "[ WARN] ", "[ERROR] "};
+    FILE* stream = (slot->level >= KURI_LOG_LEVEL_WARN) ? stderr : stdout;
+
+    fputs(tags[slot->level], stream);
+    fputs(slot->text, stream);
+    fputc('\n', stream);
+
+    // Hand the slot back to the producers
+    slot->sequence.store(dequeue_pos_ + RING_SIZE, boost::memory_order_release);
+    dequeue_pos_++;
+    return true;
+  }
+
+  void reportDrops(uint64_t& reported_drops)
+  {
+    uint64_t drops = dropped();
+    if (drops == reported_drops)
+      return;
+
+    fprintf(stderr, "[ WARN] Logger dropped %lu messages\n", (unsigned long)(drops - reported_drops));
+    reported_drops = drops;
+  }
+
+  void writerLoop()
+  {
+    uint64_t reported_drops = 0;
+
+    while (running_)
+    {
+      bool wrote = false;
+      while (writeNext())
+        wrote = true;
+
+      reportDrops(reported_drops);
+
+      if (wrote)
+      {
+        fflush(stdout);
+        fflush(stderr);
+      }
+      else
+      {
+        usleep(5*1000);
+      }
+    }
+
+    // Flush what is left on shutdown
+    while (writeNext()) { }
+    reportDrops(reported_drops);
+    fflush(stdout);
+    fflush(stderr);
+  }
+
+private:
+  AsyncLogger(const AsyncLogger&);
+  AsyncLogger& operator=(const AsyncLogger&);
+};
+
+
+#define KURI_LOG(level, ...) AsyncLogger::instance().log(level, __VA_ARGS__)
+
+#define KURI_LOG_THROTTLE(level, period, ...) \
+  do { \
+    static LogRateLimiter kuri_log_limiter_(period); \
+    if (kuri_log_limiter_.ready()) \
+      KURI_LOG(level, __VA_ARGS__); \
+  } while (0)
+
+#if KURI_LOG_LEVEL <= KURI_LOG_LEVEL_DEBUG
+#define KURI_DEBUG(...)                   KURI_LOG(KURI_LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define KURI_DEBUG_THROTTLE(period, ...)  KURI_LOG_THROTTLE(KURI_LOG_LEVEL_DEBUG, period, __VA_ARGS__)
+#else
+#define KURI_DEBUG(...)                   do { } while (0)
+#define KURI_DEBUG_THROTTLE(period, ...)  do { } while (0)
+#endif
+
+#if KURI_LOG_LEVEL <= KURI_LOG_LEVEL_INFO
+#define KURI_INFO(...)                    KURI_LOG(KURI_LOG_LEVEL_INFO, __VA_ARGS__)
+#define KURI_INFO_THROTTLE(period, ...)   KURI_LOG_THROTTLE(KURI_LOG_LEVEL_INFO, period, __VA_ARGS__)
+#else
+#define KURI_INFO(...)                    do { } while (0)
+#define KURI_INFO_THROTTLE(period, ...)   do { } while (0)
+#endif
+
+#if KURI_LOG_LEVEL <= KURI_LOG_LEVEL_WARN
+#define KURI_WARN(...)                    KURI_LOG(KURI_LOG_LEVEL_WARN, __VA_ARGS__)
+#define KURI_WARN_THROTTLE(period, ...)   KURI_LOG_THROTTLE(KURI_LOG_LEVEL_WARN, period, __VA_ARGS__)
+#else
+#define KURI_WARN(...)                    do { } while (0)
+#define KURI_WARN_THROTTLE(period, ...)   do { } while (0)
+#endif
+
+#if KURI_LOG_LEVEL <= KURI_LOG_LEVEL_ERROR
+#define KURI_ERROR(...)                   KURI_LOG(KURI_LOG_LEVEL_ERROR, __VA_ARGS__)
+#define KURI_ERROR_THROTTLE(period, ...)  KURI_LOG_THROTTLE(KURI_LOG_LEVEL_ERROR, period, __VA_ARGS__)
+#else
+#define KURI_ERROR(...)                   do { } while (0)
+#define KURI_ERROR_THROTTLE(period, ...)  do { } while (0)
+#endif
+
+#endif
@@ -0,0 +1,307 @@
+#ifndef KURI_MBZIRC_CHALLENGE_2_TOOLS_CLUSTER_FEATURES_H_
+#define KURI_MBZIRC_CHALLENGE_2_TOOLS_CLUSTER_FEATURES_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <Eigen/Dense>
+#include <ros/ros.h>
+#include <sensor_msgs/PointCloud2.h>
+#include <pcl/point_cloud.h>
+
+/**
+ * Cheap per-cluster features used to reject clusters that cannot be a panel
+ * before fitting bounding boxes and tracking them. All values are computed
+ * in one pass over the cluster plus a 3x3 eigen decomposition.
+ */
+struct ClusterFeatures
+{
+  int    num_points;
+  double range;             // Horizontal distance of the centroid from the sensor (m)
+  double expected_points;   // Returns a target of the nominal size would give at that range
+  double count_ratio;       // num_points/expected_points
+  double height;            // Vertical extent (m)
+  double length;            // Largest horizontal extent (m)
+  double thickness;         // Horizontal extent across the length (m)
+  double verticality;       // 1 for a vertical surface, 0 for a horizontal one
+
+  bool   has_intensity;
+  double intensity_mean;
+  double intensity_std;
+  double intensity_max;
+};
+
+enum ClusterFeatureId
+{
+  FEATURE_NUM_POINTS = 0,
+  FEATURE_COUNT_RATIO,
+  FEATURE_HEIGHT,
+  FEATURE_LENGTH,
+  FEATURE_THICKNESS,
+  FEATURE_VERTICALITY,
+  FEATURE_INTENSITY_MEAN,
+  FEATURE_INTENSITY_STD,
+  FEATURE_INTENSITY_MAX,
+  FEATURE_COUNT
+};
+
+static const char* const CLUSTER_FEATURE_NAMES[FEATURE_COUNT] = {
+  "num_points", "count_ratio", "height", "length", "thickness", "verticality",
+  "intensity_mean", "intensity_std", "intensity_max"
+};
+
+static inline double clusterFeatureValue(const ClusterFeatures& f, int id)
+{
+  switch (id)
+  {
+    case FEATURE_NUM_POINTS:     return f.num_points;
+    case FEATURE_COUNT_RATIO:    return f.count_ratio;
+    case FEATURE_HEIGHT:         return f.height;
+    case FEATURE_LENGTH:         return f.length;
+    case FEATURE_THICKNESS:      return f.thickness;
+    case FEATURE_VERTICALITY:    return f.verticality;
+    case FEATURE_INTENSITY_MEAN: return f.intensity_mean;
+    case FEATURE_INTENSITY_STD:  return f.intensity_std;
+    case FEATURE_INTENSITY_MAX:  return f.intensity_max;
+  }
+  return 0;
+}
+
+static inline bool isIntensityFeature(int id)
+{
+  return id >= FEATURE_INTENSITY_MEAN;
+}
+
+
+// Copies the intensity channel of a cloud message, in point order. Returns false if there is none.
+static inline bool readCloudIntensity(const sensor_msgs::PointCloud2& msg, std::vector<float>& intensity)
+{
+  intensity.clear();
+
+  for (size_t f=0; f < msg.fields.size(); f++)
+  {
+    const sensor_msgs::PointField& field = msg.fields[f];
+    if (field.name != "intensity" || field.datatype != sensor_msgs::PointField::FLOAT32)
+      continue;
+
+    size_t n = size_t(msg.width)*msg.height;
+    intensity.resize(n);
+
+    for (size_t i=0; i < n; i++)
+    {
+      size_t row = i/msg.width;
+      size_t col = i%msg.width;
+      std::memcpy(&intensity[i], &msg.data[row*msg.row_step + col*msg.point_step + field.offset], sizeof(float));
+    }
+    return true;
+  }
+
+  return false;
+}
+
+
+class ClusterFeatureExtractor
+{
+public:
+  ClusterFeatureExtractor():
+    horizontal_resolution_(0.2*M_PI/180),
+    vertical_resolution_(2.0*M_PI/180),
+    target_width_(1.0),
+    target_height_(1.0)
+  { }
+
+  // Angular resolution of the lidar (rad) and nominal size of the target (m)
+  void setResolution(double horizontal, double vertical) { horizontal_resolution_ = horizontal; vertical_resolution_ = vertical; }
+  void setTargetSize(double width, double height)        { target_width_ = width; target_height_ = height; }
+
+  void loadParams(ros::NodeHandle& nh, const std::string& ns)
+  {
+    double h_deg, v_deg;
+    nh.param(ns + "horizontal_resolution", h_deg, horizontal_resolution_*180/M_PI);
+    nh.param(ns + "vertical_resolution", v_deg, vertical_resolution_*180/M_PI);
+    nh.param(ns + "target_width", target_width_, target_width_);
+    nh.param(ns + "target_height", target_height_, target_height_);
+    setResolution(h_deg*M_PI/180, v_deg*M_PI/180);
+  }
+
+  // Returns a target of the nominal size facing the sensor would produce at range r
+  double expectedPoints(double r) const
+  {
+    r = std::max(r, 1.0);
+    double columns = std::max(1.0, target_width_/(r*horizontal_resolution_));
+    double rings   = std::max(1.0, target_height_/(r*vertical_resolution_));
+    return columns*rings;
+  }
+
+  /**
+   * Features of the points of cloud selected by indices. intensity is
+   * indexed like cloud, and may be empty if the cloud has no intensity.
+   */
+  template <typename PointT>
+  void compute(const pcl::PointCloud<PointT>& cloud, const std::vector<int>& indices,
+               const std::vector<float>& intensity, ClusterFeatures& f) const
+  {
+    f.num_points = indices.size();
+    f.has_intensity = !intensity.empty() && intensity.size() == cloud.points.size();
+    f.intensity_mean = f.intensity_std = f.intensity_max = 0;
+
+    if (indices.empty())
+    {
+      f.range = f.expected_points = f.count_ratio = 0;
+      f.height = f.length = f.thickness = f.verticality = 0;
+      return;
+    }
+
+    // First and second moments, vertical extent and intensity in one pass
+    Eigen::Vector3d sum = Eigen::Vector3d::Zero();
+    Eigen::Matrix3d sum_sq = Eigen::Matrix3d::Zero();
+    double z_min = cloud.points[indices[0]].z;
+    double z_max = z_min;
+    double i_sum = 0, i_sum_sq = 0, i_max = -1e30;
+
+    for (size_t k=0; k < indices.size(); k++)
+    {
+      const PointT& p = cloud.points[ indices[k] ];
+      Eigen::Vector3d x(p.x, p.y, p.z);
+      sum += x;
+      sum_sq += x*x.transpose();
+      z_min = std::min(z_min, x[2]);
+      z_max = std::max(z_max, x[2]);
+
+      if (f.has_intensity)
+      {
+        double v = intensity[ indices[k] ];
+        i_sum += v;
+        i_sum_sq += v*v;
+        i_max = std::max(i_max, v);
+      }
+    }
+
+    double n = indices.size();
+    Eigen::Vector3d mean = sum/n;
+    Eigen::Matrix3d cov = sum_sq/n - mean*mean.transpose();
+
+    f.range = std::sqrt(mean[0]*mean[0] + mean[1]*mean[1]);
+    f.expected_points = expectedPoints(f.range);
+    f.count_ratio = n/f.expected_points;
+    f.height = z_max - z_min;
+
+    if (f.has_intensity)
+    {
+      f.intensity_mean = i_sum/n;
+      f.intensity_std = std::sqrt(std::max(0.0, i_sum_sq/n - f.intensity_mean*f.intensity_mean));
+      f.intensity_max = i_max;
+    }
+
+    // Horizontal extents from the 2x2 xy covariance, assuming a uniform spread (extent = sqrt(12*variance))
+    Eigen::SelfAdjointEigenSolver<Eigen::Matrix2d> solver_xy(cov.block<2,2>(0,0));
+    f.length    = std::sqrt(12*std::max(0.0, solver_xy.eigenvalues()[1]));
+    f.thickness = std::sqrt(12*std::max(0.0, solver_xy.eigenvalues()[0]));
+
+    // Surface normal from the full covariance. Clusters seen by fewer than three rings, and
+    // blobs, do not define a plane and are not rejected for it, so they count as vertical.
+    Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> solver(cov);
+    const Eigen::Vector3d& ev = solver.eigenvalues();
+    if (f.height < 2*f.range*vertical_resolution_ || ev[1] < 1e-4 || ev[0] > 0.25*ev[1])
+      f.verticality = 1;
+    else
+      f.verticality = 1 - std::fabs(solver.eigenvectors().col(0)[2]);
+  }
+
+protected:
+  double horizontal_resolution_;
+  double vertical_resolution_;
+  double target_width_;
+  double target_height_;
+};
+
+
+/**
+ * Threshold classifier over ClusterFeatures. Each rule bounds one feature,
+ * and a cluster is a panel candidate only if it passes all of them. Rules on
+ * intensity are skipped for clusters without intensity. Rules are read from
+ * parameters of the form <ns><feature>/min and <ns><feature>/max.
+ */
+class ClusterClassifier
+{
+public:
+  struct Rule
+  {
+    int feature;
+    double min;
+    double max;
+  };
+
+  ClusterClassifier()
+  {
+    rejected_.assign(FEATURE_COUNT, 0);
+  }
+
+  void addRule(int feature, double min, double max)
+  {
+    Rule r;
+    r.feature = feature;
+    r.min = min;
+    r.max = max;
+    rules_.push_back(r);
+  }
+
+  void clearRules() { rules_.clear(); }
+  const std::vector<Rule>& rules() { return rules_; }
+
+  void loadParams(ros::NodeHandle& nh, const std::string& ns)
+  {
+    rules_.clear();
+
+    for (int id=0; id < FEATURE_COUNT; id++)
+    {
+      std::string name = ns + CLUSTER_FEATURE_NAMES[id];
+      double min = -HUGE_VAL, max = HUGE_VAL;
+      bool has_min = nh.getParam(name + "/min", min);
+      bool has_max = nh.getParam(name + "/max", max);
+
+      if (has_min || has_max)
+        addRule(id, min, max);
+    }
+  }
+
+  // Returns the index of the first failed feature, or -1 if all rules pass
+  int firstFailure(const ClusterFeatures& f) const
+  {
+    for (size_t i=0; i < rules_.size(); i++)
+    {
+      const Rule& r = rules_[i];
+      if (isIntensityFeature(r.feature) && !f.has_intensity)
+        continue;
+
+      double v = clusterFeatureValue(f, r.feature);
+      if (v < r.min || v > r.max)
+        return r.feature;
+    }
+
+    return -1;
+  }
+
+  bool accept(const ClusterFeatures& f)
+  {
+    int failed = firstFailure(f);
+    if (failed < 0)
+      return true;
+
+    rejected_[failed]++;
+    return false;
+  }
+
+  // Rejections per feature since the last reset
+  const std::vector<int>& rejected() { return rejected_; }
+  void resetCounts() { rejected_.assign(FEATURE_COUNT, 0); }
+
+protected:
+  std::vector<Rule> rules_;
+  std::vector<int> rejected_;
+};
+
+#endif
@@ -0,0 +1,111 @@
+#ifndef KURI_MBZIRC_CHALLENGE_2_TOOLS_FRAME_MAILBOX_H_
+#define KURI_MBZIRC_CHALLENGE_2_TOOLS_FRAME_MAILBOX_H_
+
+#include <stdint.h>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <ros/ros.h>
+#include <kuri_mbzirc_challenge_2_tools/stats_reporter.h>
+
+/**
+ * Single-slot mailbox between a subscriber callback and a worker thread.
+ *
+ * post() replaces whatever frame is waiting, so the worker always gets the
+ * newest one and stale frames never queue up. A replaced frame counts as
+ * dropped. The callback holds the lock only long enough to swap a pointer.
+ */
+template <typename T>
+class FrameMailbox
+{
+public:
+  typedef boost::shared_ptr<const T> ConstPtr;
+
+  FrameMailbox():
+    posted_(0),
+    dropped_(0),
+    closed_(false)
+  { }
+
+  void post(const ConstPtr& frame)
+  {
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      if (slot_)
+        dropped_++;
+
+      slot_ = frame;
+      posted_++;
+    }
+    cond_.notify_one();
+  }
+
+  // Blocks until a frame is available. Returns false once the mailbox is closed.
+  bool wait(ConstPtr& frame)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    while (!slot_ && !closed_)
+      cond_.wait(lock);
+
+    if (closed_)
+      return false;
+
+    frame.swap(slot_);
+    slot_.reset();
+    return true;
+  }
+
+  // Wakes up the worker and makes wait() return false
+  void close()
+  {
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      closed_ = true;
+    }
+    cond_.notify_all();
+  }
+
+  uint64_t posted()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return posted_;
+  }
+
+  uint64_t dropped()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return dropped_;
+  }
+
+protected:
+  boost::mutex mutex_;
+  boost::condition_variable cond_;
+  ConstPtr slot_;
+  uint64_t posted_;
+  uint64_t dropped_;
+  bool closed_;
+};
+
+
+/**
+ * Worker thread body: processes the newest frame of a mailbox until it is
+ * closed, reporting the age of each frame and the frames dropped so far.
+ * T needs a header with a stamp, e.g.
+ *   boost::thread(boost::bind(&frameWorker<sensor_msgs::Image>, &mailbox, &process, stats));
+ */
+template <typename T>
+void frameWorker(FrameMailbox<T>* mailbox, void (*process)(const boost::shared_ptr<const T>&), StatsReporter* stats)
+{
+  boost::shared_ptr<const T> frame;
+  while (mailbox->wait(frame))
+  {
+    stats->set("frame_age_ms", (ros::Time::now() - frame->header.stamp).toSec()*1000);
+    stats->set("dropped_frames", mailbox->dropped());
+    process(frame);
+    stats->publishIfDue();
+  }
+}
+
+#endif
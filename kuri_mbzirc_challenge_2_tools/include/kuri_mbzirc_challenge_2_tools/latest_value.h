@@ -0,0 +1,76 @@
+#ifndef KURI_MBZIRC_CHALLENGE_2_TOOLS_LATEST_VALUE_H_
+#define KURI_MBZIRC_CHALLENGE_2_TOOLS_LATEST_VALUE_H_
+
+#include <stdint.h>
+
+#include <boost/atomic.hpp>
+
+/**
+ * Lock-free cell holding the latest value of a small plain-old-data type,
+ * written by one thread and read by any number of others (a seqlock).
+ *
+ * The writer never blocks. A reader copies the value and retries if a
+ * write happened meanwhile, so it always gets a consistent value and only
+ * spins for as long as a single copy of T takes. Intended for sensor state
+ * (GPS fix, orientation, odometry pose) handed from a subscriber thread to
+ * a processing thread.
+ */
+template <typename T>
+class LatestValue
+{
+public:
+  LatestValue():
+    sequence_(0)
+  { }
+
+  // Single writer only
+  void store(const T& value)
+  {
+    uint32_t s = sequence_.load(boost::memory_order_relaxed);
+    sequence_.store(s + 1, boost::memory_order_relaxed);
+    boost::atomic_thread_fence(boost::memory_order_release);
+
+    value_ = value;
+
+    sequence_.store(s + 2, boost::memory_order_release);
+  }
+
+  // Returns false if nothing was stored yet
+  bool load(T& value) const
+  {
+    uint32_t version;
+    return load(value, version);
+  }
+
+  // version changes every time a new value is stored, so readers can skip unchanged values
+  bool load(T& value, uint32_t& version) const
+  {
+    for (;;)
+    {
+      uint32_t s1 = sequence_.load(boost::memory_order_acquire);
+      if (s1 & 1)
+        continue;
+
+      value = value_;
+      boost::atomic_thread_fence(boost::memory_order_acquire);
+
+      uint32_t s2 = sequence_.load(boost::memory_order_relaxed);
+      if (s1 == s2)
+      {
+        version = s1/2;
+        return s1 != 0;
+      }
+    }
+  }
+
+  uint32_t version() const
+  {
+    return sequence_.load(boost::memory_order_acquire)/2;
+  }
+
+protected:
+  boost::atomic<uint32_t> sequence_;
+  T value_;
+};
+
+#endif
@@ -0,0 +1,306 @@
+#ifndef KURI_MBZIRC_CHALLENGE_2_TOOLS_MIN_AREA_RECT_H_
+#define KURI_MBZIRC_CHALLENGE_2_TOOLS_MIN_AREA_RECT_H_
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include <pcl/point_cloud.h>
+
+/**
+ * Smallest rectangle enclosing the XY footprint of a cluster.
+ *
+ * yaw is the direction of the long side (width), in (-pi/2, pi/2]. The face
+ * normals are unit vectors pointing from the rectangle towards the origin of
+ * the cloud frame, which is the sensor for clouds in the sensor frame.
+ */
+struct OrientedRect
+{
+  bool   valid;
+  double center_x;
+  double center_y;
+  double yaw;
+  double width;        // Long side
+  double depth;        // Short side
+  double min_z;
+  double max_z;
+
+  double long_face_normal_x;    // Normal of the faces along the width
+  double long_face_normal_y;
+  double short_face_normal_x;   // Normal of the faces along the depth
+  double short_face_normal_y;
+
+  int    hull_size;
+};
+
+
+/**
+ * Fits an OrientedRect with a 2D convex hull (monotone chain, O(n log n))
+ * followed by rotating calipers over the hull edges (O(h)). Unlike PCA this
+ * gives the right orientation for the few points of an L-shaped return from
+ * a panel corner.
+ *
+ * The hull of an L is close to a triangle, for which every edge gives nearly
+ * the same area, so rectangles within area_tolerance of the smallest are
+ * compared by how close the points lie to their edges instead. That costs
+ * O(n) for each such rectangle: usually a few, but O(n h) when the hull is
+ * close to a regular polygon. The only allocations are the scratch vectors,
+ * which keep their capacity.
+ */
+class MinAreaRectFitter
+{
+public:
+  MinAreaRectFitter():
+    area_tolerance_(0.05)
+  { }
+
+  // Relative area above the smallest rectangle still considered a candidate
+  void setAreaTolerance(double tolerance) { area_tolerance_ = tolerance; }
+
+  template <typename PointT>
+  bool fit(const pcl::PointCloud<PointT>& cloud, OrientedRect& rect)
+  {
+    points_.clear();
+    points_.reserve(cloud.points.size());
+    rect.min_z = rect.max_z = 0;
+
+    for (size_t i=0; i < cloud.points.size(); i++)
+    {
+      const PointT& p = cloud.points[i];
+      if (!std::isfinite(p.x) || !std::isfinite(p.y) || !std::isfinite(p.z))
+        continue;
+
+      if (points_.empty())
+        rect.min_z = rect.max_z = p.z;
+
+      rect.min_z = std::min<double>(rect.min_z, p.z);
+      rect.max_z = std::max<double>(rect.max_z, p.z);
+      points_.push_back(Point2(p.x, p.y));
+    }
+
+    return fitPoints(rect);
+  }
+
+  // Hull of the last fit, counter-clockwise
+  const std::vector<std::pair<double, double> >& hull() const { return hull_; }
+
+protected:
+  typedef std::pair<double, double> Point2;
+
+  struct Candidate
+  {
+    Point2 origin;
+    double ux, uy;
+    double u_min, u_max, v_max;
+    double area;
+  };
+
+  double area_tolerance_;
+  std::vector<Point2> points_;
+  std::vector<Point2> hull_;
+  std::vector<Candidate> candidates_;
+
+  static double cross(const Point2& o, const Point2& a, const Point2& b)
+  {
+    return (a.first - o.first)*(b.second - o.second) - (a.second - o.second)*(b.first - o.first);
+  }
+
+  static double dot(const Point2& a, const Point2& b, double ux, double uy)
+  {
+    return (b.first - a.first)*ux + (b.second - a.second)*uy;
+  }
+
+  void computeHull()
+  {
+    std::sort(points_.begin(), points_.end());
+    points_.erase(std::unique(points_.begin(), points_.end()), points_.end());
+
+    size_t n = points_.size();
+    hull_.resize(2*n);
+    if (n < 3)
+    {
+      hull_.assign(points_.begin(), points_.end());
+      return;
+    }
+
+    // Lower then upper hull
+    size_t k = 0;
+    for (size_t i=0; i < n; i++)
+    {
+      while (k >= 2 && cross(hull_[k-2], hull_[k-1], points_[i]) <= 0)
+        k--;
+      hull_[k++] = points_[i];
+    }
+
+    for (size_t i=n-1, t=k+1; i > 0; i--)
+    {
+      while (k >= t && cross(hull_[k-2], hull_[k-1], points_[i-1]) <= 0)
+        k--;
+      hull_[k++] = points_[i-1];
+    }
+
+    hull_.resize(k-1);
+  }
+
+  bool fitPoints(OrientedRect& rect)
+  {
+    rect.valid = false;
+    if (points_.empty())
+      return false;
+
+    computeHull();
+    candidates_.clear();
+    int h = hull_.size();
+    rect.hull_size = h;
+
+    // Best edge direction (u) and the extents of the hull along it and its normal (v)
+    double best_area = HUGE_VAL;
+    double best_ux = 1, best_uy = 0;
+    double best_u_min = 0, best_u_max = 0, best_v_min = 0, best_v_max = 0;
+    Point2 best_origin = hull_[0];
+
+    if (h == 1)
+    {
+      best_area = 0;
+    }
+    else if (h == 2)
+    {
+      double dx = hull_[1].first - hull_[0].first;
+      double dy = hull_[1].second - hull_[0].second;
+      double len = std::sqrt(dx*dx + dy*dy);
+      best_ux = dx/len;
+      best_uy = dy/len;
+      best_u_max = len;
+      best_area = 0;
+    }
+    else
+    {
+      // Rotating calipers: the extreme points along u and v only move forward along the hull
+      int r = 0, f = 0, l = 0;
+
+      for (int i=0; i < h; i++)
+      {
+        const Point2& p = hull_[i];
+        const Point2& q = hull_[(i+1)%h];
+
+        double dx = q.first - p.first;
+        double dy = q.second - p.second;
+        double len = std::sqrt(dx*dx + dy*dy);
+        double ux = dx/len, uy = dy/len;
+        double vx = -uy, vy = ux;   // Points into the hull
+
+        if (i == 0)
+        {
+          for (int j=1; j < h; j++)
+          {
+            if (dot(p, hull_[j], ux, uy) > dot(p, hull_[r], ux, uy)) r = j;
+            if (dot(p, hull_[j], vx, vy) > dot(p, hull_[f], vx, vy)) f = j;
+            if (dot(p, hull_[j], ux, uy) < dot(p, hull_[l], ux, uy)) l = j;
+          }
+        }
+        else
+        {
+          for (int k=0; k < h && dot(p, hull_[(r+1)%h], ux, uy) > dot(p, hull_[r], ux, uy); k++) r = (r+1)%h;
+          for (int k=0; k < h && dot(p, hull_[(f+1)%h], vx, vy) > dot(p, hull_[f], vx, vy); k++) f = (f+1)%h;
+          for (int k=0; k < h && dot(p, hull_[(l+1)%h], ux, uy) < dot(p, hull_[l], ux, uy); k++) l = (l+1)%h;
+        }
+
+        Candidate c;
+        c.origin = p;
+        c.ux = ux;
+        c.uy = uy;
+        c.u_min = dot(p, hull_[l], ux, uy);
+        c.u_max = dot(p, hull_[r], ux, uy);
+        c.v_max = dot(p, hull_[f], vx, vy);
+        c.area = (c.u_max - c.u_min)*c.v_max;
+        candidates_.push_back(c);
+
+        best_area = std::min(best_area, c.area);
+      }
+
+      // Among the smallest rectangles, the one whose edges the points hug
+      double best_closeness = HUGE_VAL;
+      for (size_t i=0; i < candidates_.size(); i++)
+      {
+        const Candidate& c = candidates_[i];
+        if (c.area > best_area*(1 + area_tolerance_) + 1e-9)
+          continue;
+
+        double closeness = 0;
+        for (size_t j=0; j < points_.size(); j++)
+        {
+          double u = dot(c.origin, points_[j], c.ux, c.uy);
+          double v = dot(c.origin, points_[j], -c.uy, c.ux);
+          closeness += std::min(std::min(u - c.u_min, c.u_max - u), std::min(v, c.v_max - v));
+        }
+
+        if (closeness < best_closeness)
+        {
+          best_closeness = closeness;
+          best_ux = c.ux;
+          best_uy = c.uy;
+          best_u_min = c.u_min;
+          best_u_max = c.u_max;
+          best_v_max = c.v_max;
+          best_origin = c.origin;
+        }
+      }
+    }
+
+    // Rectangle in the frame of the cloud
+    double vx = -best_uy, vy = best_ux;
+    double u_mid = 0.5*(best_u_min + best_u_max);
+    double v_mid = 0.5*(best_v_min + best_v_max);
+    double extent_u = best_u_max - best_u_min;
+    double extent_v = best_v_max - best_v_min;
+
+    rect.center_x = best_origin.first  + u_mid*best_ux + v_mid*vx;
+    rect.center_y = best_origin.second + u_mid*best_uy + v_mid*vy;
+
+    double long_x = best_ux, long_y = best_uy;
+    if (extent_u >= extent_v)
+    {
+      rect.width = extent_u;
+      rect.depth = extent_v;
+    }
+    else
+    {
+      rect.width = extent_v;
+      rect.depth = extent_u;
+      long_x = vx;
+      long_y = vy;
+    }
+
+    // Direction of the long side, folded into (-pi/2, pi/2]
+    if (long_x < 0 || (long_x == 0 && long_y < 0))
+    {
+      long_x = -long_x;
+      long_y = -long_y;
+    }
+    rect.yaw = std::atan2(long_y, long_x);
+
+    // Face normals towards the sensor
+    double to_sensor_x = -rect.center_x, to_sensor_y = -rect.center_y;
+
+    rect.long_face_normal_x = -long_y;
+    rect.long_face_normal_y = long_x;
+    if (rect.long_face_normal_x*to_sensor_x + rect.long_face_normal_y*to_sensor_y < 0)
+    {
+      rect.long_face_normal_x = -rect.long_face_normal_x;
+      rect.long_face_normal_y = -rect.long_face_normal_y;
+    }
+
+    rect.short_face_normal_x = long_x;
+    rect.short_face_normal_y = long_y;
+    if (rect.short_face_normal_x*to_sensor_x + rect.short_face_normal_y*to_sensor_y < 0)
+    {
+      rect.short_face_normal_x = -rect.short_face_normal_x;
+      rect.short_face_normal_y = -rect.short_face_normal_y;
+    }
+
+    rect.valid = true;
+    return true;
+  }
+};
+
+#endif
@@ -0,0 +1,147 @@
+#ifndef KURI_MBZIRC_CHALLENGE_2_TOOLS_MOTION_GATED_SCHEDULER_H_
+#define KURI_MBZIRC_CHALLENGE_2_TOOLS_MOTION_GATED_SCHEDULER_H_
+
+#include <cmath>
+#include <string>
+
+#include <boost/thread/mutex.hpp>
+
+#include <ros/ros.h>
+
+/**
+ * Decides whether a perception callback should process the incoming scan.
+ *
+ * While the robot moves every scan is processed. Once the odometry twist has
+ * stayed below the thresholds for still_time seconds, consecutive scans see
+ * the same scene, so only one scan per heartbeat_period is processed. Full
+ * rate resumes on motion, for wake_time seconds after wake() (a query or a
+ * new goal), and whenever the caller reports that its tracker has not
+ * settled yet.
+ *
+ * A caller that may still drop a scan after deciding to process it asks
+ * isDue() and calls markProcessed() once the scan is really taken, so a lost
+ * scan does not use up the heartbeat.
+ *
+ * All methods can be called from different threads.
+ */
+class MotionGatedScheduler
+{
+public:
+  MotionGatedScheduler():
+    enabled_(false),
+    linear_threshold_(0.05),
+    angular_threshold_(0.05),
+    still_time_(1.0),
+    heartbeat_period_(1.0),
+    wake_time_(2.0),
+    has_twist_(false),
+    gated_(false),
+    num_skipped_(0)
+  { }
+
+  // Reads the parameters under ns, e.g. "motion_gating/"
+  void loadParams(ros::NodeHandle& nh, const std::string& ns)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    nh.param(ns + "enabled", enabled_, enabled_);
+    nh.param(ns + "linear_threshold", linear_threshold_, linear_threshold_);
+    nh.param(ns + "angular_threshold", angular_threshold_, angular_threshold_);
+    nh.param(ns + "still_time", still_time_, still_time_);
+    nh.param(ns + "heartbeat_period", heartbeat_period_, heartbeat_period_);
+    nh.param(ns + "wake_time", wake_time_, wake_time_);
+  }
+
+  bool isEnabled() const { return enabled_; }
+
+  // Odometry twist, m/s and rad/s
+  void updateTwist(double linear_speed, double angular_speed)
+  {
+    ros::WallTime now = ros::WallTime::now();
+
+    boost::mutex::scoped_lock lock(mutex_);
+    if (!has_twist_ || std::fabs(linear_speed) > linear_threshold_ || std::fabs(angular_speed) > angular_threshold_)
+      last_motion_ = now;
+    has_twist_ = true;
+  }
+
+  // Process at full rate for the next wake_time seconds
+  void wake()
+  {
+    ros::WallTime now = ros::WallTime::now();
+
+    boost::mutex::scoped_lock lock(mutex_);
+    wake_until_ = now + ros::WallDuration(wake_time_);
+  }
+
+  // True if the scan should be processed. tracker_settled is false while
+  // the caller still needs scans to confirm or reject its candidates.
+  bool isDue(bool tracker_settled = true)
+  {
+    ros::WallTime now = ros::WallTime::now();
+
+    boost::mutex::scoped_lock lock(mutex_);
+
+    // Without odometry, never assume the robot is still
+    gated_ = enabled_ && has_twist_ && tracker_settled
+        && (now - last_motion_).toSec() > still_time_
+        && now > wake_until_;
+
+    if (gated_ && (now - last_processed_).toSec() < heartbeat_period_)
+    {
+      num_skipped_++;
+      return false;
+    }
+
+    return true;
+  }
+
+  // Starts the next heartbeat period
+  void markProcessed()
+  {
+    ros::WallTime now = ros::WallTime::now();
+
+    boost::mutex::scoped_lock lock(mutex_);
+    last_processed_ = now;
+  }
+
+  // isDue() for callers that process the scan right away
+  bool shouldProcess(bool tracker_settled = true)
+  {
+    if (!isDue(tracker_settled))
+      return false;
+
+    markProcessed();
+    return true;
+  }
+
+  // Set by the last isDue()
+  bool isGated()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return gated_;
+  }
+
+  unsigned long numSkipped()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return num_skipped_;
+  }
+
+protected:
+  bool enabled_;
+  double linear_threshold_;
+  double angular_threshold_;
+  double still_time_;
+  double heartbeat_period_;
+  double wake_time_;
+
+  bool has_twist_;
+  bool gated_;
+  unsigned long num_skipped_;
+  ros::WallTime last_motion_;
+  ros::WallTime last_processed_;
+  ros::WallTime wake_until_;
+  boost::mutex mutex_;
+};
+
+#endif
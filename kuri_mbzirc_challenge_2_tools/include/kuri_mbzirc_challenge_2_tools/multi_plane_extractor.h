@@ -0,0 +1,279 @@
+#ifndef KURI_MBZIRC_CHALLENGE_2_TOOLS_MULTI_PLANE_EXTRACTOR_H_
+#define KURI_MBZIRC_CHALLENGE_2_TOOLS_MULTI_PLANE_EXTRACTOR_H_
+
+#include <stdint.h>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include <Eigen/Dense>
+#include <pcl/point_cloud.h>
+#include <pcl/PointIndices.h>
+
+/**
+ * Plane found by MultiPlaneExtractor. Its points are
+ * clusters[cluster].indices[begin, end) after the extraction.
+ */
+struct PlaneSpan
+{
+  // Unaligned, so that spans can be kept in plain std::vectors
+  typedef Eigen::Matrix<float, 4, 1, Eigen::DontAlign> Coefficients;
+
+  Coefficients coefficients;      // ax + by + cz + d = 0, unit normal
+  int cluster;
+  int begin;
+  int end;
+
+  int size() const { return end - begin; }
+};
+
+
+/**
+ * Repeated RANSAC plane extraction that never copies points.
+ *
+ * Each cluster's index list is used as the mask: the points of every plane
+ * found are moved to the front of the still unassigned part of the list, so
+ * a plane is a span of indices and the remainder is the tail. The candidate
+ * planes of a round are drawn up front and scored in parallel. Several
+ * clusters are processed concurrently, each with its own scratch, in which
+ * case the scoring inside a cluster runs serially (no nested OpenMP).
+ *
+ * With an axis set, only planes parallel to it are kept, as
+ * SACMODEL_PARALLEL_PLANE does (vertical planes for the z axis).
+ */
+class MultiPlaneExtractor
+{
+public:
+  MultiPlaneExtractor():
+    distance_threshold_(0.02),
+    max_iterations_(100),
+    min_remaining_ratio_(0.3),
+    min_inliers_(3),
+    max_planes_(10),
+    use_axis_(false),
+    axis_(0, 0, 1),
+    max_axis_cos_(0),
+    seed_(12345)
+  { }
+
+  void setDistanceThreshold(double threshold) { distance_threshold_ = threshold; }
+  void setMaxIterations(int iterations)       { max_iterations_ = iterations; }
+  void setMinInliers(int min_inliers)         { min_inliers_ = min_inliers; }
+  void setMaxPlanes(int max_planes)           { max_planes_ = max_planes; }
+  void setSeed(uint32_t seed)                 { seed_ = seed; }
+
+  // Stop once fewer than this fraction of the cluster is left unassigned
+  void setMinRemainingRatio(double ratio)     { min_remaining_ratio_ = ratio; }
+
+  // Only planes parallel to axis, within eps_angle (rad)
+  void setAxis(const Eigen::Vector3f& axis, double eps_angle)
+  {
+    use_axis_ = true;
+    axis_ = axis.normalized();
+    max_axis_cos_ = std::sin(eps_angle);
+  }
+
+  /**
+   * Extracts the planes of every cluster. The index lists are reordered in
+   * place; planes are appended to planes cluster by cluster.
+   */
+  template <typename PointT>
+  void extract(const pcl::PointCloud<PointT>& cloud, std::vector<pcl::PointIndices>& clusters, std::vector<PlaneSpan>& planes) const
+  {
+    int n = clusters.size();
+    std::vector<std::vector<PlaneSpan> > cluster_planes (n);
+
+    #pragma omp parallel for schedule(dynamic)
+    for (int c=0; c < n; c++)
+    {
+      Scratch scratch;
+      extractCluster(cloud, clusters[c].indices, c, scratch, cluster_planes[c]);
+    }
+
+    for (int c=0; c < n; c++)
+      planes.insert(planes.end(), cluster_planes[c].begin(), cluster_planes[c].end());
+  }
+
+  // Single cluster; the hypotheses of each round are scored in parallel
+  template <typename PointT>
+  void extract(const pcl::PointCloud<PointT>& cloud, std::vector<int>& indices, std::vector<PlaneSpan>& planes)
+  {
+    extractCluster(cloud, indices, 0, scratch_, planes);
+  }
+
+protected:
+  struct Scratch
+  {
+    std::vector<PlaneSpan::Coefficients> hypotheses;
+    std::vector<int> scores;
+  };
+
+  double   distance_threshold_;
+  int      max_iterations_;
+  double   min_remaining_ratio_;
+  int      min_inliers_;
+  int      max_planes_;
+  bool     use_axis_;
+  Eigen::Vector3f axis_;
+  double   max_axis_cos_;
+  uint32_t seed_;
+
+  Scratch  scratch_;
+
+  static uint32_t hash(uint32_t x)
+  {
+    x ^= x >> 16;  x *= 0x7feb352dU;
+    x ^= x >> 15;  x *= 0x846ca68bU;
+    x ^= x >> 16;
+    return x;
+  }
+
+  bool acceptNormal(const Eigen::Vector3f& normal) const
+  {
+    return !use_axis_ || std::fabs(normal.dot(axis_)) <= max_axis_cos_;
+  }
+
+  template <typename PointT>
+  static Eigen::Vector3f position(const pcl::PointCloud<PointT>& cloud, int index)
+  {
+    const PointT& p = cloud.points[index];
+    return Eigen::Vector3f(p.x, p.y, p.z);
+  }
+
+  template <typename PointT>
+  bool isInlier(const pcl::PointCloud<PointT>& cloud, int index, const PlaneSpan::Coefficients& plane) const
+  {
+    const PointT& p = cloud.points[index];
+    return std::fabs(plane[0]*p.x + plane[1]*p.y + plane[2]*p.z + plane[3]) <= distance_threshold_;
+  }
+
+  template <typename PointT>
+  void extractCluster(const pcl::PointCloud<PointT>& cloud, std::vector<int>& indices, int cluster,
+                      Scratch& scratch, std::vector<PlaneSpan>& planes) const
+  {
+    int n = indices.size();
+    int head = 0;   // indices[head, n) are not assigned to a plane yet
+
+    scratch.hypotheses.resize(max_iterations_, PlaneSpan::Coefficients::Zero());
+    scratch.scores.resize(max_iterations_);
+
+    for (int round=0; round < max_planes_ && n - head > min_remaining_ratio_*n && n - head >= 3; round++)
+    {
+      int remaining = n - head;
+      const int* active = &indices[head];
+
+      // Score all the hypotheses of this round at once. Samples only depend on
+      // (seed, cluster, round, hypothesis), so the result does not depend on
+      // the number of threads.
+      #pragma omp parallel for schedule(static) if(remaining*max_iterations_ > 50000)
+      for (int h=0; h < max_iterations_; h++)
+      {
+        uint32_t key = hash(seed_ ^ hash(cluster*7919 + round*131 + h));
+        int s0 = hash(key + 1) % remaining;
+        int s1 = hash(key + 2) % remaining;
+        int s2 = hash(key + 3) % remaining;
+
+        scratch.scores[h] = -1;
+        if (s0 == s1 || s0 == s2 || s1 == s2)
+          continue;
+
+        Eigen::Vector3f p0 = position(cloud, active[s0]);
+        Eigen::Vector3f normal = (position(cloud, active[s1]) - p0).cross(position(cloud, active[s2]) - p0);
+        float norm = normal.norm();
+        if (norm < 1e-6)
+          continue;
+
+        normal /= norm;
+        if (!acceptNormal(normal))
+          continue;
+
+        PlaneSpan::Coefficients plane (normal[0], normal[1], normal[2], -normal.dot(p0));
+        scratch.hypotheses[h] = plane;
+
+        int score = 0;
+        for (int i=0; i < remaining; i++)
+          if (isInlier(cloud, active[i], plane))
+            score++;
+
+        scratch.scores[h] = score;
+      }
+
+      // Best hypothesis, lowest index on ties
+      int best = -1;
+      for (int h=0; h < max_iterations_; h++)
+        if (scratch.scores[h] > 0 && (best < 0 || scratch.scores[h] > scratch.scores[best]))
+          best = h;
+
+      if (best < 0 || scratch.scores[best] < min_inliers_)
+        break;
+
+      PlaneSpan::Coefficients plane = refine(cloud, active, remaining, scratch.hypotheses[best]);
+
+      // Move the inliers to the front of the unassigned part
+      int* begin = &indices[head];
+      int* middle = std::partition(begin, begin + remaining, InlierTest<PointT>(*this, cloud, plane));
+      int count = middle - begin;
+
+      if (count < min_inliers_)
+        break;
+
+      PlaneSpan span;
+      span.coefficients = plane;
+      span.cluster = cluster;
+      span.begin = head;
+      span.end = head + count;
+      planes.push_back(span);
+
+      head += count;
+    }
+  }
+
+  // Least squares plane of the inliers, kept only if it still respects the axis
+  template <typename PointT>
+  PlaneSpan::Coefficients refine(const pcl::PointCloud<PointT>& cloud, const int* active, int remaining, const PlaneSpan::Coefficients& plane) const
+  {
+    Eigen::Vector3d sum = Eigen::Vector3d::Zero();
+    Eigen::Matrix3d sum_sq = Eigen::Matrix3d::Zero();
+    int count = 0;
+
+    for (int i=0; i < remaining; i++)
+    {
+      if (!isInlier(cloud, active[i], plane))
+        continue;
+
+      Eigen::Vector3d p = position(cloud, active[i]).template cast<double>();
+      sum += p;
+      sum_sq += p*p.transpose();
+      count++;
+    }
+
+    if (count < 3)
+      return plane;
+
+    Eigen::Vector3d mean = sum/count;
+    Eigen::Matrix3d covariance = sum_sq/count - mean*mean.transpose();
+    Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> solver (covariance);
+    Eigen::Vector3f normal = solver.eigenvectors().col(0).cast<float>();
+
+    if (!acceptNormal(normal))
+      return plane;
+
+    return PlaneSpan::Coefficients(normal[0], normal[1], normal[2], -normal.dot(mean.cast<float>()));
+  }
+
+  template <typename PointT>
+  struct InlierTest
+  {
+    const MultiPlaneExtractor& extractor;
+    const pcl::PointCloud<PointT>& cloud;
+    PlaneSpan::Coefficients plane;
+
+    InlierTest(const MultiPlaneExtractor& e, const pcl::PointCloud<PointT>& c, const PlaneSpan::Coefficients& p):
+      extractor(e), cloud(c), plane(p)
+    { }
+
+    bool operator()(int index) const { return extractor.isInlier(cloud, index, plane); }
+  };
+};
+
+#endif
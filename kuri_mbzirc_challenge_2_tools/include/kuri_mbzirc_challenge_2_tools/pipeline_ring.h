@@ -0,0 +1,123 @@
+#ifndef KURI_MBZIRC_CHALLENGE_2_TOOLS_PIPELINE_RING_H_
+#define KURI_MBZIRC_CHALLENGE_2_TOOLS_PIPELINE_RING_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <boost/atomic.hpp>
+#include <boost/lockfree/spsc_queue.hpp>
+#include <boost/scoped_array.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+/**
+ * Bounded ring of preallocated slots between two pipeline stages, one
+ * producer thread and one consumer thread.
+ *
+ * The producer fills a slot from acquire() and hands it over with push();
+ * the consumer gets it from wait() and gives it back with release(). Both
+ * directions are single-producer/single-consumer lock-free queues, so the
+ * slots (and whatever buffers they own) are reused and never copied. When
+ * every slot is in use the producer's acquire() fails and the frame counts
+ * as dropped, which bounds the latency to depth frames.
+ *
+ * The consumer sleeps on a condition variable while the ring is empty; the
+ * producer only takes its mutex to wake it up.
+ */
+template <typename T>
+class PipelineRing
+{
+public:
+  explicit PipelineRing(size_t depth):
+    size_(depth < 1 ? 1 : depth),
+    slots_(new T[size_]),
+    free_(size_ + 1),    // A ring buffer of n elements holds n - 1
+    ready_(size_ + 1),
+    queued_(0),
+    pushed_(0),
+    dropped_(0),
+    closed_(false)
+  {
+    for (size_t i=0; i < size_; i++)
+      free_.push(&slots_[i]);
+  }
+
+  size_t size() const { return size_; }
+
+  // Producer. Returns NULL, and counts a drop, if the consumer holds every slot.
+  T* acquire()
+  {
+    T* slot;
+    if (free_.pop(slot))
+      return slot;
+
+    dropped_++;
+    return NULL;
+  }
+
+  // Producer. The slot must come from acquire(), and every acquired slot must be pushed.
+  void push(T* slot)
+  {
+    queued_++;
+    ready_.push(slot);
+    pushed_++;
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+    }
+    cond_.notify_one();
+  }
+
+  // Consumer. Blocks until a slot is ready. Returns NULL once the ring is closed.
+  T* wait()
+  {
+    T* slot;
+    boost::mutex::scoped_lock lock(mutex_);
+    while (!ready_.pop(slot))
+    {
+      if (closed_)
+        return NULL;
+      cond_.wait(lock);
+    }
+
+    queued_--;
+    return slot;
+  }
+
+  // Consumer. Returns a slot from wait() to the producer.
+  void release(T* slot)
+  {
+    free_.push(slot);
+  }
+
+  // Wakes up the consumer and makes wait() return NULL once the ring is empty
+  void close()
+  {
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      closed_ = true;
+    }
+    cond_.notify_all();
+  }
+
+  // Slots pushed and not picked up by the consumer yet
+  size_t queued() const    { return queued_.load(boost::memory_order_relaxed); }
+  uint64_t pushed() const  { return pushed_.load(boost::memory_order_relaxed); }
+  uint64_t dropped() const { return dropped_.load(boost::memory_order_relaxed); }
+
+protected:
+  size_t size_;
+  boost::scoped_array<T> slots_;
+  boost::lockfree::spsc_queue<T*> free_;    // Consumer to producer
+  boost::lockfree::spsc_queue<T*> ready_;   // Producer to consumer
+
+  boost::atomic<size_t> queued_;
+  boost::atomic<uint64_t> pushed_;
+  boost::atomic<uint64_t> dropped_;
+
+  boost::mutex mutex_;
+  boost::condition_variable cond_;
+  bool closed_;
+};
+
+#endif
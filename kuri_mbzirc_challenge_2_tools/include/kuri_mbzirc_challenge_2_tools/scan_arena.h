@@ -0,0 +1,243 @@
+#ifndef KURI_MBZIRC_CHALLENGE_2_TOOLS_SCAN_ARENA_H_
+#define KURI_MBZIRC_CHALLENGE_2_TOOLS_SCAN_ARENA_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <limits>
+#include <new>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/type_traits/alignment_of.hpp>
+#include <pcl/point_cloud.h>
+
+/**
+ * Monotonic arena for buffers that only live while one scan is processed.
+ *
+ * allocate() bumps an offset, deallocate() does nothing, and reset() frees
+ * everything at once. What does not fit comes from overflow blocks, which
+ * are merged into one larger block on the next reset, so once the arena has
+ * grown to the size of a typical scan it never calls malloc again. With the
+ * arena disabled every call goes straight to malloc/free, which is useful to
+ * compare allocation counts.
+ */
+class ScanArena : boost::noncopyable
+{
+public:
+  explicit ScanArena(size_t capacity = 1 << 20):
+    buffer_(NULL),
+    capacity_(0),
+    used_(0),
+    peak_(0),
+    overflow_bytes_(0),
+    enabled_(true)
+  {
+    overflow_.reserve(64);
+    grow(capacity);
+  }
+
+  ~ScanArena()
+  {
+    releaseOverflow();
+    std::free(buffer_);
+  }
+
+  void setEnabled(bool enabled) { enabled_ = enabled; }
+  bool enabled() const          { return enabled_; }
+
+  void* allocate(size_t bytes, size_t align)
+  {
+    if (!enabled_)
+      return checked(std::malloc(bytes));
+
+    size_t offset = (used_ + align - 1) & ~(align - 1);
+    if (offset + bytes <= capacity_)
+    {
+      used_ = offset + bytes;
+      peak_ = std::max(peak_, used_);
+      return buffer_ + offset;
+    }
+
+    void* p = checked(std::malloc(bytes));
+    overflow_.push_back(p);
+    overflow_bytes_ += bytes;
+    return p;
+  }
+
+  void deallocate(void* p)
+  {
+    if (!enabled_)
+      std::free(p);
+  }
+
+  // Every pointer handed out since the last reset becomes invalid
+  void reset()
+  {
+    if (!overflow_.empty())
+    {
+      size_t needed = used_ + overflow_bytes_;
+      releaseOverflow();
+      grow(std::max(2*capacity_, needed));
+    }
+
+    used_ = 0;
+  }
+
+  size_t capacity() const { return capacity_; }
+  size_t used() const     { return used_ + overflow_bytes_; }
+  size_t peak() const     { return peak_; }
+
+  // Resets the arena when the processing of a scan returns, whichever way it does
+  class Scope : boost::noncopyable
+  {
+  public:
+    explicit Scope(ScanArena& arena): arena_(arena) { }
+    ~Scope() { arena_.reset(); }
+  private:
+    ScanArena& arena_;
+  };
+
+protected:
+  char* buffer_;
+  size_t capacity_;
+  size_t used_;
+  size_t peak_;
+
+  std::vector<void*> overflow_;
+  size_t overflow_bytes_;
+  bool enabled_;
+
+  static void* checked(void* p)
+  {
+    if (!p)
+      throw std::bad_alloc();
+    return p;
+  }
+
+  void grow(size_t capacity)
+  {
+    std::free(buffer_);
+    buffer_ = static_cast<char*>(checked(std::malloc(capacity)));
+    capacity_ = capacity;
+  }
+
+  void releaseOverflow()
+  {
+    for (size_t i=0; i < overflow_.size(); i++)
+      std::free(overflow_[i]);
+
+    overflow_.clear();
+    overflow_bytes_ = 0;
+  }
+};
+
+
+/**
+ * Standard allocator drawing from a ScanArena, for the temporary vectors of
+ * a scan (indices, corners, flags). Containers using it must not outlive the
+ * arena scope they were filled in.
+ */
+template <typename T>
+class ArenaAllocator
+{
+public:
+  typedef T         value_type;
+  typedef T*        pointer;
+  typedef const T*  const_pointer;
+  typedef T&        reference;
+  typedef const T&  const_reference;
+  typedef size_t    size_type;
+  typedef ptrdiff_t difference_type;
+
+  template <typename U>
+  struct rebind { typedef ArenaAllocator<U> other; };
+
+  explicit ArenaAllocator(ScanArena& arena): arena_(&arena) { }
+
+  template <typename U>
+  ArenaAllocator(const ArenaAllocator<U>& other): arena_(other.arena()) { }
+
+  pointer allocate(size_type n, const void* = 0)
+  {
+    return static_cast<pointer>(arena_->allocate(n*sizeof(T), boost::alignment_of<T>::value));
+  }
+
+  void deallocate(pointer p, size_type) { arena_->deallocate(p); }
+
+  void construct(pointer p, const T& value) { new (p) T(value); }
+  void destroy(pointer p)                   { p->~T(); }
+
+  pointer address(reference x) const             { return &x; }
+  const_pointer address(const_reference x) const { return &x; }
+  size_type max_size() const { return std::numeric_limits<size_type>::max()/sizeof(T); }
+
+  ScanArena* arena() const { return arena_; }
+
+  template <typename U>
+  bool operator==(const ArenaAllocator<U>& other) const { return arena_ == other.arena(); }
+  template <typename U>
+  bool operator!=(const ArenaAllocator<U>& other) const { return arena_ != other.arena(); }
+
+protected:
+  ScanArena* arena_;
+};
+
+
+/**
+ * Recycles point clouds between scans. pcl::PointCloud fixes the allocator of
+ * its points, so clouds cannot live in a ScanArena; instead the pool keeps
+ * them, with their capacity, and hands them out again once nobody else holds
+ * them. Clouds kept after the scan (e.g. by a tracked cluster) are simply
+ * skipped until they are released. reset() is O(1).
+ */
+template <typename PointT>
+class CloudPool : boost::noncopyable
+{
+public:
+  typedef pcl::PointCloud<PointT> Cloud;
+  typedef typename Cloud::Ptr CloudPtr;
+
+  CloudPool():
+    next_(0),
+    enabled_(true)
+  { }
+
+  void setEnabled(bool enabled) { enabled_ = enabled; }
+
+  // An empty cloud, valid for as long as the caller holds it
+  CloudPtr acquire()
+  {
+    if (!enabled_)
+      return CloudPtr(new Cloud);
+
+    while (next_ < clouds_.size())
+    {
+      CloudPtr& c = clouds_[next_++];
+      if (!c.unique())
+        continue;
+
+      c->points.clear();
+      c->width = 0;
+      c->height = 1;
+      c->is_dense = true;
+      c->header = Cloud().header;
+      return c;
+    }
+
+    clouds_.push_back(CloudPtr(new Cloud));
+    next_ = clouds_.size();
+    return clouds_.back();
+  }
+
+  void reset() { next_ = 0; }
+  size_t size() const { return clouds_.size(); }
+
+protected:
+  std::vector<CloudPtr> clouds_;
+  size_t next_;
+  bool enabled_;
+};
+
+#endif
@@ -0,0 +1,121 @@
+#ifndef KURI_MBZIRC_CHALLENGE_2_TOOLS_STATS_REPORTER_H_
+#define KURI_MBZIRC_CHALLENGE_2_TOOLS_STATS_REPORTER_H_
+
+#include <map>
+#include <sstream>
+#include <string>
+
+#include <sys/resource.h>
+
+#include <boost/thread/mutex.hpp>
+
+#include <ros/ros.h>
+#include <diagnostic_msgs/DiagnosticArray.h>
+
+/**
+ * Collects named runtime statistics (rates, latencies, counters) and publishes
+ * them as a single DiagnosticStatus on /diagnostics at a fixed period.
+ * Values can be set from any thread; publishIfDue() is cheap when not due.
+ * Every report also carries cpu_percent, the CPU time of the whole node
+ * (all threads, user and system) over the wall time since the last report.
+ */
+class StatsReporter
+{
+protected:
+  std::string name_;
+  ros::Publisher pub_;
+  ros::WallDuration period_;
+  ros::WallTime last_publish_;
+  ros::WallTime last_cpu_wall_;
+  double last_cpu_time_;
+  std::map<std::string, double> values_;
+  boost::mutex mutex_;
+
+public:
+  StatsReporter(const std::string& name, double period = 1.0):
+    name_(name),
+    period_(period),
+    last_publish_(ros::WallTime::now()),
+    last_cpu_wall_(last_publish_),
+    last_cpu_time_(cpuTime())
+  {
+    ros::NodeHandle nh;
+    pub_ = nh.advertise<diagnostic_msgs::DiagnosticArray>("/diagnostics", 10);
+  }
+
+  void set(const std::string& key, double value)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    values_[key] = value;
+  }
+
+  void increment(const std::string& key, double value = 1)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    values_[key] += value;
+  }
+
+  double get(const std::string& key)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return values_[key];
+  }
+
+  // Seconds of CPU used by the process so far
+  static double cpuTime()
+  {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+      return 0;
+
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec
+        + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec)*1e-6;
+  }
+
+  void publishIfDue()
+  {
+    ros::WallTime now = ros::WallTime::now();
+    if (now - last_publish_ < period_)
+      return;
+
+    last_publish_ = now;
+    publish();
+  }
+
+  void publish()
+  {
+    ros::WallTime now = ros::WallTime::now();
+    double cpu_time = cpuTime();
+    double wall = (now - last_cpu_wall_).toSec();
+    if (wall > 0)
+      set("cpu_percent", 100*(cpu_time - last_cpu_time_)/wall);
+    last_cpu_wall_ = now;
+    last_cpu_time_ = cpu_time;
+
+    diagnostic_msgs::DiagnosticArray msg;
+    diagnostic_msgs::DiagnosticStatus status;
+    status.level = diagnostic_msgs::DiagnosticStatus::OK;
+    status.name = name_;
+    status.hardware_id = ros::this_node::getName();
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      for (std::map<std::string, double>::const_iterator it = values_.begin(); it != values_.end(); ++it)
+      {
+        diagnostic_msgs::KeyValue kv;
+        std::ostringstream ss;
+        ss << it->second;
+
+        kv.key = it->first;
+        kv.value = ss.str();
+        status.values.push_back(kv);
+      }
+    }
+
+    msg.header.stamp = ros::Time::now();
+    msg.status.push_back(status);
+    pub_.publish(msg);
+  }
+};
+
+#endif
@@ -0,0 +1,177 @@
+#ifndef KURI_MBZIRC_CHALLENGE_2_TOOLS_VISUALIZATION_SINK_H_
+#define KURI_MBZIRC_CHALLENGE_2_TOOLS_VISUALIZATION_SINK_H_
+
+#include <stdint.h>
+#include <algorithm>
+#include <vector>
+
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+class VisualizationChannelBase
+{
+public:
+  virtual ~VisualizationChannelBase() { }
+  virtual void flush() = 0;
+};
+
+
+/**
+ * Pending state of one visualization topic.
+ *
+ * The perception thread posts compact state (shared pointers to clouds it
+ * already has, a few poses) and the sink thread turns it into a message
+ * later. Only the newest state is kept; a replaced one counts as dropped.
+ */
+template <typename State>
+class VisualizationChannel : public VisualizationChannelBase, boost::noncopyable
+{
+public:
+  typedef boost::function<uint32_t ()> SubscriberCount;
+  typedef boost::function<void (const State&)> Publish;
+
+  VisualizationChannel(const SubscriberCount& subscribers, const Publish& publish):
+    subscribers_(subscribers),
+    publish_(publish),
+    pending_(false),
+    dropped_(0)
+  { }
+
+  // Lets callers skip even building their state when nobody is listening
+  bool wanted() const { return subscribers_() > 0; }
+
+  void post(const State& state)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    if (pending_)
+      dropped_++;
+
+    state_ = state;
+    pending_ = true;
+  }
+
+  uint64_t dropped()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return dropped_;
+  }
+
+  // Called by the sink thread
+  void flush()
+  {
+    State state;
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      if (!pending_)
+        return;
+
+      std::swap(state, state_);
+      pending_ = false;
+    }
+
+    if (wanted())
+      publish_(state);
+  }
+
+protected:
+  SubscriberCount subscribers_;
+  Publish publish_;
+
+  boost::mutex mutex_;
+  State state_;
+  bool pending_;
+  uint64_t dropped_;
+};
+
+
+/**
+ * Background thread that publishes the visualization channels at no more
+ * than max_rate, so building and serializing markers and clouds never adds
+ * to the latency of the perception callbacks, whether RViz is open or not.
+ */
+class VisualizationSink : boost::noncopyable
+{
+public:
+  explicit VisualizationSink(double max_rate = 10.0):
+    max_rate_(max_rate),
+    running_(true)
+  {
+    thread_ = boost::thread(&VisualizationSink::run, this);
+  }
+
+  ~VisualizationSink()
+  {
+    stop();
+  }
+
+  template <typename State>
+  boost::shared_ptr<VisualizationChannel<State> > addChannel(
+      const typename VisualizationChannel<State>::SubscriberCount& subscribers,
+      const typename VisualizationChannel<State>::Publish& publish)
+  {
+    boost::shared_ptr<VisualizationChannel<State> > channel (new VisualizationChannel<State>(subscribers, publish));
+
+    boost::mutex::scoped_lock lock(mutex_);
+    channels_.push_back(channel);
+    return channel;
+  }
+
+  void setMaxRate(double max_rate)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    max_rate_ = max_rate;
+  }
+
+  // Publishers used by the channels must outlive the sink, or be stopped first
+  void stop()
+  {
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      running_ = false;
+    }
+    cond_.notify_all();
+
+    if (thread_.joinable())
+      thread_.join();
+  }
+
+protected:
+  std::vector<boost::shared_ptr<VisualizationChannelBase> > channels_;
+  double max_rate_;
+  bool running_;
+
+  boost::mutex mutex_;
+  boost::condition_variable cond_;
+  boost::thread thread_;
+
+  void run()
+  {
+    std::vector<boost::shared_ptr<VisualizationChannelBase> > channels;
+
+    for (;;)
+    {
+      boost::system_time next;
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        if (!running_)
+          return;
+
+        channels = channels_;
+        next = boost::get_system_time() + boost::posix_time::microseconds(int64_t(1e6/std::max(max_rate_, 0.1)));
+      }
+
+      for (size_t i=0; i < channels.size(); i++)
+        channels[i]->flush();
+
+      boost::mutex::scoped_lock lock(mutex_);
+      while (running_ && boost::get_system_time() < next)
+        cond_.timed_wait(lock, next);
+    }
+  }
+};
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef KURI_MBZIRC_CHALLENGE_2_TOOLS_VISUALIZATION_VIEWS_H_
+#define KURI_MBZIRC_CHALLENGE_2_TOOLS_VISUALIZATION_VIEWS_H_
+
+#include <string>
+#include <vector>
+
+#include <ros/ros.h>
+#include <geometry_msgs/Point.h>
+#include <geometry_msgs/PoseArray.h>
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+#include <pcl_conversions/pcl_conversions.h>
+#include <sensor_msgs/PointCloud2.h>
+#include <visualization_msgs/Marker.h>
+
+/**
+ * States posted to a VisualizationSink by the perception code, and the
+ * functions the sink thread builds and publishes their messages with. Bind
+ * the publisher when adding the channel, e.g.
+ *   sink.addChannel<PointsView>(subscribers, boost::bind(publishPointsView, boost::cref(pub), _1));
+ */
+struct ClustersView
+{
+  std::vector<pcl::PointCloud<pcl::PointXYZ>::Ptr> clusters;
+  std::string frame_id;
+  ros::Time stamp;
+};
+
+struct PointsView
+{
+  std::vector<geometry_msgs::Point> points;
+  std::string frame_id;
+  ros::Time stamp;
+};
+
+// All clusters go out as a single cloud
+inline void publishClustersView(const ros::Publisher& pub, const ClustersView& view)
+{
+  pcl::PointCloud<pcl::PointXYZ> merged;
+  for (size_t i=0; i < view.clusters.size(); i++)
+    merged += *view.clusters[i];
+
+  sensor_msgs::PointCloud2 cloud_cluster_msg;
+  pcl::toROSMsg(merged, cloud_cluster_msg);
+  cloud_cluster_msg.header.frame_id = view.frame_id;
+  cloud_cluster_msg.header.stamp = view.stamp;
+  pub.publish(cloud_cluster_msg);
+}
+
+inline void publishPointsView(const ros::Publisher& pub, const PointsView& view)
+{
+  visualization_msgs::Marker marker_msg;
+  marker_msg.header.frame_id = view.frame_id;
+  marker_msg.header.stamp = view.stamp;
+  marker_msg.type = marker_msg.POINTS;
+
+  marker_msg.scale.x = 0.05;
+  marker_msg.scale.y = 0.05;
+  marker_msg.color.a = 1.0;
+  marker_msg.color.g = 1.0;
+
+  marker_msg.points = view.points;
+
+  pub.publish(marker_msg);
+}
+
+inline void publishPosesView(const ros::Publisher& pub, const geometry_msgs::PoseArray& view)
+{
+  pub.publish(view);
+}
+
+#endif
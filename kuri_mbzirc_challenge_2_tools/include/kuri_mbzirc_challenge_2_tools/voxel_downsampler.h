@@ -0,0 +1,243 @@
+#ifndef KURI_MBZIRC_CHALLENGE_2_TOOLS_VOXEL_DOWNSAMPLER_H_
+#define KURI_MBZIRC_CHALLENGE_2_TOOLS_VOXEL_DOWNSAMPLER_H_
+
+#include <stdint.h>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include <pcl/point_cloud.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/**
+ * Linear time voxel grid filter, a drop-in for pcl::VoxelGrid on XYZ clouds.
+ *
+ * Points are binned with an open addressing hash table on their integer leaf
+ * coordinates instead of sorting the whole cloud, so there is no limit on
+ * the extent of the cloud relative to the leaf size (pcl::VoxelGrid refuses
+ * leaf sizes whose grid overflows 32 bit indices). The table and the voxel
+ * accumulators keep their capacity between calls.
+ *
+ * CENTROID outputs the mean position of each voxel, with the other fields
+ * of its first point. FIRST_POINT keeps the first point of each voxel as is.
+ *
+ * Large clouds are split by hash among the OpenMP threads, each owning the
+ * voxels of its shard. The key pass lists the points of each shard, so a
+ * shard only walks its own points. The output order is by first point
+ * within a shard.
+ */
+class VoxelDownsampler
+{
+public:
+  enum Mode
+  {
+    CENTROID,
+    FIRST_POINT
+  };
+
+  VoxelDownsampler():
+    leaf_size_(0.1),
+    mode_(CENTROID),
+    parallel_min_points_(50000)
+  { }
+
+  void setLeafSize(double leaf_size)            { leaf_size_ = leaf_size; }
+  void setMode(Mode mode)                       { mode_ = mode; }
+
+  // Clouds smaller than this are processed by the calling thread only
+  void setParallelMinPoints(size_t num_points)  { parallel_min_points_ = num_points; }
+
+  double getLeafSize() const { return leaf_size_; }
+
+  // cloud_out must be a different cloud than cloud_in
+  template <typename PointT>
+  void filter(const pcl::PointCloud<PointT>& cloud_in, pcl::PointCloud<PointT>& cloud_out)
+  {
+    int n = cloud_in.points.size();
+    double inv_leaf = 1.0/leaf_size_;
+
+    int num_shards = 1;
+#ifdef _OPENMP
+    if ((size_t) n >= parallel_min_points_)
+      num_shards = omp_get_max_threads();
+#endif
+
+    if (shards_.size() < (size_t) num_shards)
+      shards_.resize(num_shards);
+
+    if (buckets_.size() < (size_t) (num_shards*num_shards))
+      buckets_.resize(num_shards*num_shards);
+
+    // Leaf coordinates of every point. Each contiguous chunk of the cloud lists
+    // its points by shard in buckets_[chunk*num_shards + shard], in cloud order.
+    keys_.resize(n);
+
+    #pragma omp parallel for schedule(static, 1) if(num_shards > 1)
+    for (int c=0; c < num_shards; c++)
+    {
+      std::vector<int>* chunk_buckets = &buckets_[c*num_shards];
+      for (int s=0; s < num_shards; s++)
+        chunk_buckets[s].clear();
+
+      int begin = int(int64_t(n)*c/num_shards);
+      int end = int(int64_t(n)*(c + 1)/num_shards);
+
+      for (int i=begin; i < end; i++)
+      {
+        const PointT& p = cloud_in.points[i];
+        if (!std::isfinite(p.x) || !std::isfinite(p.y) || !std::isfinite(p.z))
+          continue;
+
+        LeafKey& k = keys_[i];
+        k.x = (int32_t) std::floor(p.x*inv_leaf);
+        k.y = (int32_t) std::floor(p.y*inv_leaf);
+        k.z = (int32_t) std::floor(p.z*inv_leaf);
+        k.hash = hashKey(k);
+        chunk_buckets[(k.hash >> 24) % num_shards].push_back(i);
+      }
+    }
+
+    // Each shard bins its own points
+    #pragma omp parallel for schedule(static, 1) if(num_shards > 1)
+    for (int s=0; s < num_shards; s++)
+      shards_[s].bin(cloud_in, keys_, buckets_, s, num_shards);
+
+    // Output
+    size_t num_voxels = 0;
+    for (int s=0; s < num_shards; s++)
+      num_voxels += shards_[s].voxels.size();
+
+    cloud_out.header = cloud_in.header;
+    cloud_out.points.resize(num_voxels);
+
+    size_t offset = 0;
+    for (int s=0; s < num_shards; s++)
+    {
+      const std::vector<Voxel>& voxels = shards_[s].voxels;
+      for (size_t v=0; v < voxels.size(); v++)
+      {
+        PointT& p = cloud_out.points[offset + v];
+        p = cloud_in.points[ voxels[v].first ];
+
+        if (mode_ == CENTROID)
+        {
+          p.x = voxels[v].sum_x/voxels[v].count;
+          p.y = voxels[v].sum_y/voxels[v].count;
+          p.z = voxels[v].sum_z/voxels[v].count;
+        }
+      }
+      offset += voxels.size();
+    }
+
+    cloud_out.width = cloud_out.points.size();
+    cloud_out.height = 1;
+    cloud_out.is_dense = true;
+  }
+
+protected:
+  struct LeafKey
+  {
+    int32_t x, y, z;
+    uint32_t hash;
+  };
+
+  struct Voxel
+  {
+    double sum_x, sum_y, sum_z;
+    int count;
+    int first;
+  };
+
+  struct Shard
+  {
+    std::vector<int> slots;       // Index into voxels, -1 when empty
+    std::vector<Voxel> voxels;
+
+    // Points of the shard are buckets[c*num_shards + shard] for every chunk c
+    template <typename PointT>
+    void bin(const pcl::PointCloud<PointT>& cloud, const std::vector<LeafKey>& keys,
+             const std::vector<std::vector<int> >& buckets, int shard, int num_shards)
+    {
+      voxels.clear();
+
+      // At most one voxel per point, so a table twice that size stays half full
+      size_t num_points = 0;
+      for (int c=0; c < num_shards; c++)
+        num_points += buckets[c*num_shards + shard].size();
+
+      size_t capacity = 16;
+      while (capacity < 2*num_points)
+        capacity *= 2;
+
+      slots.assign(capacity, -1);
+      size_t mask = capacity - 1;
+
+      for (int c=0; c < num_shards; c++)
+      {
+        const std::vector<int>& points = buckets[c*num_shards + shard];
+        for (size_t j=0; j < points.size(); j++)
+          insert(cloud, keys, points[j], mask);
+      }
+    }
+
+    template <typename PointT>
+    void insert(const pcl::PointCloud<PointT>& cloud, const std::vector<LeafKey>& keys, int i, size_t mask)
+    {
+      const LeafKey& k = keys[i];
+      const PointT& p = cloud.points[i];
+
+      size_t slot = k.hash & mask;
+      for (;;)
+      {
+        int v = slots[slot];
+        if (v < 0)
+        {
+          Voxel voxel;
+          voxel.sum_x = p.x;
+          voxel.sum_y = p.y;
+          voxel.sum_z = p.z;
+          voxel.count = 1;
+          voxel.first = i;
+
+          slots[slot] = voxels.size();
+          voxels.push_back(voxel);
+          break;
+        }
+
+        const LeafKey& other = keys[ voxels[v].first ];
+        if (other.x == k.x && other.y == k.y && other.z == k.z)
+        {
+          voxels[v].sum_x += p.x;
+          voxels[v].sum_y += p.y;
+          voxels[v].sum_z += p.z;
+          voxels[v].count++;
+          break;
+        }
+
+        slot = (slot + 1) & mask;
+      }
+    }
+  };
+
+  double leaf_size_;
+  Mode   mode_;
+  size_t parallel_min_points_;
+
+  std::vector<LeafKey> keys_;
+  std::vector<std::vector<int> > buckets_;   // Points of each chunk and shard
+  std::vector<Shard> shards_;
+
+  static uint32_t hashKey(const LeafKey& k)
+  {
+    uint32_t h = uint32_t(k.x)*0x8da6b343U ^ uint32_t(k.y)*0xd8163841U ^ uint32_t(k.z)*0xcb1ab31fU;
+    h ^= h >> 16;  h *= 0x7feb352dU;
+    h ^= h >> 15;  h *= 0x846ca68bU;
+    h ^= h >> 16;
+    return h;
+  }
+};
+
+#endif
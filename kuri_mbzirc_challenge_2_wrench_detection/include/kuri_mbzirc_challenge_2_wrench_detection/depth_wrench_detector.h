@@ -0,0 +1,304 @@
+#ifndef KURI_MBZIRC_CHALLENGE_2_WRENCH_DETECTION_DEPTH_WRENCH_DETECTOR_H_
+#define KURI_MBZIRC_CHALLENGE_2_WRENCH_DETECTION_DEPTH_WRENCH_DETECTOR_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include <geometry_msgs/Point.h>
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+#include <sensor_msgs/CameraInfo.h>
+#include <sensor_msgs/Image.h>
+#include <sensor_msgs/image_encodings.h>
+
+#include <kuri_mbzirc_challenge_2_wrench_detection/plane_segmentation.h>
+#include <kuri_mbzirc_challenge_2_wrench_detection/plane_tracker.h>
+
+struct DepthWrenchResult
+{
+  bool found;
+  PlaneSegmentationResult plane;   // On the decimated grid
+
+  // Full resolution mask of wrench pixels, and its bounding box
+  uint32_t width, height;
+  std::vector<uint8_t> wrench_mask;
+  int wrench_count;
+  int roi_x, roi_y, roi_width, roi_height;
+
+  // Back-projected wrench pixels, in the depth optical frame
+  std::vector<geometry_msgs::Point> roi_points;
+
+  DepthWrenchResult():
+    found(false), width(0), height(0), wrench_count(0),
+    roi_x(0), roi_y(0), roi_width(0), roi_height(0)
+  { }
+};
+
+
+/**
+ * Wrench ROI extraction straight from a depth image (little-endian 16UC1 in mm
+ * or 32FC1 in m) and the camera intrinsics, without building a full point cloud.
+ *
+ * The panel plane is found on a grid decimated by grid_step_ pixels. Inside
+ * the pixel extent of the panel, the signed plane distance of each full
+ * resolution pixel is z*(a[u] + b[v]) + d, with a and b precomputed per
+ * column and row, so only the pixels that end up in the wrench ROI are
+ * back-projected.
+ */
+class DepthWrenchDetector
+{
+public:
+  DepthWrenchDetector():
+    has_camera_info_(false),
+    grid_step_(8),
+    wrench_min_offset_(0.01),
+    wrench_max_offset_(0.20),
+    grid_(new pcl::PointCloud<pcl::PointXYZ>)
+  {
+    // The decimated grid has far fewer points than the Kinect cloud
+    tracker_.segmenter().setMinPlaneInliers(100);
+  }
+
+  void setCameraInfo(const sensor_msgs::CameraInfo& info)
+  {
+    fx_ = info.K[0];
+    fy_ = info.K[4];
+    cx_ = info.K[2];
+    cy_ = info.K[5];
+    has_camera_info_ = (fx_ > 0 && fy_ > 0);
+  }
+
+  bool hasCameraInfo() { return has_camera_info_; }
+
+  void setGridStep(int step) { grid_step_ = std::max(1, step); }
+  void setWrenchOffsets(double min_offset, double max_offset)
+  {
+    wrench_min_offset_ = min_offset;
+    wrench_max_offset_ = max_offset;
+  }
+
+  PlaneTracker<pcl::PointXYZ>& tracker() { return tracker_; }
+
+  static bool isSupportedEncoding(const std::string& encoding)
+  {
+    return encoding == sensor_msgs::image_encodings::TYPE_16UC1
+        || encoding == sensor_msgs::image_encodings::TYPE_32FC1;
+  }
+
+  // Supported encoding, in little-endian byte order
+  static bool isSupported(const sensor_msgs::Image& depth)
+  {
+    return isSupportedEncoding(depth.encoding) && !depth.is_bigendian;
+  }
+
+  bool detect(const sensor_msgs::Image& depth, DepthWrenchResult& result, bool track_plane = true)
+  {
+    result.found = false;
+    result.roi_points.clear();
+    result.wrench_count = 0;
+    result.width = depth.width;
+    result.height = depth.height;
+    result.wrench_mask.assign(depth.width*depth.height, MASK_CLEAR);
+    result.roi_x = result.roi_y = result.roi_width = result.roi_height = 0;
+
+    if (!has_camera_info_ || !isSupported(depth))
+      return false;
+
+    // The encoding is resolved once per frame, so the pixel loops read a single type
+    if (depth.encoding == sensor_msgs::image_encodings::TYPE_16UC1)
+      return detectTyped<uint16_t>(depth, result, track_plane);
+    return detectTyped<float>(depth, result, track_plane);
+  }
+
+  // Copy a rectangle of an image, keeping its encoding
+  static void cropImage(const sensor_msgs::Image& in, int x, int y, int width, int height, sensor_msgs::Image& out)
+  {
+    int bytes_per_pixel = sensor_msgs::image_encodings::numChannels(in.encoding)
+                        * sensor_msgs::image_encodings::bitDepth(in.encoding)/8;
+
+    out.header = in.header;
+    out.encoding = in.encoding;
+    out.is_bigendian = in.is_bigendian;
+    out.width = width;
+    out.height = height;
+    out.step = width*bytes_per_pixel;
+    out.data.resize(out.step*height);
+
+    for (int r=0; r < height; r++)
+      std::memcpy(&out.data[r*out.step], &in.data[(y + r)*in.step + x*bytes_per_pixel], out.step);
+  }
+
+protected:
+  bool   has_camera_info_;
+  double fx_, fy_, cx_, cy_;
+  int    grid_step_;
+  double wrench_min_offset_;
+  double wrench_max_offset_;
+
+  PlaneTracker<pcl::PointXYZ> tracker_;
+  pcl::PointCloud<pcl::PointXYZ>::Ptr grid_;
+  std::vector<double> col_term_;
+  std::vector<double> row_term_;
+
+  template <typename DepthT>
+  bool detectTyped(const sensor_msgs::Image& depth, DepthWrenchResult& result, bool track_plane)
+  {
+    // ============
+    // Plane on the decimated grid
+    // ============
+    int gw = depth.width/grid_step_;
+    int gh = depth.height/grid_step_;
+    int offset = grid_step_/2;
+
+    grid_->width = gw;
+    grid_->height = gh;
+    grid_->is_dense = false;
+    grid_->points.resize(gw*gh);
+
+    for (int gv=0; gv < gh; gv++)
+    {
+      for (int gu=0; gu < gw; gu++)
+      {
+        int u = gu*grid_step_ + offset;
+        int v = gv*grid_step_ + offset;
+        grid_->points[gv*gw + gu] = backProject(u, v, readDepth<DepthT>(depth, u, v));
+      }
+    }
+
+    pcl::PointCloud<pcl::PointXYZ>::ConstPtr grid = grid_;
+    if (track_plane)
+      tracker_.segment(grid, result.plane);
+    else
+      tracker_.segmenter().segment(grid, result.plane);
+
+    if (!result.plane.found || result.plane.coefficients.values.size() < 4)
+      return false;
+
+    // Normalize, with the normal towards the camera so that the wrenches are at positive distance
+    double a = result.plane.coefficients.values[0];
+    double b = result.plane.coefficients.values[1];
+    double c = result.plane.coefficients.values[2];
+    double d = result.plane.coefficients.values[3];
+    double norm = std::sqrt(a*a + b*b + c*c);
+    if (d < 0)
+      norm = -norm;
+
+    a /= norm; b /= norm; c /= norm; d /= norm;
+
+    // Pixel extent of the panel, from the grid inliers
+    int u_min = depth.width, u_max = -1, v_min = depth.height, v_max = -1;
+    const std::vector<int>& inliers = result.plane.inliers.indices;
+    for (size_t i=0; i < inliers.size(); i++)
+    {
+      int gu = inliers[i] % gw;
+      int gv = inliers[i] / gw;
+      u_min = std::min(u_min, gu*grid_step_);
+      u_max = std::max(u_max, (gu+1)*grid_step_ - 1);
+      v_min = std::min(v_min, gv*grid_step_);
+      v_max = std::max(v_max, (gv+1)*grid_step_ - 1);
+    }
+
+    if (u_max < 0)
+      return false;
+
+    u_max = std::min<int>(u_max, depth.width-1);
+    v_max = std::min<int>(v_max, depth.height-1);
+
+    // ============
+    // Full resolution pass over the panel extent
+    // ============
+    col_term_.resize(depth.width);
+    row_term_.resize(depth.height);
+    for (int u=u_min; u <= u_max; u++)
+      col_term_[u] = a*(u - cx_)/fx_ + c;
+    for (int v=v_min; v <= v_max; v++)
+      row_term_[v] = b*(v - cy_)/fy_;
+
+    int roi_u_min = depth.width, roi_u_max = -1, roi_v_min = depth.height, roi_v_max = -1;
+
+    for (int v=v_min; v <= v_max; v++)
+    {
+      for (int u=u_min; u <= u_max; u++)
+      {
+        float z = readDepth<DepthT>(depth, u, v);
+        if (!pcl_isfinite(z))
+          continue;
+
+        double dist = z*(col_term_[u] + row_term_[v]) + d;
+        if (dist <= wrench_min_offset_ || dist >= wrench_max_offset_)
+          continue;
+
+        result.wrench_mask[v*depth.width + u] = MASK_SET;
+        result.wrench_count++;
+
+        roi_u_min = std::min(roi_u_min, u);
+        roi_u_max = std::max(roi_u_max, u);
+        roi_v_min = std::min(roi_v_min, v);
+        roi_v_max = std::max(roi_v_max, v);
+
+        pcl::PointXYZ p = backProject(u, v, z);
+        geometry_msgs::Point pt;
+        pt.x = p.x;
+        pt.y = p.y;
+        pt.z = p.z;
+        result.roi_points.push_back(pt);
+      }
+    }
+
+    if (result.wrench_count == 0)
+      return false;
+
+    result.roi_x = roi_u_min;
+    result.roi_y = roi_v_min;
+    result.roi_width  = roi_u_max - roi_u_min + 1;
+    result.roi_height = roi_v_max - roi_v_min + 1;
+    result.found = true;
+
+    return true;
+  }
+
+  // Depth in meters, NaN when invalid
+  static inline float toMeters(uint16_t mm)
+  {
+    if (mm == 0)
+      return std::numeric_limits<float>::quiet_NaN();
+    return mm*0.001f;
+  }
+
+  static inline float toMeters(float m)
+  {
+    if (m <= 0)
+      return std::numeric_limits<float>::quiet_NaN();
+    return m;
+  }
+
+  template <typename DepthT>
+  static inline float readDepth(const sensor_msgs::Image& depth, int u, int v)
+  {
+    DepthT raw;
+    std::memcpy(&raw, &depth.data[v*depth.step + u*sizeof(DepthT)], sizeof(DepthT));
+    return toMeters(raw);
+  }
+
+  inline pcl::PointXYZ backProject(int u, int v, float z)
+  {
+    pcl::PointXYZ p;
+    if (!pcl_isfinite(z))
+    {
+      p.x = p.y = p.z = std::numeric_limits<float>::quiet_NaN();
+      return p;
+    }
+
+    p.x = (u - cx_)*z/fx_;
+    p.y = (v - cy_)*z/fy_;
+    p.z = z;
+    return p;
+  }
+};
+
+#endif
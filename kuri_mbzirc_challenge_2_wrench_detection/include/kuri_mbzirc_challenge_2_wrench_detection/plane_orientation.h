@@ -0,0 +1,115 @@
+#ifndef KURI_MBZIRC_CHALLENGE_2_WRENCH_DETECTION_PLANE_ORIENTATION_H_
+#define KURI_MBZIRC_CHALLENGE_2_WRENCH_DETECTION_PLANE_ORIENTATION_H_
+
+#include <algorithm>
+#include <cmath>
+
+#include <Eigen/Dense>
+#include <Eigen/Geometry>
+#include <geometry_msgs/Pose.h>
+#include <pcl/point_cloud.h>
+
+#include <kuri_mbzirc_challenge_2_wrench_detection/plane_segmentation.h>
+
+struct PlaneOrientation
+{
+  Eigen::Vector3f normal;    // Unit normal, pointing out of the panel towards the camera
+  Eigen::Vector3f centroid;  // Mean of the sampled plane inliers
+  double theta;              // Angle between the normal and the camera optical axis (rad)
+  double inlier_ratio;       // Plane points over valid points, estimated from the sample
+  double rms_residual;       // Distance of the sampled inliers to the plane (m)
+  double confidence;         // [0, 1]
+
+  PlaneOrientation():
+    normal(Eigen::Vector3f::Zero()), centroid(Eigen::Vector3f::Zero()),
+    theta(0), inlier_ratio(0), rms_residual(0), confidence(0)
+  { }
+};
+
+
+/**
+ * Orientation of the segmented panel taken directly from the plane
+ * coefficients. A strided sample of at most max_samples pixels gives the
+ * centroid, the inlier ratio and the fit residual, so the cost does not depend
+ * on the cloud size.
+ *
+ * confidence = coverage * fit, where coverage saturates once half of the valid
+ * points lie on the plane and fit = exp(-(rms / distance_threshold)^2).
+ */
+template <typename PointT>
+bool computePlaneOrientation(const pcl::PointCloud<PointT>& cloud,
+                             const PlaneSegmentationResult& result,
+                             double distance_threshold,
+                             PlaneOrientation& orientation,
+                             int max_samples = 500)
+{
+  orientation = PlaneOrientation();
+
+  if (!result.found || result.coefficients.values.size() < 4 || cloud.points.empty())
+    return false;
+
+  Eigen::Vector4f model(result.coefficients.values[0], result.coefficients.values[1],
+                        result.coefficients.values[2], result.coefficients.values[3]);
+  model /= model.head<3>().norm();
+
+  // Camera at the origin: d > 0 means the normal points towards it
+  if (model[3] < 0)
+    model = -model;
+
+  size_t n = cloud.points.size();
+  size_t step = std::max<size_t>(1, n/max_samples);
+  bool has_mask = (result.plane_mask.size() == n);
+
+  int valid = 0, inliers = 0;
+  double sum_sq = 0;
+  Eigen::Vector3f sum = Eigen::Vector3f::Zero();
+
+  for (size_t i = step/2; i < n; i += step)
+  {
+    const PointT& p = cloud.points[i];
+    if (!pcl_isfinite(p.z))
+      continue;
+
+    valid++;
+
+    float dist = model[0]*p.x + model[1]*p.y + model[2]*p.z + model[3];
+    bool on_plane = has_mask ? (result.plane_mask[i] == MASK_SET) : (std::fabs(dist) < distance_threshold);
+    if (!on_plane)
+      continue;
+
+    inliers++;
+    sum_sq += dist*dist;
+    sum += Eigen::Vector3f(p.x, p.y, p.z);
+  }
+
+  if (inliers == 0)
+    return false;
+
+  orientation.normal = model.head<3>();
+  orientation.centroid = sum/inliers;
+  orientation.theta = std::acos(std::min(1.0f, std::max(-1.0f, -orientation.normal[2])));
+  orientation.inlier_ratio = double(inliers)/valid;
+  orientation.rms_residual = std::sqrt(sum_sq/inliers);
+
+  double coverage = std::min(1.0, orientation.inlier_ratio/0.5);
+  double fit_error = orientation.rms_residual/distance_threshold;
+  orientation.confidence = coverage*std::exp(-fit_error*fit_error);
+
+  return true;
+}
+
+// Pose at the plane centroid whose z-axis is the outward plane normal
+static inline void planeOrientationToPose(const PlaneOrientation& orientation, geometry_msgs::Pose& pose)
+{
+  Eigen::Quaternionf q = Eigen::Quaternionf::FromTwoVectors(Eigen::Vector3f::UnitZ(), orientation.normal);
+
+  pose.position.x = orientation.centroid[0];
+  pose.position.y = orientation.centroid[1];
+  pose.position.z = orientation.centroid[2];
+  pose.orientation.x = q.x();
+  pose.orientation.y = q.y();
+  pose.orientation.z = q.z();
+  pose.orientation.w = q.w();
+}
+
+#endif
@@ -0,0 +1,245 @@
+#ifndef KURI_MBZIRC_CHALLENGE_2_WRENCH_DETECTION_PLANE_SEGMENTATION_H_
+#define KURI_MBZIRC_CHALLENGE_2_WRENCH_DETECTION_PLANE_SEGMENTATION_H_
+
+#include <cmath>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+#include <pcl/ModelCoefficients.h>
+#include <pcl/PointIndices.h>
+#include <pcl/features/integral_image_normal.h>
+#include <pcl/sample_consensus/method_types.h>
+#include <pcl/sample_consensus/model_types.h>
+#include <pcl/segmentation/organized_multi_plane_segmentation.h>
+#include <pcl/segmentation/sac_segmentation.h>
+#include <sensor_msgs/Image.h>
+#include <sensor_msgs/image_encodings.h>
+
+// Values written into the image-indexed masks
+const uint8_t MASK_SET   = 255;
+const uint8_t MASK_CLEAR = 0;
+
+enum PlaneSegmentationMode
+{
+  SEGMENTATION_RANSAC,     // SACSegmentation over the whole cloud
+  SEGMENTATION_ORGANIZED   // Integral image normals + organized multi-plane segmentation
+};
+
+struct PlaneSegmentationResult
+{
+  bool found;
+  pcl::ModelCoefficients coefficients;
+  pcl::PointIndices      inliers;
+
+  // Image-indexed buffers (width*height, row major), one byte per pixel
+  uint32_t width, height;
+  std::vector<uint8_t> plane_mask;
+  std::vector<uint8_t> wrench_mask;
+  int wrench_count;
+
+  PlaneSegmentationResult():
+    found(false), width(0), height(0), wrench_count(0)
+  { }
+};
+
+
+/**
+ * Finds the panel plane in a Kinect cloud and splits the cloud into plane and
+ * off-plane (wrench) masks that keep the pixel layout of the depth image.
+ *
+ * SEGMENTATION_RANSAC reproduces the original behaviour of the wrench nodes.
+ * SEGMENTATION_ORGANIZED requires an organized cloud and uses the pixel
+ * adjacency to avoid the global RANSAC search.
+ */
+template <typename PointT>
+class PlaneSegmenter
+{
+public:
+  typedef pcl::PointCloud<PointT> Cloud;
+  typedef typename Cloud::ConstPtr CloudConstPtr;
+
+  PlaneSegmenter():
+    mode_(SEGMENTATION_RANSAC),
+    distance_threshold_(0.01),
+    wrench_min_offset_(0.01),
+    wrench_max_offset_(0.20),
+    angular_threshold_(3.0*M_PI/180),
+    min_plane_inliers_(5000),
+    max_depth_change_(0.02),
+    normal_smoothing_(10.0)
+  { }
+
+  static bool parseMode(const std::string& name, PlaneSegmentationMode& mode)
+  {
+    if (name == "ransac")
+      mode = SEGMENTATION_RANSAC;
+    else if (name == "organized")
+      mode = SEGMENTATION_ORGANIZED;
+    else
+      return false;
+
+    return true;
+  }
+
+  void setMode(PlaneSegmentationMode mode) { mode_ = mode; }
+  PlaneSegmentationMode getMode() { return mode_; }
+
+  void setDistanceThreshold(double d)  { distance_threshold_ = d; }
+  double getDistanceThreshold()        { return distance_threshold_; }
+  void setWrenchOffsets(double min_offset, double max_offset)
+  {
+    wrench_min_offset_ = min_offset;
+    wrench_max_offset_ = max_offset;
+  }
+  void setMinPlaneInliers(int n)       { min_plane_inliers_ = n; }
+  void setAngularThreshold(double rad) { angular_threshold_ = rad; }
+
+  bool segment(const CloudConstPtr& cloud, PlaneSegmentationResult& result)
+  {
+    result.found = false;
+    result.inliers.indices.clear();
+    result.coefficients.values.clear();
+
+    if (mode_ == SEGMENTATION_ORGANIZED && cloud->isOrganized())
+      result.found = segmentOrganized(cloud, result);
+    else
+      result.found = segmentRansac(cloud, result);
+
+    fillMasks(cloud, result);
+    return result.found;
+  }
+
+  /**
+   * Rebuild the plane/wrench masks from result.coefficients and result.inliers.
+   * Wrench pixels are valid points in front of the plane (camera side) by
+   * between wrench_min_offset_ and wrench_max_offset_.
+   */
+  void fillMasks(const CloudConstPtr& cloud, PlaneSegmentationResult& result)
+  {
+    result.width  = cloud->width;
+    result.height = cloud->height;
+    result.plane_mask.assign(cloud->points.size(), MASK_CLEAR);
+    result.wrench_mask.assign(cloud->points.size(), MASK_CLEAR);
+    result.wrench_count = 0;
+
+    if (!result.found || result.coefficients.values.size() < 4)
+      return;
+
+    for (size_t i=0; i < result.inliers.indices.size(); i++)
+      result.plane_mask[ result.inliers.indices[i] ] = MASK_SET;
+
+    // Orient the normal towards the camera (origin) so that positive distances are in front of the panel
+    float a = result.coefficients.values[0];
+    float b = result.coefficients.values[1];
+    float c = result.coefficients.values[2];
+    float d = result.coefficients.values[3];
+    float norm = std::sqrt(a*a + b*b + c*c);
+    if (d < 0)
+      norm = -norm;
+
+    a /= norm; b /= norm; c /= norm; d /= norm;
+
+    for (size_t i=0; i < cloud->points.size(); i++)
+    {
+      if (result.plane_mask[i])
+        continue;
+
+      const PointT& p = cloud->points[i];
+      if (!pcl_isfinite(p.z))
+        continue;
+
+      float dist = a*p.x + b*p.y + c*p.z + d;
+      if (dist > wrench_min_offset_ && dist < wrench_max_offset_)
+      {
+        result.wrench_mask[i] = MASK_SET;
+        result.wrench_count++;
+      }
+    }
+  }
+
+protected:
+  PlaneSegmentationMode mode_;
+  double distance_threshold_;
+  double wrench_min_offset_;
+  double wrench_max_offset_;
+  double angular_threshold_;
+  int    min_plane_inliers_;
+  double max_depth_change_;
+  double normal_smoothing_;
+
+  pcl::PointCloud<pcl::Normal>::Ptr normals_;
+
+  bool segmentRansac(const CloudConstPtr& cloud, PlaneSegmentationResult& result)
+  {
+    pcl::SACSegmentation<PointT> seg;
+    seg.setOptimizeCoefficients (true);
+    seg.setModelType (pcl::SACMODEL_PLANE);
+    seg.setMethodType (pcl::SAC_RANSAC);
+    seg.setDistanceThreshold (distance_threshold_);
+    seg.setInputCloud (cloud);
+    seg.segment (result.inliers, result.coefficients);
+
+    return result.inliers.indices.size() > 0;
+  }
+
+  bool segmentOrganized(const CloudConstPtr& cloud, PlaneSegmentationResult& result)
+  {
+    if (!normals_)
+      normals_.reset(new pcl::PointCloud<pcl::Normal>);
+
+    // Normals from integral images, O(1) per pixel
+    pcl::IntegralImageNormalEstimation<PointT, pcl::Normal> ne;
+    ne.setNormalEstimationMethod (ne.COVARIANCE_MATRIX);
+    ne.setMaxDepthChangeFactor (max_depth_change_);
+    ne.setNormalSmoothingSize (normal_smoothing_);
+    ne.setInputCloud (cloud);
+    ne.compute (*normals_);
+
+    // Region growing over neighbouring pixels with similar normals
+    std::vector<pcl::ModelCoefficients> model_coefficients;
+    std::vector<pcl::PointIndices> inlier_indices;
+
+    pcl::OrganizedMultiPlaneSegmentation<PointT, pcl::Normal, pcl::Label> mps;
+    mps.setMinInliers (min_plane_inliers_);
+    mps.setAngularThreshold (angular_threshold_);
+    mps.setDistanceThreshold (distance_threshold_);
+    mps.setInputNormals (normals_);
+    mps.setInputCloud (cloud);
+    mps.segment (model_coefficients, inlier_indices);
+
+    // The panel is the largest plane in view
+    int best = -1;
+    size_t best_size = 0;
+    for (size_t i=0; i < inlier_indices.size(); i++)
+    {
+      if (inlier_indices[i].indices.size() > best_size)
+      {
+        best_size = inlier_indices[i].indices.size();
+        best = i;
+      }
+    }
+
+    if (best < 0)
+      return false;
+
+    result.coefficients = model_coefficients[best];
+    result.inliers = inlier_indices[best];
+    return true;
+  }
+};
+
+// Wrap an image-indexed mask into a mono8 image for publishing
+static inline void maskToImageMsg(const std::vector<uint8_t>& mask, uint32_t width, uint32_t height, sensor_msgs::Image& img)
+{
+  img.width = width;
+  img.height = height;
+  img.encoding = sensor_msgs::image_encodings::MONO8;
+  img.is_bigendian = 0;
+  img.step = width;
+  img.data = mask;
+}
+
+#endif
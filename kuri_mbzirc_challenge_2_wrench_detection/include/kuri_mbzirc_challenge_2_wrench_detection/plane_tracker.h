@@ -0,0 +1,245 @@
+#ifndef KURI_MBZIRC_CHALLENGE_2_WRENCH_DETECTION_PLANE_TRACKER_H_
+#define KURI_MBZIRC_CHALLENGE_2_WRENCH_DETECTION_PLANE_TRACKER_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+
+#include <Eigen/Dense>
+#include <pcl/common/centroid.h>
+#include <ros/ros.h>
+
+#include <kuri_mbzirc_challenge_2_wrench_detection/plane_segmentation.h>
+#include <kuri_mbzirc_challenge_2_tools/stats_reporter.h>
+
+struct PlaneTrackerStats
+{
+  int frames;       // Frames processed
+  int hits;         // Frames where the previous model was verified and refined
+  int fallbacks;    // Frames that needed a full segmentation
+  int rejected_refits;   // Hits where the refit lost inliers and the seed was kept
+  double last_latency;   // Seconds
+  double mean_latency;   // Seconds, exponential moving average
+  double last_sample_ratio;
+
+  PlaneTrackerStats():
+    frames(0), hits(0), fallbacks(0), rejected_refits(0),
+    last_latency(0), mean_latency(0), last_sample_ratio(0)
+  { }
+
+  double hitRate() const
+  {
+    if (frames == 0)
+      return 0;
+    return double(hits)/frames;
+  }
+};
+
+
+inline void reportPlaneTrackerStats(const PlaneTrackerStats& s, StatsReporter* reporter)
+{
+  reporter->set("frames", s.frames);
+  reporter->set("tracker_hit_rate", s.hitRate());
+  reporter->set("tracker_fallbacks", s.fallbacks);
+  reporter->set("tracker_rejected_refits", s.rejected_refits);
+  reporter->set("latency_ms", s.last_latency*1000);
+  reporter->set("mean_latency_ms", s.mean_latency*1000);
+}
+
+
+/**
+ * Temporally tracked panel plane.
+ *
+ * The panel barely moves between Kinect frames, so each frame is seeded with
+ * the previous coefficients. The seed is verified on a strided sample of the
+ * cloud: if the fraction of sampled points close to the plane is at least
+ * verify_ratio_ times the inlier fraction of the last full segmentation, the
+ * model is refined with one linear pass (collect inliers, least-squares
+ * refit). Otherwise the tracker falls back to the full PlaneSegmenter search.
+ *
+ * The reference fraction only moves on a full segmentation, so a plane that
+ * slowly loses support still ends up being detected again. A refit with fewer
+ * inliers than the seed is discarded and the seed kept.
+ */
+template <typename PointT>
+class PlaneTracker
+{
+public:
+  typedef pcl::PointCloud<PointT> Cloud;
+  typedef typename Cloud::ConstPtr CloudConstPtr;
+
+  PlaneTracker():
+    has_model_(false),
+    sample_size_(500),
+    verify_ratio_(0.8),
+    min_inlier_ratio_(0.05),
+    distance_threshold_(0.01),
+    reference_inlier_ratio_(0)
+  { }
+
+  PlaneSegmenter<PointT>& segmenter() { return segmenter_; }
+  const PlaneTrackerStats& stats() { return stats_; }
+
+  void setSampleSize(int n)          { sample_size_ = n; }
+  void setVerifyRatio(double r)      { verify_ratio_ = r; }
+  void setDistanceThreshold(double d)
+  {
+    distance_threshold_ = d;
+    segmenter_.setDistanceThreshold(d);
+  }
+
+  void reset() { has_model_ = false; }
+
+  bool segment(const CloudConstPtr& cloud, PlaneSegmentationResult& result)
+  {
+    ros::WallTime start = ros::WallTime::now();
+    stats_.frames++;
+
+    bool tracked = false;
+    if (has_model_ && verify(cloud))
+      tracked = refine(cloud, result);
+
+    if (tracked)
+    {
+      stats_.hits++;
+      segmenter_.fillMasks(cloud, result);
+    }
+    else
+    {
+      stats_.fallbacks++;
+      segmenter_.segment(cloud, result);
+    }
+
+    // Update the seed for the next frame
+    has_model_ = result.found && result.coefficients.values.size() >= 4;
+    if (has_model_)
+    {
+      model_ = Eigen::Vector4f(result.coefficients.values[0], result.coefficients.values[1],
+                               result.coefficients.values[2], result.coefficients.values[3]);
+      model_ /= model_.head<3>().norm();
+
+      double inlier_ratio = double(result.inliers.indices.size())/cloud->points.size();
+      if (!tracked)
+        reference_inlier_ratio_ = inlier_ratio;
+
+      if (inlier_ratio < min_inlier_ratio_)
+        has_model_ = false;
+    }
+
+    stats_.last_latency = (ros::WallTime::now() - start).toSec();
+    if (stats_.frames == 1)
+      stats_.mean_latency = stats_.last_latency;
+    else
+      stats_.mean_latency = 0.9*stats_.mean_latency + 0.1*stats_.last_latency;
+
+    return result.found;
+  }
+
+protected:
+  PlaneSegmenter<PointT> segmenter_;
+  PlaneTrackerStats stats_;
+
+  bool has_model_;
+  Eigen::Vector4f model_;   // Normalized plane coefficients
+
+  int    sample_size_;
+  double verify_ratio_;
+  double min_inlier_ratio_;
+  double distance_threshold_;
+  double reference_inlier_ratio_;   // Of the last full segmentation
+  std::vector<int> refit_inliers_;
+
+  static inline float distance(const Eigen::Vector4f& model, const PointT& p)
+  {
+    return std::fabs(model[0]*p.x + model[1]*p.y + model[2]*p.z + model[3]);
+  }
+
+  // Check the previous model against a strided sample of the cloud
+  bool verify(const CloudConstPtr& cloud)
+  {
+    size_t n = cloud->points.size();
+    if (n == 0)
+      return false;
+
+    size_t step = std::max<size_t>(1, n/sample_size_);
+    size_t offset = std::rand() % step;
+
+    int sampled = 0, inliers = 0;
+    for (size_t i = offset; i < n; i += step)
+    {
+      const PointT& p = cloud->points[i];
+      sampled++;
+
+      if (!pcl_isfinite(p.z))
+        continue;
+
+      if (distance(model_, p) < distance_threshold_)
+        inliers++;
+    }
+
+    stats_.last_sample_ratio = double(inliers)/sampled;
+    return stats_.last_sample_ratio >= verify_ratio_*reference_inlier_ratio_;
+  }
+
+  // One pass to collect inliers of the seeded model, a least-squares refit,
+  // and one more pass to check that the refit keeps at least as many inliers
+  bool refine(const CloudConstPtr& cloud, PlaneSegmentationResult& result)
+  {
+    result.inliers.indices.clear();
+
+    Eigen::Matrix3f covariance;
+    Eigen::Vector4f centroid;
+
+    for (size_t i=0; i < cloud->points.size(); i++)
+    {
+      const PointT& p = cloud->points[i];
+      if (pcl_isfinite(p.z) && distance(model_, p) < distance_threshold_)
+        result.inliers.indices.push_back(i);
+    }
+
+    if (result.inliers.indices.size() < 3)
+      return false;
+
+    pcl::computeMeanAndCovarianceMatrix(*cloud, result.inliers.indices, covariance, centroid);
+
+    Eigen::SelfAdjointEigenSolver<Eigen::Matrix3f> eigen_solver(covariance);
+    Eigen::Vector3f normal = eigen_solver.eigenvectors().col(0);
+
+    // Keep the same orientation as the seed
+    if (normal.dot(model_.head<3>()) < 0)
+      normal = -normal;
+
+    Eigen::Vector4f refit(normal[0], normal[1], normal[2], -normal.dot(centroid.head<3>()));
+
+    refit_inliers_.clear();
+    for (size_t i=0; i < cloud->points.size(); i++)
+    {
+      const PointT& p = cloud->points[i];
+      if (pcl_isfinite(p.z) && distance(refit, p) < distance_threshold_)
+        refit_inliers_.push_back(i);
+    }
+
+    // Outliers pulled the refit away from the panel, the seed fits better
+    if (refit_inliers_.size() < result.inliers.indices.size())
+    {
+      stats_.rejected_refits++;
+      refit = model_;
+    }
+    else
+    {
+      result.inliers.indices.swap(refit_inliers_);
+    }
+
+    result.coefficients.values.resize(4);
+    result.coefficients.values[0] = refit[0];
+    result.coefficients.values[1] = refit[1];
+    result.coefficients.values[2] = refit[2];
+    result.coefficients.values[3] = refit[3];
+    result.found = true;
+
+    return true;
+  }
+};
+
+#endif
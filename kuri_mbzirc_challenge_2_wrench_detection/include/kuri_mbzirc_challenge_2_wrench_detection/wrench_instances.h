@@ -0,0 +1,345 @@
+#ifndef KURI_MBZIRC_CHALLENGE_2_WRENCH_DETECTION_WRENCH_INSTANCES_H_
+#define KURI_MBZIRC_CHALLENGE_2_WRENCH_DETECTION_WRENCH_INSTANCES_H_
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+#include <stdint.h>
+
+#include <Eigen/Dense>
+#include <Eigen/Geometry>
+#include <geometry_msgs/Pose.h>
+#include <pcl/point_cloud.h>
+
+#include <kuri_mbzirc_challenge_2_wrench_detection/plane_segmentation.h>
+
+struct WrenchInstance
+{
+  int pixel_count;
+  Eigen::Vector3f centroid;
+  Eigen::Vector3f axis;         // Principal axis, from the handle towards the head
+  Eigen::Vector3f normal;       // Smallest axis, towards the camera
+  Eigen::Vector3f grasp_point;  // On the handle
+  float length;                 // Extent along the axis (m)
+  float width;                  // Extent across the axis (m)
+};
+
+
+/**
+ * Splits the off-plane (wrench) mask of an organized cloud into separate
+ * wrenches.
+ *
+ * The first pass labels the mask with 4-connected union-find. Neighbours are
+ * joined only if their depth differs by less than max_depth_jump_. The first
+ * and second order moments are accumulated per provisional label in the same
+ * pass and merged into the root labels afterwards, so the PCA of each wrench
+ * needs no extra pass. A second pass over the labelled pixels measures the
+ * extents along the principal axes and the skew along the main axis. A
+ * wrench's head is heavier than its handle, so the skew tells the two ends
+ * apart.
+ */
+template <typename PointT>
+class WrenchInstanceSegmenter
+{
+public:
+  typedef pcl::PointCloud<PointT> Cloud;
+
+  WrenchInstanceSegmenter():
+    min_pixels_(200),
+    max_depth_jump_(0.03),
+    grasp_position_(0.3)
+  { }
+
+  void setMinPixels(int n)            { min_pixels_ = n; }
+  void setMaxDepthJump(double d)      { max_depth_jump_ = d; }
+  void setGraspPosition(double ratio) { grasp_position_ = ratio; }
+
+  // Pixel labels of the last call: the index of the pixel's wrench in the
+  // returned instances, -1 for background or small components
+  const std::vector<int>& labels() { return labels_; }
+
+  void segment(const Cloud& cloud, const std::vector<uint8_t>& mask, uint32_t width, uint32_t height,
+               std::vector<WrenchInstance>& instances)
+  {
+    instances.clear();
+
+    size_t n = size_t(width)*height;
+    if (mask.size() != n || cloud.points.size() != n)
+      return;
+
+    labels_.assign(n, -1);
+    parent_.clear();
+    moments_.clear();
+
+    // ============
+    // Pass 1: provisional labels and moments
+    // ============
+    for (uint32_t v=0; v < height; v++)
+    {
+      for (uint32_t u=0; u < width; u++)
+      {
+        size_t idx = v*width + u;
+        const PointT& p = cloud.points[idx];
+        if (mask[idx] != MASK_SET || !pcl_isfinite(p.z))
+          continue;
+
+        int left = (u > 0) ? neighbourLabel(cloud, idx, idx-1) : -1;
+        int up   = (v > 0) ? neighbourLabel(cloud, idx, idx-width) : -1;
+
+        int label;
+        if (left < 0 && up < 0)
+        {
+          label = parent_.size();
+          parent_.push_back(label);
+          moments_.push_back(Moments());
+        }
+        else if (left >= 0 && up >= 0)
+        {
+          label = left;
+          unite(left, up);
+        }
+        else
+        {
+          label = std::max(left, up);
+        }
+
+        labels_[idx] = label;
+        moments_[label].add(p);
+      }
+    }
+
+    // Merge the moments into the roots
+    for (size_t l=0; l < parent_.size(); l++)
+    {
+      int root = find(l);
+      if (root != (int)l)
+        moments_[root].merge(moments_[l]);
+    }
+
+    // ============
+    // PCA per component
+    // ============
+    std::vector<int> instance_of(parent_.size(), -1);
+    std::vector<Extents> extents;
+
+    for (size_t l=0; l < parent_.size(); l++)
+    {
+      if (parent_[l] != (int)l || moments_[l].n < min_pixels_)
+        continue;
+
+      const Moments& m = moments_[l];
+      Eigen::Vector3d mean = m.sum/m.n;
+      Eigen::Matrix3d cov = m.sum_sq/m.n - mean*mean.transpose();
+
+      // Eigenvalues in increasing order
+      Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> solver(cov);
+
+      WrenchInstance w;
+      w.pixel_count = m.n;
+      w.centroid = mean.cast<float>();
+      w.axis = solver.eigenvectors().col(2).cast<float>();
+      w.normal = solver.eigenvectors().col(0).cast<float>();
+      if (w.normal.dot(w.centroid) > 0)
+        w.normal = -w.normal;
+
+      instance_of[l] = instances.size();
+      instances.push_back(w);
+    }
+
+    // Left to right in the camera frame. Sorted before pass 2 so that the
+    // pixel labels are written with the final instance indices.
+    order_.resize(instances.size());
+    for (size_t i=0; i < order_.size(); i++)
+      order_[i] = i;
+    std::stable_sort(order_.begin(), order_.end(), LeftOf(instances));
+
+    rank_.resize(order_.size());
+    sorted_.resize(order_.size());
+    for (size_t i=0; i < order_.size(); i++)
+    {
+      rank_[ order_[i] ] = i;
+      sorted_[i] = instances[ order_[i] ];
+    }
+    instances.swap(sorted_);
+
+    for (size_t l=0; l < instance_of.size(); l++)
+      if (instance_of[l] >= 0)
+        instance_of[l] = rank_[ instance_of[l] ];
+
+    extents.resize(instances.size());
+
+    // ============
+    // Pass 2: final labels, extents and skew
+    // ============
+    for (size_t idx=0; idx < n; idx++)
+    {
+      if (labels_[idx] < 0)
+        continue;
+
+      int inst = instance_of[ find(labels_[idx]) ];
+      labels_[idx] = inst;
+      if (inst < 0)
+        continue;
+
+      const WrenchInstance& w = instances[inst];
+      const PointT& p = cloud.points[idx];
+      Eigen::Vector3f d = Eigen::Vector3f(p.x, p.y, p.z) - w.centroid;
+
+      float t = d.dot(w.axis);
+      float s = d.dot(w.normal.cross(w.axis));
+      extents[inst].add(t, s);
+    }
+
+    for (size_t i=0; i < instances.size(); i++)
+    {
+      WrenchInstance& w = instances[i];
+      const Extents& e = extents[i];
+
+      w.length = e.t_max - e.t_min;
+      w.width  = e.s_max - e.s_min;
+
+      // Negative skew: the mass (head) is at +t and the tail (handle) at -t
+      float t_grasp;
+      if (e.sum_t3 < 0)
+      {
+        t_grasp = e.t_min + grasp_position_*w.length;
+      }
+      else
+      {
+        t_grasp = e.t_max - grasp_position_*w.length;
+        w.axis = -w.axis;
+        t_grasp = -t_grasp;
+      }
+
+      w.grasp_point = w.centroid + t_grasp*w.axis;
+    }
+  }
+
+protected:
+  struct Moments
+  {
+    int n;
+    Eigen::Vector3d sum;
+    Eigen::Matrix3d sum_sq;
+
+    Moments(): n(0), sum(Eigen::Vector3d::Zero()), sum_sq(Eigen::Matrix3d::Zero()) { }
+
+    void add(const PointT& p)
+    {
+      Eigen::Vector3d x(p.x, p.y, p.z);
+      n++;
+      sum += x;
+      sum_sq += x*x.transpose();
+    }
+
+    void merge(const Moments& o)
+    {
+      n += o.n;
+      sum += o.sum;
+      sum_sq += o.sum_sq;
+    }
+  };
+
+  struct Extents
+  {
+    float t_min, t_max, s_min, s_max;
+    double sum_t3;
+
+    Extents():
+      t_min(std::numeric_limits<float>::max()), t_max(-std::numeric_limits<float>::max()),
+      s_min(std::numeric_limits<float>::max()), s_max(-std::numeric_limits<float>::max()),
+      sum_t3(0)
+    { }
+
+    void add(float t, float s)
+    {
+      t_min = std::min(t_min, t);
+      t_max = std::max(t_max, t);
+      s_min = std::min(s_min, s);
+      s_max = std::max(s_max, s);
+      sum_t3 += double(t)*t*t;
+    }
+  };
+
+  int    min_pixels_;
+  double max_depth_jump_;
+  double grasp_position_;   // Fraction of the length from the handle end
+
+  std::vector<int> labels_;
+  std::vector<int> parent_;
+  std::vector<Moments> moments_;
+  std::vector<int> order_;      // Instance indices in left to right order
+  std::vector<int> rank_;       // Left to right position of each instance
+  std::vector<WrenchInstance> sorted_;
+
+  int find(int l)
+  {
+    while (parent_[l] != l)
+    {
+      parent_[l] = parent_[ parent_[l] ];
+      l = parent_[l];
+    }
+    return l;
+  }
+
+  void unite(int a, int b)
+  {
+    a = find(a);
+    b = find(b);
+    if (a == b)
+      return;
+
+    // Keep the smaller label as root so that labels stay in scan order
+    if (a < b)
+      parent_[b] = a;
+    else
+      parent_[a] = b;
+  }
+
+  inline int neighbourLabel(const Cloud& cloud, size_t idx, size_t neighbour)
+  {
+    int label = labels_[neighbour];
+    if (label < 0)
+      return -1;
+
+    if (std::fabs(cloud.points[idx].z - cloud.points[neighbour].z) > max_depth_jump_)
+      return -1;
+
+    return label;
+  }
+
+  struct LeftOf
+  {
+    const std::vector<WrenchInstance>& instances;
+
+    LeftOf(const std::vector<WrenchInstance>& instances): instances(instances) { }
+
+    bool operator()(int a, int b) const
+    {
+      return instances[a].centroid[0] < instances[b].centroid[0];
+    }
+  };
+};
+
+// Grasp pose: x-axis from the handle to the head, z-axis out of the panel
+static inline void wrenchGraspPose(const WrenchInstance& w, geometry_msgs::Pose& pose)
+{
+  Eigen::Vector3f z = w.normal;
+  Eigen::Vector3f x = (w.axis - w.axis.dot(z)*z).normalized();
+  Eigen::Matrix3f R;
+  R.col(0) = x;
+  R.col(1) = z.cross(x);
+  R.col(2) = z;
+
+  Eigen::Quaternionf q(R);
+  pose.position.x = w.grasp_point[0];
+  pose.position.y = w.grasp_point[1];
+  pose.position.z = w.grasp_point[2];
+  pose.orientation.x = q.x();
+  pose.orientation.y = q.y();
+  pose.orientation.z = q.z();
+  pose.orientation.w = q.w();
+}
+
+#endif
@@ -33,26 +33,36 @@
 #include <pcl_ros/point_cloud.h>
 #include <pcl/point_types.h>
 #include <boost/foreach.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <kuri_mbzirc_challenge_2_wrench_detection/plane_segmentation.h>
+#include <kuri_mbzirc_challenge_2_wrench_detection/plane_tracker.h>
+#include <kuri_mbzirc_challenge_2_tools/async_logger.h>
+#include <kuri_mbzirc_challenge_2_tools/frame_mailbox.h>
+#include <kuri_mbzirc_challenge_2_tools/stats_reporter.h>
 
 ros::Publisher planePub;
 ros::Publisher wrenchPub;
+ros::Publisher planeMaskPub;
+ros::Publisher wrenchMaskPub;
 typedef pcl::PointCloud<pcl::PointXYZ> PointCloud;
 
-void cloud_cb(const sensor_msgs::PointCloud2ConstPtr& input)
+PlaneTracker<pcl::PointXYZ> tracker;
+PlaneSegmentationResult segmentation;
+StatsReporter* stats;
+bool track_plane;
+
+// Newest frame waiting for the worker thread
+FrameMailbox<sensor_msgs::PointCloud2> cloud_mailbox;
+
+void process_cloud(const sensor_msgs::PointCloud2ConstPtr& input)
 {
-  // Container for original & filtered data
-  pcl::PCLPointCloud2* cloud = new pcl::PCLPointCloud2; 
-  pcl::PCLPointCloud2 cloud_filtered;
-  // Convert to PCL data type
-  pcl_conversions::toPCL(*input, *cloud);
- 
   // Convert to ROS data type
   sensor_msgs::PointCloud2 planeOutput,wrenchOutput;
-  pcl_conversions::fromPCL(cloud_filtered, planeOutput);
   //planeOutput = *input;
   //wrenchOutput = *input;
 
-  ROS_INFO("Received Data");
+  KURI_DEBUG("Received Data");
     
   pcl::PCLPointCloud2 pcl_pc2;
   pcl_conversions::toPCL(*input,pcl_pc2);
@@ -60,18 +70,27 @@ void cloud_cb(const sensor_msgs::PointCloud2ConstPtr& input)
   pcl::PointCloud<pcl::PointXYZ>::Ptr inputCloud(new pcl::PointCloud<pcl::PointXYZ>);
   pcl::fromPCLPointCloud2(pcl_pc2,*inputCloud);
     
-  pcl::ModelCoefficients::Ptr coefficients (new pcl::ModelCoefficients);
-  pcl::PointIndices::Ptr inliers (new pcl::PointIndices);
-  // Create the segmentation object
-  pcl::SACSegmentation<pcl::PointXYZ> seg;
-   // Optional
-  seg.setOptimizeCoefficients (true);
-  // Mandatory
-  seg.setModelType (pcl::SACMODEL_PLANE);
-  seg.setMethodType (pcl::SAC_RANSAC);
-  seg.setDistanceThreshold (0.01);
-  seg.setInputCloud(inputCloud);
-  seg.segment (*inliers, *coefficients);
+  // Find the panel plane and the image-indexed plane/wrench masks
+  if (track_plane)
+  {
+    tracker.segment(inputCloud, segmentation);
+
+    reportPlaneTrackerStats(tracker.stats(), stats);
+  }
+  else
+  {
+    tracker.segmenter().segment(inputCloud, segmentation);
+  }
+  pcl::ModelCoefficients::Ptr coefficients (new pcl::ModelCoefficients(segmentation.coefficients));
+  pcl::PointIndices::Ptr inliers (new pcl::PointIndices(segmentation.inliers));
+
+  sensor_msgs::Image planeMask, wrenchMask;
+  maskToImageMsg(segmentation.plane_mask, segmentation.width, segmentation.height, planeMask);
+  maskToImageMsg(segmentation.wrench_mask, segmentation.width, segmentation.height, wrenchMask);
+  planeMask.header = input->header;
+  wrenchMask.header = input->header;
+  planeMaskPub.publish(planeMask);
+  wrenchMaskPub.publish(wrenchMask);
 
   // Create the filtering object
   pcl::ExtractIndices<pcl::PointXYZ> extract;
@@ -80,18 +99,19 @@ void cloud_cb(const sensor_msgs::PointCloud2ConstPtr& input)
 
   if (inliers->indices.size () == 0)
   {
-    PCL_ERROR ("Could not estimate a planar model for the given dataset.");
+    KURI_WARN_THROTTLE(1.0, "Could not estimate a planar model for the given dataset.");
   }
   else
   {
-    std::cerr << "Model coefficients: " << coefficients->values[0] << " " << coefficients->values[1] << " "<< coefficients->values[2] << " " << coefficients->values[3] << std::endl;
-    std::cerr << "Model inliers: " << inliers->indices.size () << std::endl;
+    KURI_INFO_THROTTLE(1.0, "Model coefficients: %f %f %f %f, inliers: %lu",
+                       coefficients->values[0], coefficients->values[1], coefficients->values[2], coefficients->values[3],
+                       (unsigned long) inliers->indices.size ());
     // Extract the inliers
     extract.setInputCloud (inputCloud);
     extract.setIndices (inliers);
     extract.setNegative (false);
     extract.filter (*planePoints);
-    std::cerr << "PointCloud representing the planar component: " << planePoints->width * planePoints->height << " data points." << std::endl;
+    KURI_DEBUG("PointCloud representing the planar component: %u data points.", planePoints->width * planePoints->height);
 
     pcl::toROSMsg(*planePoints, planeOutput);
     planeOutput.header.frame_id = "camera_rgb_optical_frame";
@@ -100,9 +120,11 @@ void cloud_cb(const sensor_msgs::PointCloud2ConstPtr& input)
     //std::cerr << "depth: "<< planeOutput->fields << std::endl;
     //ROS_INFO(planeOutput.z())
 
-    printf ("Cloud: width = %d, height = %d\n", planePoints->width, planePoints->height);
+#if KURI_LOG_LEVEL <= KURI_LOG_LEVEL_DEBUG
+    KURI_DEBUG("Cloud: width = %d, height = %d", planePoints->width, planePoints->height);
     BOOST_FOREACH (const pcl::PointXYZ& pt, planePoints->points)
-    printf ("\t(%f, %f, %f)\n", pt.x, pt.y, pt.z);
+      KURI_DEBUG("\t(%f, %f, %f)", pt.x, pt.y, pt.z);
+#endif
 
     planePub.publish(planeOutput);
     // Extract the outliers
@@ -110,7 +132,7 @@ void cloud_cb(const sensor_msgs::PointCloud2ConstPtr& input)
     extract.setIndices (inliers);
     extract.setNegative (true);
     extract.filter (*wrenchPoints);
-    std::cerr << "PointCloud representing the wrench component: " << wrenchPoints->width * wrenchPoints->height << " data points." << std::endl;
+    KURI_DEBUG("PointCloud representing the wrench component: %u data points.", wrenchPoints->width * wrenchPoints->height);
 
     pcl::toROSMsg(*wrenchPoints, wrenchOutput);
     planeOutput.header.frame_id = "camera_rgb_optical_frame";
@@ -127,6 +149,11 @@ void cloud_cb(const sensor_msgs::PointCloud2ConstPtr& input)
 
 }
 
+// Subscriber side: only hand the newest frame to the worker
+void cloud_cb(const sensor_msgs::PointCloud2ConstPtr& input)
+{
+  cloud_mailbox.post(input);
+}
 
 
 int main (int argc, char** argv)
@@ -135,13 +162,39 @@ int main (int argc, char** argv)
   // Initialize ROS
   ros::init (argc, argv, "kuri_wrench_detection");
   ros::NodeHandle nh;
+  ros::NodeHandle nh_private("~");
   std::string topic = nh.resolveName("point_cloud");;
+
+  // Plane segmentation mode: "ransac" (default) or "organized"
+  std::string mode_name;
+  PlaneSegmentationMode mode;
+  nh_private.param<std::string>("segmentation_mode", mode_name, "ransac");
+  if (!PlaneSegmenter<pcl::PointXYZ>::parseMode(mode_name, mode))
+  {
+    ROS_ERROR("Unknown segmentation_mode \"%s\". Expected \"ransac\" or \"organized\"", mode_name.c_str());
+    return -1;
+  }
+  tracker.segmenter().setMode(mode);
+  ROS_INFO("Using %s plane segmentation", mode_name.c_str());
+
+  // Seed each frame with the previous plane, falling back to a full search when it no longer fits
+  nh_private.param("track_plane", track_plane, true);
+  stats = new StatsReporter("wrench_detection/plane_tracker");
+
   // Create a ROS subscriber for the input point cloud
   // ros::Subscriber sub = nh.subscribe ("/camera/depth_registered/points", 1, cloud_cb);
   ros::Subscriber sub = nh.subscribe ("/kinect2/qhd/points", 1, cloud_cb);
   planePub      = nh.advertise<sensor_msgs::PointCloud2>("/plane_points", 1);
   wrenchPub     = nh.advertise<sensor_msgs::PointCloud2>("/wrench_points", 1);
+  planeMaskPub  = nh.advertise<sensor_msgs::Image>("/plane_mask", 1);
+  wrenchMaskPub = nh.advertise<sensor_msgs::Image>("/wrench_mask", 1);
+
+  // The callback only posts frames, the worker processes the newest one
+  boost::thread worker(boost::bind(&frameWorker<sensor_msgs::PointCloud2>, &cloud_mailbox, &process_cloud, stats));
 
   // Spin
   ros::spin ();
+
+  cloud_mailbox.close();
+  worker.join();
 }
@@ -22,6 +22,7 @@
 #include <ros/ros.h>
 #include <sensor_msgs/PointCloud2.h>
 #include <sensor_msgs/Image.h>
+#include <sensor_msgs/CameraInfo.h>
 #include <pcl_conversions/pcl_conversions.h>
 #include <pcl/point_cloud.h>
 #include <pcl/point_types.h>
@@ -34,28 +35,49 @@
 #include <pcl/filters/extract_indices.h>
 #include <pcl_ros/point_cloud.h>
 #include <pcl/point_types.h>
+#include <boost/thread/thread.hpp>
+
+#include <kuri_mbzirc_challenge_2_msgs/WrenchDetectionResult.h>
+#include <kuri_mbzirc_challenge_2_wrench_detection/depth_wrench_detector.h>
+#include <kuri_mbzirc_challenge_2_wrench_detection/plane_segmentation.h>
+#include <kuri_mbzirc_challenge_2_wrench_detection/plane_tracker.h>
+#include <kuri_mbzirc_challenge_2_tools/async_logger.h>
+#include <kuri_mbzirc_challenge_2_tools/frame_mailbox.h>
+#include <kuri_mbzirc_challenge_2_tools/stats_reporter.h>
 
 ros::Publisher planePub;
 ros::Publisher wrenchPub;
+ros::Publisher planeMaskPub;
+ros::Publisher wrenchMaskPub;
 ros::Publisher wrench_img_Pub;
+ros::Publisher wrenchRoiPub;
 typedef pcl::PointCloud<pcl::PointXYZRGB> PointCloud;
 
-void cloud_cb(const sensor_msgs::PointCloud2ConstPtr& input)
+PlaneTracker<pcl::PointXYZRGB> tracker;
+PlaneSegmentationResult segmentation;
+StatsReporter* stats;
+bool track_plane;
+
+// Newest frame waiting for the worker thread
+FrameMailbox<sensor_msgs::PointCloud2> cloud_mailbox;
+
+DepthWrenchDetector depth_detector;
+DepthWrenchResult depth_result;
+FrameMailbox<sensor_msgs::Image> depth_mailbox;
+
+// Latest intrinsics, applied by the worker before each depth frame
+boost::mutex camera_info_mutex;
+sensor_msgs::CameraInfoConstPtr camera_info;
+
+void process_cloud(const sensor_msgs::PointCloud2ConstPtr& input)
 {
-  // Container for original & filtered data
-  pcl::PCLPointCloud2* cloud = new pcl::PCLPointCloud2; 
-  pcl::PCLPointCloud2 cloud_filtered;
-  // Convert to PCL data type
-  pcl_conversions::toPCL(*input, *cloud);
- 
   // Convert to ROS data type
   sensor_msgs::Image wrenchOutputImg; 
   sensor_msgs::PointCloud2 planeOutput,wrenchOutput;
-  pcl_conversions::fromPCL(cloud_filtered, planeOutput);
   //planeOutput = *input;
   //wrenchOutput = *input;
 
-  ROS_INFO("Received Data");
+  KURI_DEBUG("Received Data");
     
   pcl::PCLPointCloud2 pcl_pc2;
   pcl_conversions::toPCL(*input,pcl_pc2);
@@ -63,18 +85,27 @@ void cloud_cb(const sensor_msgs::PointCloud2ConstPtr& input)
   pcl::PointCloud<pcl::PointXYZRGB>::Ptr inputCloud(new pcl::PointCloud<pcl::PointXYZRGB>);
   pcl::fromPCLPointCloud2(pcl_pc2,*inputCloud);
     
-  pcl::ModelCoefficients::Ptr coefficients (new pcl::ModelCoefficients);
-  pcl::PointIndices::Ptr inliers (new pcl::PointIndices);
-  // Create the segmentation object
-  pcl::SACSegmentation<pcl::PointXYZRGB> seg;
-   // Optional
-  seg.setOptimizeCoefficients (true);
-  // Mandatory
-  seg.setModelType (pcl::SACMODEL_PLANE);
-  seg.setMethodType (pcl::SAC_RANSAC);
-  seg.setDistanceThreshold (0.01);
-  seg.setInputCloud(inputCloud);
-  seg.segment (*inliers, *coefficients);
+  // Find the panel plane and the image-indexed plane/wrench masks
+  if (track_plane)
+  {
+    tracker.segment(inputCloud, segmentation);
+
+    reportPlaneTrackerStats(tracker.stats(), stats);
+  }
+  else
+  {
+    tracker.segmenter().segment(inputCloud, segmentation);
+  }
+  pcl::ModelCoefficients::Ptr coefficients (new pcl::ModelCoefficients(segmentation.coefficients));
+  pcl::PointIndices::Ptr inliers (new pcl::PointIndices(segmentation.inliers));
+
+  sensor_msgs::Image planeMask, wrenchMask;
+  maskToImageMsg(segmentation.plane_mask, segmentation.width, segmentation.height, planeMask);
+  maskToImageMsg(segmentation.wrench_mask, segmentation.width, segmentation.height, wrenchMask);
+  planeMask.header = input->header;
+  wrenchMask.header = input->header;
+  planeMaskPub.publish(planeMask);
+  wrenchMaskPub.publish(wrenchMask);
 
   // Create the filtering object
   pcl::ExtractIndices<pcl::PointXYZRGB> extract;
@@ -83,19 +114,20 @@ void cloud_cb(const sensor_msgs::PointCloud2ConstPtr& input)
 
   if (inliers->indices.size () == 0)
   {
-    PCL_ERROR ("Could not estimate a planar model for the given dataset.");
+    KURI_WARN_THROTTLE(1.0, "Could not estimate a planar model for the given dataset.");
   }
   else
   {
-    std::cerr << "Model coefficients: " << coefficients->values[0] << " " << coefficients->values[1] << " "<< coefficients->values[2] << " " << coefficients->values[3] << std::endl;
-    std::cerr << "Model inliers: " << inliers->indices.size () << std::endl;
+    KURI_INFO_THROTTLE(1.0, "Model coefficients: %f %f %f %f, inliers: %lu",
+                       coefficients->values[0], coefficients->values[1], coefficients->values[2], coefficients->values[3],
+                       (unsigned long) inliers->indices.size ());
     // Extract the inliers
     extract.setInputCloud (inputCloud);
     extract.setIndices (inliers);
     extract.setKeepOrganized (true); 	
     extract.setNegative (false);
     extract.filter (*planePoints);
-    std::cerr << "PointCloud representing the planar component: " << planePoints->width * planePoints->height << " data points." << std::endl;
+    KURI_DEBUG("PointCloud representing the planar component: %u data points.", planePoints->width * planePoints->height);
 
     pcl::toROSMsg(*planePoints, planeOutput);
     //planeOutput.header.frame_id = "camera_rgb_optical_frame";
@@ -108,7 +140,7 @@ void cloud_cb(const sensor_msgs::PointCloud2ConstPtr& input)
     extract.setKeepOrganized (true); 
     extract.setNegative (true);
     extract.filter (*wrenchPoints);
-    std::cerr << "PointCloud representing the wrench component: " << wrenchPoints->width * wrenchPoints->height << " data points." << std::endl;
+    KURI_DEBUG("PointCloud representing the wrench component: %u data points.", wrenchPoints->width * wrenchPoints->height);
 
     pcl::toROSMsg(*wrenchPoints, wrenchOutput);
     pcl::toROSMsg(*wrenchPoints, wrenchOutputImg);
@@ -127,6 +159,74 @@ void cloud_cb(const sensor_msgs::PointCloud2ConstPtr& input)
 
 }
 
+// Subscriber side: only hand the newest frame to the worker
+void cloud_cb(const sensor_msgs::PointCloud2ConstPtr& input)
+{
+  cloud_mailbox.post(input);
+}
+
+
+void camera_info_cb(const sensor_msgs::CameraInfoConstPtr& info)
+{
+  boost::mutex::scoped_lock lock(camera_info_mutex);
+  camera_info = info;
+}
+
+void depth_cb(const sensor_msgs::ImageConstPtr& depth)
+{
+  depth_mailbox.post(depth);
+}
+
+void process_depth(const sensor_msgs::ImageConstPtr& depth)
+{
+  {
+    boost::mutex::scoped_lock lock(camera_info_mutex);
+    if (camera_info)
+      depth_detector.setCameraInfo(*camera_info);
+  }
+
+  if (!depth_detector.hasCameraInfo())
+  {
+    KURI_WARN_THROTTLE(1.0, "Waiting for camera_info");
+    return;
+  }
+
+  if (!DepthWrenchDetector::isSupported(*depth))
+  {
+    KURI_ERROR_THROTTLE(1.0, "Unsupported depth encoding \"%s\"%s. Expected little-endian 16UC1 or 32FC1",
+                        depth->encoding.c_str(), depth->is_bigendian ? " (big-endian)" : "");
+    return;
+  }
+
+  ros::WallTime start = ros::WallTime::now();
+  depth_detector.detect(*depth, depth_result, track_plane);
+
+  // The tracker only counts the frames it tracks
+  stats->increment("frames");
+  stats->set("tracker_hit_rate", depth_detector.tracker().stats().hitRate());
+  stats->set("latency_ms", (ros::WallTime::now() - start).toSec()*1000);
+  stats->set("roi_points", depth_result.roi_points.size());
+
+  sensor_msgs::Image wrenchMask;
+  maskToImageMsg(depth_result.wrench_mask, depth_result.width, depth_result.height, wrenchMask);
+  wrenchMask.header = depth->header;
+  wrenchMaskPub.publish(wrenchMask);
+
+  if (!depth_result.found)
+  {
+    KURI_WARN_THROTTLE(1.0, "No wrench pixels found in front of the panel");
+    return;
+  }
+
+  sensor_msgs::Image wrenchOutputImg;
+  DepthWrenchDetector::cropImage(*depth, depth_result.roi_x, depth_result.roi_y,
+                                 depth_result.roi_width, depth_result.roi_height, wrenchOutputImg);
+  wrench_img_Pub.publish(wrenchOutputImg);
+
+  kuri_mbzirc_challenge_2_msgs::WrenchDetectionResult roi;
+  roi.ROI = depth_result.roi_points;
+  wrenchRoiPub.publish(roi);
+}
 
 
 int main (int argc, char** argv)
@@ -135,14 +235,67 @@ int main (int argc, char** argv)
   // Initialize ROS
   ros::init (argc, argv, "kuri_wrench_detection");
   ros::NodeHandle nh;
+  ros::NodeHandle nh_private("~");
   std::string topic = nh.resolveName("point_cloud");;
-  // Create a ROS subscriber for the input point cloud
-  // ros::Subscriber sub = nh.subscribe ("/camera/depth_registered/points", 1, cloud_cb);
-  ros::Subscriber sub = nh.subscribe ("/camera/depth/points", 1, cloud_cb);
+
+  // Plane segmentation mode: "ransac" (default) or "organized"
+  std::string mode_name;
+  PlaneSegmentationMode mode;
+  nh_private.param<std::string>("segmentation_mode", mode_name, "ransac");
+  if (!PlaneSegmenter<pcl::PointXYZRGB>::parseMode(mode_name, mode))
+  {
+    ROS_ERROR("Unknown segmentation_mode \"%s\". Expected \"ransac\" or \"organized\"", mode_name.c_str());
+    return -1;
+  }
+  tracker.segmenter().setMode(mode);
+  ROS_INFO("Using %s plane segmentation", mode_name.c_str());
+
+  // Seed each frame with the previous plane, falling back to a full search when it no longer fits
+  nh_private.param("track_plane", track_plane, true);
+  stats = new StatsReporter("wrench_detection/plane_tracker");
+
+  // Input: "cloud" (default) for the XYZRGB cloud, "depth" for the raw depth image and intrinsics
+  std::string input_mode;
+  nh_private.param<std::string>("input_mode", input_mode, "cloud");
+
+  ros::Subscriber sub, depth_sub, info_sub;
+  boost::thread worker;
+  if (input_mode == "cloud")
+  {
+    // Create a ROS subscriber for the input point cloud
+    // ros::Subscriber sub = nh.subscribe ("/camera/depth_registered/points", 1, cloud_cb);
+    sub = nh.subscribe ("/camera/depth/points", 1, cloud_cb);
+    worker = boost::thread(boost::bind(&frameWorker<sensor_msgs::PointCloud2>, &cloud_mailbox, &process_cloud, stats));
+  }
+  else if (input_mode == "depth")
+  {
+    int grid_step;
+    nh_private.param("grid_step", grid_step, 8);
+    depth_detector.setGridStep(grid_step);
+    depth_detector.tracker().segmenter().setMode(mode);
+
+    depth_sub = nh.subscribe ("/camera/depth/image_raw", 1, depth_cb);
+    info_sub  = nh.subscribe ("/camera/depth/camera_info", 1, camera_info_cb);
+    worker = boost::thread(boost::bind(&frameWorker<sensor_msgs::Image>, &depth_mailbox, &process_depth, stats));
+  }
+  else
+  {
+    ROS_ERROR("Unknown input_mode \"%s\". Expected \"cloud\" or \"depth\"", input_mode.c_str());
+    return -1;
+  }
+  ROS_INFO("Using %s input", input_mode.c_str());
+
   planePub      = nh.advertise<sensor_msgs::PointCloud2>("/plane_points", 1);
   wrenchPub     = nh.advertise<sensor_msgs::PointCloud2>("/wrench_points", 1);
+  planeMaskPub  = nh.advertise<sensor_msgs::Image>("/plane_mask", 1);
+  wrenchMaskPub = nh.advertise<sensor_msgs::Image>("/wrench_mask", 1);
   wrench_img_Pub     = nh.advertise<sensor_msgs::Image>("/wrench_image", 30);
+  wrenchRoiPub  = nh.advertise<kuri_mbzirc_challenge_2_msgs::WrenchDetectionResult>("/wrench_roi", 1);
 
-  // Spin
+  // Spin. The callbacks only post frames, the worker does the processing
   ros::spin ();
+
+  cloud_mailbox.close();
+  depth_mailbox.close();
+  worker.join();
 }
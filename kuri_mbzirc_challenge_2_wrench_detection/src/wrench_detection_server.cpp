@@ -0,0 +1,195 @@
+#include <ros/ros.h>
+#include <sensor_msgs/PointCloud2.h>
+#include <geometry_msgs/PoseArray.h>
+#include <pcl_conversions/pcl_conversions.h>
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <actionlib/server/simple_action_server.h>
+#include <kuri_mbzirc_challenge_2_msgs/WrenchDetectionAction.h>
+
+#include <kuri_mbzirc_challenge_2_wrench_detection/plane_segmentation.h>
+#include <kuri_mbzirc_challenge_2_wrench_detection/plane_tracker.h>
+#include <kuri_mbzirc_challenge_2_wrench_detection/wrench_instances.h>
+#include <kuri_mbzirc_challenge_2_tools/async_logger.h>
+#include <kuri_mbzirc_challenge_2_tools/stats_reporter.h>
+
+typedef pcl::PointXYZ PcPoint;
+typedef pcl::PointCloud<PcPoint> PcCloud;
+
+/**
+ * Runs plane segmentation and wrench instance segmentation on every Kinect
+ * frame. A goal is answered with the first frame received after it was
+ * accepted.
+ */
+class WrenchDetectionServer
+{
+protected:
+  ros::NodeHandle nh_;
+  actionlib::SimpleActionServer<kuri_mbzirc_challenge_2_msgs::WrenchDetectionAction> as_; // NodeHandle instance must be created before this line. Otherwise strange error occurs.
+  std::string action_name_;
+
+  ros::Subscriber sub_cloud_;
+  ros::Publisher pub_grasp_poses_;
+
+  PlaneTracker<PcPoint> tracker_;
+  PlaneSegmentationResult segmentation_;
+  WrenchInstanceSegmenter<PcPoint> instance_segmenter_;
+  std::vector<WrenchInstance> instances_;
+  StatsReporter stats_;
+
+  // Latest result, shared with the action thread
+  boost::mutex mutex_;
+  boost::condition_variable frame_cond_;
+  kuri_mbzirc_challenge_2_msgs::WrenchDetectionResult latest_result_;
+  ros::Time latest_time_;   // Capture stamp of the cloud latest_result_ comes from
+  double timeout_;
+
+public:
+  WrenchDetectionServer(std::string name) :
+    as_(nh_, name, boost::bind(&WrenchDetectionServer::executeCB, this, _1), false),
+    action_name_(name),
+    stats_("wrench_detection/instances")
+  {
+    ros::NodeHandle nh_private("~");
+
+    std::string mode_name;
+    PlaneSegmentationMode mode;
+    nh_private.param<std::string>("segmentation_mode", mode_name, "organized");
+    if (!PlaneSegmenter<PcPoint>::parseMode(mode_name, mode))
+    {
+      ROS_WARN("Unknown segmentation_mode \"%s\", using \"organized\"", mode_name.c_str());
+      mode = SEGMENTATION_ORGANIZED;
+    }
+    tracker_.segmenter().setMode(mode);
+
+    int min_pixels;
+    double max_depth_jump;
+    nh_private.param("min_wrench_pixels", min_pixels, 200);
+    nh_private.param("max_depth_jump", max_depth_jump, 0.03);
+    nh_private.param("timeout", timeout_, 5.0);
+    instance_segmenter_.setMinPixels(min_pixels);
+    instance_segmenter_.setMaxDepthJump(max_depth_jump);
+
+    std::string cloud_topic;
+    nh_private.param<std::string>("cloud_topic", cloud_topic, "/camera/depth/points");
+
+    sub_cloud_ = nh_.subscribe(cloud_topic, 1, &WrenchDetectionServer::callbackCloud, this);
+    pub_grasp_poses_ = nh_.advertise<geometry_msgs::PoseArray>("/wrench_grasp_poses", 1);
+
+    ROS_INFO("Starting server for action %s", action_name_.c_str());
+    as_.start();
+  }
+
+  void callbackCloud(const sensor_msgs::PointCloud2ConstPtr& cloud_msg)
+  {
+    PcCloud::Ptr cloud (new PcCloud);
+    pcl::fromROSMsg (*cloud_msg, *cloud);
+
+    if (!cloud->isOrganized())
+    {
+      KURI_ERROR_THROTTLE(1.0, "Wrench instance segmentation needs an organized cloud");
+      return;
+    }
+
+    ros::WallTime start = ros::WallTime::now();
+
+    tracker_.segment(cloud, segmentation_);
+    instance_segmenter_.segment(*cloud, segmentation_.wrench_mask, segmentation_.width, segmentation_.height, instances_);
+
+    // Build the result
+    kuri_mbzirc_challenge_2_msgs::WrenchDetectionResult result;
+    result.grasp_poses.header = cloud_msg->header;
+
+    for (size_t i=0; i < instances_.size(); i++)
+    {
+      const WrenchInstance& w = instances_[i];
+
+      geometry_msgs::Pose pose;
+      wrenchGraspPose(w, pose);
+
+      result.ROI.push_back(pose.position);
+      result.grasp_poses.poses.push_back(pose);
+      result.lengths.push_back(w.length);
+      result.widths.push_back(w.width);
+    }
+
+    pub_grasp_poses_.publish(result.grasp_poses);
+
+    stats_.set("wrenches", instances_.size());
+    stats_.set("latency_ms", (ros::WallTime::now() - start).toSec()*1000);
+    stats_.set("tracker_hit_rate", tracker_.stats().hitRate());
+    stats_.publishIfDue();
+
+    KURI_DEBUG("Found %lu wrenches", (unsigned long) instances_.size());
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      latest_result_ = result;
+      latest_time_ = cloud_msg->header.stamp;
+    }
+    frame_cond_.notify_all();
+  }
+
+  void executeCB(const kuri_mbzirc_challenge_2_msgs::WrenchDetectionGoalConstPtr& goal)
+  {
+    ROS_INFO("Accepting Goal for action %s", action_name_.c_str());
+    ros::Time request_time = ros::Time::now();
+    ros::WallTime deadline = ros::WallTime::now() + ros::WallDuration(timeout_);
+
+    kuri_mbzirc_challenge_2_msgs::WrenchDetectionResult result;
+    bool received = false;
+
+    // Wait for a frame captured after the request
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      while (ros::ok() && !as_.isPreemptRequested() && ros::WallTime::now() < deadline)
+      {
+        if (latest_time_ >= request_time)
+        {
+          result = latest_result_;
+          received = true;
+          break;
+        }
+
+        frame_cond_.timed_wait(lock, boost::posix_time::milliseconds(100));
+      }
+    }
+
+    if (as_.isPreemptRequested() || !ros::ok())
+    {
+      ROS_INFO("%s: Preempted", action_name_.c_str());
+      as_.setPreempted();
+      return;
+    }
+
+    if (!received)
+    {
+      ROS_WARN("%s: No point cloud received within %.1f sec", action_name_.c_str(), timeout_);
+      as_.setAborted(result);
+      return;
+    }
+
+    if (result.grasp_poses.poses.empty())
+    {
+      ROS_INFO("%s: No wrenches found", action_name_.c_str());
+      as_.setAborted(result);
+      return;
+    }
+
+    ROS_INFO("%s: Found %lu wrenches", action_name_.c_str(), (unsigned long) result.grasp_poses.poses.size());
+    as_.setSucceeded(result);
+  }
+};
+
+int main(int argc, char** argv)
+{
+  ros::init(argc, argv, "wrench_detection_server");
+
+  WrenchDetectionServer server("wrench_detection");
+  ros::spin();
+  return 0;
+}